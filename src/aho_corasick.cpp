@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <deque>
+
+#include "aho_corasick.hpp"
+
+void LiteralAutomaton::add(std::string_view literal, uint32_t id)
+{
+	uint32_t node = 0;
+	for (const char c : literal)
+	{
+		const uint8_t byte = static_cast<uint8_t>(c);
+		uint32_t target = child(node, byte);
+		if (!target)
+		{
+			target = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			if (node == 0)
+				root_edges[byte] = target;
+			else
+				edges.emplace(edge_key(node, byte), target);
+		}
+		node = target;
+	}
+	pending.emplace_back(node, id);
+}
+
+void LiteralAutomaton::build()
+{
+	// Group the ids by node, keeping their order
+	std::stable_sort(pending.begin(), pending.end(),
+					 [](const auto& a, const auto& b) { return a.first < b.first; });
+	outputs.clear();
+	outputs.reserve(pending.size());
+	for (const auto& [node, id] : pending)
+	{
+		if (!nodes[node].output_count)
+			nodes[node].first_output = static_cast<uint32_t>(outputs.size());
+		nodes[node].output_count++;
+		outputs.push_back(id);
+	}
+	pending.clear();
+	pending.shrink_to_fit();
+
+	// Children of each node, edges being sorted by parent
+	std::vector<std::pair<uint64_t, uint32_t>> sorted_edges(edges.begin(), edges.end());
+	std::sort(sorted_edges.begin(), sorted_edges.end());
+
+	// Breadth first so that the fail target of a node is always done before it
+	std::deque<uint32_t> queue;
+	for (uint32_t c = 0; c < 256; c++)
+	{
+		if (const uint32_t target = root_edges[c])
+		{
+			nodes[target].fail = 0;
+			nodes[target].output_link = 0;
+			queue.push_back(target);
+		}
+	}
+	while (!queue.empty())
+	{
+		const uint32_t node = queue.front();
+		queue.pop_front();
+
+		auto it = std::lower_bound(sorted_edges.begin(), sorted_edges.end(),
+								   std::make_pair(edge_key(node, 0), uint32_t{0}));
+		for (; it != sorted_edges.end() && (it->first >> 8) == node; ++it)
+		{
+			const uint8_t c = static_cast<uint8_t>(it->first & 0xff);
+			const uint32_t target = it->second;
+			const uint32_t fail = next(nodes[node].fail, c);
+			nodes[target].fail = fail;
+			nodes[target].output_link =
+				nodes[fail].output_count ? fail : nodes[fail].output_link;
+			queue.push_back(target);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Aho-Corasick automaton finding every occurrence of a set of literals in a single pass over a
+// text, whatever the number of literals.
+class LiteralAutomaton
+{
+	struct Node
+	{
+		uint32_t fail = 0;
+		// Nearest node on the fail chain where a literal ends, 0 if none
+		uint32_t output_link = 0;
+		// Ids of the literals ending here, a range of outputs
+		uint32_t first_output = 0;
+		uint32_t output_count = 0;
+	};
+
+	// Node 0 is the root
+	std::vector<Node> nodes{Node{}};
+	// Children of the root, 0 if none
+	std::array<uint32_t, 256> root_edges{};
+	// Children of the other nodes, keyed by parent << 8 | byte
+	std::unordered_map<uint64_t, uint32_t> edges;
+	std::vector<uint32_t> outputs;
+	// Literal ids by the node where they end, until build
+	std::vector<std::pair<uint32_t, uint32_t>> pending;
+
+	static uint64_t edge_key(uint32_t node, uint8_t c)
+	{
+		return (static_cast<uint64_t>(node) << 8) | c;
+	}
+
+	uint32_t child(uint32_t node, uint8_t c) const
+	{
+		if (node == 0)
+			return root_edges[c];
+		const auto it = edges.find(edge_key(node, c));
+		return it == edges.end() ? 0 : it->second;
+	}
+
+	uint32_t next(uint32_t state, uint8_t c) const
+	{
+		while (state != 0)
+		{
+			if (const uint32_t target = child(state, c))
+				return target;
+			state = nodes[state].fail;
+		}
+		return root_edges[c];
+	}
+
+  public:
+	// Adds a non empty literal, reported with id
+	void add(std::string_view literal, uint32_t id);
+	// Computes the fail links, must be called after the last add and before scan
+	void build();
+
+	bool empty() const
+	{
+		return nodes.size() == 1;
+	}
+
+	// Calls fn(id, end) for each occurrence of a literal in text, end being the position right
+	// after the occurrence
+	template<typename Fn> void scan(std::string_view text, Fn&& fn) const
+	{
+		uint32_t state = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			state = next(state, static_cast<uint8_t>(text[i]));
+			for (uint32_t node = nodes[state].output_count ? state : nodes[state].output_link;
+				 node != 0; node = nodes[node].output_link)
+			{
+				const Node& output = nodes[node];
+				for (uint32_t j = 0; j < output.output_count; j++)
+					fn(outputs[output.first_output + j], i + 1);
+			}
+		}
+	}
+};
+
+#endif
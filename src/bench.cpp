@@ -0,0 +1,97 @@
+// Throughput of the matcher hot paths, per path depth.
+// Build and run with: xmake build bench && xmake run bench
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gitignore_parser.hpp"
+#include "simd_scan.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	constexpr std::string_view gitignore_content = "*.log\n"
+												   "build/\n"
+												   "/dist\n"
+												   "**/node_modules\n"
+												   "docs/**/*.pdf\n"
+												   "!important.log\n"
+												   "cache-*.tmp\n"
+												   "*.o\n";
+
+	std::vector<std::string> generate_paths(size_t depth, size_t count)
+	{
+		static const char* const names[] = {"src", "include", "node_modules", "build", "docs",
+											"components", "a", "very_long_directory_name"};
+		static const char* const files[] = {"main.cpp", "debug.log", "cache-01.tmp", "paper.pdf",
+											"important.log", "object.o", "README.md"};
+		std::mt19937 rng(static_cast<unsigned>(depth));
+		std::vector<std::string> paths;
+		paths.reserve(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			std::string path = "/bench/root";
+			for (size_t d = 0; d < depth; d++)
+			{
+				path += '/';
+				path += names[rng() % std::size(names)];
+			}
+			path += '/';
+			path += files[rng() % std::size(files)];
+			paths.push_back(std::move(path));
+		}
+		return paths;
+	}
+
+	template<typename Fn>
+	double paths_per_second(const std::vector<std::string>& paths, size_t rounds, Fn&& fn)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t round = 0; round < rounds; round++)
+		{
+			for (const auto& path : paths)
+				fn(path);
+		}
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return static_cast<double>(paths.size() * rounds) / elapsed.count();
+	}
+} // namespace
+
+int main()
+{
+	const GitIgnoreMatcher matcher(parse_gitignore_content(gitignore_content, "/bench/root"));
+	volatile size_t sink = 0;
+
+	std::printf("%-6s %-7s %16s %16s %16s\n", "depth", "level", "separators/s", "literal/s",
+				"is_ignored/s");
+	for (const size_t depth : {1, 2, 4, 8, 16, 32})
+	{
+		const auto paths = generate_paths(depth, 2000);
+		for (const ScanLevel level : {ScanLevel::scalar, ScanLevel::sse2, ScanLevel::avx2})
+		{
+			set_scan_level(level);
+			if (scan_level() != level)
+				continue;
+
+			const double separators = paths_per_second(paths, 200, [&](const std::string& path) {
+				for (size_t pos = find_separator(path); pos != std::string_view::npos;
+					 pos = find_separator(path, pos + 1))
+					sink = sink + pos;
+			});
+			const double literal = paths_per_second(paths, 200, [&](const std::string& path) {
+				sink = sink + find_literal(path, "node_modules");
+			});
+			const double ignored = paths_per_second(paths, 2, [&](const std::string& path) {
+				sink = sink + matcher.is_ignored(fs::path(path));
+			});
+			std::printf("%-6zu %-7s %16.0f %16.0f %16.0f\n", depth, scan_level_name(level),
+						separators, literal, ignored);
+		}
+	}
+	set_scan_level(best_scan_level());
+	return 0;
+}
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <charconv>
+#include <exception>
+
+#include "daemon.hpp"
+#include "folder_list.hpp"
+#include "ipc.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+Daemon::Daemon(MatcherCache& cache, FolderLister lister, tb_fwatcher_ref_t watcher,
+			   size_t thread_count)
+	: matcher_cache(cache), folder_lister(std::move(lister)), fwatcher(watcher),
+	  folders(std::make_shared<const ManagedFolders>()), pool(thread_count)
+{
+}
+
+Daemon::~Daemon()
+{
+	// Stopping the folders first cancels their walks, the queued jobs then find them stopped
+	stop();
+	wait_idle();
+}
+
+void Daemon::set_folders(const std::vector<fs::path>& roots)
+{
+	std::vector<fs::path> normalized;
+	for (const auto& root : roots)
+		normalized.push_back(normalize_path(root));
+
+	std::lock_guard<std::mutex> lock(folders_mutex);
+	const auto current = folders.load();
+	auto next = std::make_shared<ManagedFolders>();
+	std::vector<std::shared_ptr<ManagedFolder>> added;
+	for (const auto& root : normalized)
+	{
+		const auto it = std::find_if(current->begin(), current->end(), [&](const auto& managed) {
+			return managed->folder->root() == root;
+		});
+		if (it != current->end())
+		{
+			next->push_back(*it);
+			continue;
+		}
+		tb_trace_i("[daemon] managing %s", root.generic_string().c_str());
+		auto managed = std::make_shared<ManagedFolder>();
+		managed->folder = std::make_shared<Folder>(root, matcher_cache, scan_throttle);
+		next->push_back(managed);
+		added.push_back(std::move(managed));
+	}
+
+	for (const auto& managed : *current)
+	{
+		if (std::find(next->begin(), next->end(), managed) == next->end())
+		{
+			tb_trace_i("[daemon] no longer managing %s",
+					   managed->folder->root().generic_string().c_str());
+			// A scan already queued finds the folder stopped
+			managed->folder->stop();
+		}
+	}
+
+	folders.publish(std::move(next));
+	for (const auto& managed : added)
+		schedule_scan(managed);
+}
+
+void Daemon::refresh_folders()
+{
+	const FolderList list = folder_lister();
+	{
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		list_sources = std::set<fs::path>(list.sources.begin(), list.sources.end());
+		bool added = false;
+		for (const auto& source : list.sources)
+			added |= watch_directory(path_table().intern(source.parent_path()));
+		if (added)
+			tb_fwatcher_spak(fwatcher);
+	}
+
+	if (list.scan_options)
+		scan_throttle.set_options(*list.scan_options);
+
+	if (!list.complete)
+	{
+		tb_trace_e("[daemon] the folder list couldn't be read, keeping the current folders");
+		return;
+	}
+	set_folders(list.roots);
+}
+
+void Daemon::schedule_refresh()
+{
+	if (refresh_queued.exchange(true))
+	{
+		metrics().events_coalesced.add();
+		return;
+	}
+
+	pool.submit([this] {
+		refresh_queued.store(false);
+		try
+		{
+			refresh_folders();
+		}
+		catch (const std::exception& e)
+		{
+			tb_trace_e("[daemon] listing the folders failed: %s", e.what());
+		}
+	});
+}
+
+bool Daemon::request_reload(const std::optional<fs::path>& path)
+{
+	if (path)
+	{
+		const auto managed = find_managed(*path);
+		if (!managed)
+			return false;
+		schedule_scan(managed);
+		return true;
+	}
+
+	for (const auto& managed : *folders.load())
+		schedule_scan(managed);
+	return true;
+}
+
+bool Daemon::request_reload(const ScanRequest& request)
+{
+	const auto managed = find_managed(request.subtree);
+	if (!managed)
+		return false;
+	schedule_scan(managed, ScanRequest{.subtree = normalize_path(request.subtree),
+									   .max_age = request.max_age});
+	return true;
+}
+
+void Daemon::schedule_scan(const std::shared_ptr<ManagedFolder>& managed,
+						   std::optional<ScanRequest> request)
+{
+	if (!request)
+		request = ScanRequest{.subtree = managed->folder->root()};
+	{
+		std::lock_guard<std::mutex> lock(managed->pending_mutex);
+		auto& pending = managed->pending_scans;
+		if (std::any_of(pending.begin(), pending.end(),
+						[&](const auto& queued) { return queued.covers(*request); }))
+		{
+			metrics().events_coalesced.add();
+			return;
+		}
+		metrics().events_coalesced.add(
+			std::erase_if(pending, [&](const auto& queued) { return request->covers(queued); }));
+		const bool queued = !pending.empty();
+		pending.push_back(std::move(*request));
+		if (queued)
+			return;
+	}
+
+	pool.submit([this, managed] {
+		// A request coming from now on needs a scan of its own
+		std::vector<ScanRequest> requests;
+		{
+			std::lock_guard<std::mutex> lock(managed->pending_mutex);
+			requests.swap(managed->pending_scans);
+		}
+		Folder& folder = *managed->folder;
+		try
+		{
+			for (const auto& scan_request : requests)
+				folder.scan(scan_request);
+		}
+		catch (const std::exception& e)
+		{
+			tb_trace_e("[daemon] scan of %s failed: %s", folder.root().generic_string().c_str(),
+					   e.what());
+			return;
+		}
+		watch(folder);
+	});
+}
+
+void Daemon::watch(const Folder& folder)
+{
+	if (!fwatcher)
+		return;
+
+	std::lock_guard<std::mutex> lock(watch_mutex);
+	bool added = false;
+	for (const PathId directory : folder.directories())
+		added |= watch_directory(directory);
+	// Wake up the watcher so it takes the new directories into account
+	if (added)
+		tb_fwatcher_spak(fwatcher);
+}
+
+bool Daemon::watch_directory(PathId directory)
+{
+	if (!fwatcher || !watched_dirs.insert(directory).second)
+		return false;
+	const std::string directory_path = path_table().path(directory).generic_string();
+	if (!tb_fwatcher_add(fwatcher, directory_path.c_str(), tb_false))
+		tb_trace_e("[watcher] cannot watch %s", directory_path.c_str());
+	return true;
+}
+
+std::shared_ptr<Daemon::ManagedFolder> Daemon::find_managed(const fs::path& path) const
+{
+	const auto current = folders.load();
+	std::vector<fs::path> roots;
+	roots.reserve(current->size());
+	for (const auto& managed : *current)
+		roots.push_back(managed->folder->root());
+	const std::optional<size_t> index = find_folder(roots, path);
+	return index ? (*current)[*index] : nullptr;
+}
+
+void Daemon::file_event(const fs::path& file, bool deleted)
+{
+	metrics().events_received.add();
+	{
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		if (list_sources.contains(normalize_path(file)))
+		{
+			tb_trace_i("[watcher] folder list changed at : %s", file.generic_string().c_str());
+			schedule_refresh();
+			return;
+		}
+	}
+
+	// An excludes file can be shared by several folders, and folders can be nested
+	bool used = false;
+	for (const auto& managed : *folders.load())
+	{
+		Folder& folder = *managed->folder;
+		if (deleted)
+		{
+			used |= folder.file_deleted(file);
+		}
+		else if (folder.file_modified(file))
+		{
+			used = true;
+			watch(folder);
+		}
+	}
+	if (!used)
+		metrics().events_dropped.add();
+}
+
+std::string Daemon::handle_command(std::string_view command)
+{
+	if (command == "reload")
+	{
+		// The folder list is read again too, from the pool as stopping a folder waits for it
+		pool.submit([this] {
+			refresh_folders();
+			request_reload();
+		});
+		return "ok\n";
+	}
+	if (command.starts_with("reload "))
+	{
+		// "reload [max_age=<seconds>] <path>" rescans what is below the path only
+		std::string_view arguments = command.substr(7);
+		ScanRequest request;
+		if (arguments.starts_with("max_age="))
+		{
+			const size_t space = arguments.find(' ');
+			if (space == std::string_view::npos)
+				return "invalid max age\n";
+			const std::string_view value = arguments.substr(8, space - 8);
+			const char* value_end = value.data() + value.size();
+			long long seconds = 0;
+			const auto [end, ec] = std::from_chars(value.data(), value_end, seconds);
+			if (ec != std::errc() || end != value_end || seconds < 0)
+				return "invalid max age\n";
+			request.max_age = std::chrono::seconds(seconds);
+			arguments.remove_prefix(space + 1);
+		}
+		request.subtree = fs::path(arguments);
+		return request_reload(request) ? "ok\n" : "not in a managed folder\n";
+	}
+
+	// Queries are answered from the last published snapshots, without waiting for the scans
+	if (command.starts_with("check "))
+	{
+		const fs::path path(command.substr(6));
+		const auto managed = find_managed(path);
+		if (!managed)
+			return "not in a managed folder\n";
+		return managed->folder->is_ignored(path) ? "ignored\n" : "not ignored\n";
+	}
+	if (command == "scan")
+	{
+		return format_scan_options(scan_throttle.options()) + "\n";
+	}
+	if (command.starts_with("scan "))
+	{
+		// Until the folder list sets other options
+		ScanOptions options = scan_throttle.options();
+		if (!parse_scan_options(command.substr(5), options))
+			return "invalid scan options\n";
+		scan_throttle.set_options(options);
+		return "ok\n";
+	}
+	if (command == "metrics")
+	{
+		const auto current = folders.load();
+		size_t pending = 0;
+		for (const auto& managed : *current)
+		{
+			std::lock_guard<std::mutex> lock(managed->pending_mutex);
+			pending += managed->pending_scans.size();
+		}
+		metrics().scan_queue_depth.set(static_cast<int64_t>(pending));
+		metrics().worker_queue_depth.set(static_cast<int64_t>(pool.queued_tasks()));
+		return metrics().prometheus_text();
+	}
+	if (command == "trace")
+	{
+		return std::string("trace ") + (tracer().enabled() ? "on" : "off") + " events " +
+			   std::to_string(tracer().event_count()) + " dropped " +
+			   std::to_string(tracer().dropped()) + "\n";
+	}
+	if (command == "trace on" || command == "trace off")
+	{
+		tracer().set_enabled(command == "trace on");
+		return "ok\n";
+	}
+	if (command == "trace clear")
+	{
+		tracer().clear();
+		return "ok\n";
+	}
+	if (command.starts_with("trace dump "))
+	{
+		// "trace dump <offset>" returns the trace from the offset, a chunk at a time as it is
+		// usually larger than a reply, a shorter chunk being the last. The trace is taken when
+		// the offset is 0. The client writes the file, the instance never writes where it is told.
+		const std::string_view value = command.substr(11);
+		const char* value_end = value.data() + value.size();
+		size_t offset = 0;
+		const auto [end, ec] = std::from_chars(value.data(), value_end, offset);
+		if (ec != std::errc() || end != value_end)
+			return "";
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		if (!offset)
+			trace_dump = tracer().chrome_json();
+		std::string chunk =
+			offset < trace_dump.size() ? trace_dump.substr(offset, ipc_chunk_size) : "";
+		if (chunk.size() < ipc_chunk_size)
+			std::string().swap(trace_dump);
+		return chunk;
+	}
+	if (command == "status")
+	{
+		const auto current = folders.load();
+		std::string reply = "folders " + std::to_string(current->size()) + "\nscan options " +
+							format_scan_options(scan_throttle.options()) + "\n";
+		for (const auto& managed : *current)
+		{
+			const auto snapshot = managed->folder->snapshot();
+			const ScanProgress& progress = managed->folder->progress();
+			reply += "folder " + managed->folder->root().generic_string() + "\ngeneration " +
+					 std::to_string(snapshot ? snapshot->generation : 0) + "\ngitignore files " +
+					 std::to_string(snapshot ? snapshot->gitignore_count : 0) + "\nscan " +
+					 scan_state_name(progress.state.load()) + " directories " +
+					 std::to_string(progress.directories.load()) + " ignore files " +
+					 std::to_string(progress.ignore_files.load()) + " elapsed " +
+					 std::to_string(progress.elapsed().count()) + "ms\n";
+		}
+		return reply;
+	}
+	return "unknown command\n";
+}
+
+void Daemon::wait_idle()
+{
+	pool.wait_idle();
+}
+
+void Daemon::stop()
+{
+	for (const auto& managed : *folders.load())
+		managed->folder->stop();
+}
+
+bool Daemon::autostart() const
+{
+	const auto current = folders.load();
+	return std::any_of(current->begin(), current->end(),
+					   [](const auto& managed) { return managed->folder->autostart(); });
+}
@@ -0,0 +1,112 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <tbox/tbox.h>
+
+#include "folder.hpp"
+#include "folder_list.hpp"
+#include "matcher_cache.hpp"
+#include "path_table.hpp"
+#include "scan_records.hpp"
+#include "scan_throttle.hpp"
+#include "snapshot.hpp"
+#include "worker_pool.hpp"
+
+// One process managing all the synced folders.
+// The folders share the worker pool their scans run on, the file watcher, the matcher cache and
+// the IPC endpoint. The scans requested for a folder while one is queued are queued along with
+// it, those another queued request covers being dropped, and a folder failing to scan doesn't
+// stop the others. The walks of the trees share a throttle,
+// so that huge folders don't take the disk from everything else.
+class Daemon
+{
+  public:
+	// Folders to manage, listed again on each full reload and when one of their sources changes
+	using FolderLister = std::function<FolderList()>;
+
+	// Without a watcher, the folders are scanned but not watched
+	Daemon(MatcherCache& cache, FolderLister lister, tb_fwatcher_ref_t watcher,
+		   size_t thread_count = 0);
+	~Daemon();
+
+	Daemon(const Daemon&) = delete;
+	Daemon& operator=(const Daemon&) = delete;
+
+	// Starts managing the listed folders, loading them in the background, and stops managing
+	// the others
+	void set_folders(const std::vector<std::filesystem::path>& roots);
+	// Lists the folders again and manages them, watching the sources of the list. A list that
+	// couldn't be read entirely leaves the folders as they are. The scan options of the list
+	// replace the current ones.
+	void refresh_folders();
+	// Rescans the folder containing the path, or all of them. False if no folder contains it.
+	bool request_reload(const std::optional<std::filesystem::path>& path = std::nullopt);
+	// Rescans the directories below the subtree not read for the maximum age, in the folder
+	// containing it. False if no folder contains it.
+	bool request_reload(const ScanRequest& request);
+	// Dispatches a change seen by the watcher to the folders it concerns
+	void file_event(const std::filesystem::path& file, bool deleted);
+	// Answers an IPC command, without waiting for the scans
+	std::string handle_command(std::string_view command);
+
+	// Waits for the scans queued and running
+	void wait_idle();
+	// Cancels the walks in progress and saves the pending changes of all the folders
+	void stop();
+	// Whether a folder asked to start with the session
+	bool autostart() const;
+
+  private:
+	struct ManagedFolder
+	{
+		std::shared_ptr<Folder> folder;
+		// Scans to run, a task being queued while there are some
+		std::vector<ScanRequest> pending_scans;
+		std::mutex pending_mutex;
+	};
+	using ManagedFolders = std::vector<std::shared_ptr<ManagedFolder>>;
+
+	MatcherCache& matcher_cache;
+	FolderLister folder_lister;
+	tb_fwatcher_ref_t fwatcher;
+	ScanThrottle scan_throttle;
+
+	// Read without locking, replaced while holding folders_mutex
+	Published<ManagedFolders> folders;
+	std::mutex folders_mutex;
+
+	std::set<PathId> watched_dirs;
+	// Files the folders are listed in
+	std::set<std::filesystem::path> list_sources;
+	std::atomic<bool> refresh_queued = false;
+	std::mutex watch_mutex;
+
+	// Trace taken by the last "trace dump", kept until its last chunk is sent
+	std::string trace_dump;
+	std::mutex trace_mutex;
+
+	// Last so that it is joined before the rest is destroyed
+	WorkerPool pool;
+
+	// Scans the whole folder without a request
+	void schedule_scan(const std::shared_ptr<ManagedFolder>& managed,
+					   std::optional<ScanRequest> request = std::nullopt);
+	void schedule_refresh();
+	void watch(const Folder& folder);
+	// Must be called with watch_mutex locked, true if the directory wasn't watched yet
+	bool watch_directory(PathId directory);
+	std::shared_ptr<ManagedFolder> find_managed(const std::filesystem::path& path) const;
+};
+
+#endif
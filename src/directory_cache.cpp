@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "directory_cache.hpp"
+#include "gitignore_stack.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	// Matchers whose rules start to apply in the directory, the stack of its parent being the ones
+	// applying above
+	void push_applicable(const fs::path& directory, const fs::path* parent,
+						 const MatcherSnapshot& matchers, MatcherSnapshot& stack)
+	{
+		for (const auto& matcher : matchers)
+		{
+			if (matcher->applies_below(directory) && !(parent && matcher->applies_below(*parent)))
+				stack.push_back(matcher);
+		}
+	}
+} // namespace
+
+DirectoryCache::DirectoryCache(size_t capacity) : capacity(std::max<size_t>(capacity, 1))
+{
+}
+
+void DirectoryCache::insert(std::shared_ptr<const Entry> entry)
+{
+	// Another query may have resolved the directory meanwhile
+	if (const auto it = index.find(entry->directory); it != index.end())
+	{
+		*it->second = std::move(entry);
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+
+	entries.push_front(std::move(entry));
+	index.emplace(entries.front()->directory, entries.begin());
+	if (entries.size() > capacity)
+	{
+		index.erase(entries.back()->directory);
+		entries.pop_back();
+	}
+}
+
+void DirectoryCache::invalidate(uint64_t new_generation, const fs::path& directory)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	generation = new_generation;
+
+	const std::string key = normalize_path(directory).generic_string();
+	const std::string prefix = key.ends_with('/') ? key : key + '/';
+	for (auto it = entries.begin(); it != entries.end();)
+	{
+		if ((*it)->directory == key || (*it)->directory.starts_with(prefix))
+		{
+			index.erase((*it)->directory);
+			it = entries.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void DirectoryCache::clear(uint64_t new_generation)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	generation = new_generation;
+	entries.clear();
+	index.clear();
+}
+
+bool DirectoryCache::is_ignored(const fs::path& path, const MatcherSnapshot& matchers,
+								uint64_t matchers_generation)
+{
+	const fs::path normalized = normalize_path(path);
+	if (!normalized.has_relative_path())
+		return false;
+
+	// The directory of the path and its parents up to the root
+	std::vector<fs::path> directories;
+	std::vector<std::string> keys;
+	for (fs::path current = normalized.parent_path();; current = current.parent_path())
+	{
+		keys.push_back(current.generic_string());
+		directories.push_back(current);
+		if (!current.has_relative_path())
+			break;
+	}
+
+	// Look up the nearest directory already known. Results of other matchers would outlive them,
+	// those queries are resolved without the cache.
+	std::shared_ptr<const Entry> entry;
+	size_t missing = directories.size();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < keys.size() && matchers_generation == generation; i++)
+		{
+			const auto it = index.find(keys[i]);
+			if (it == index.end())
+				continue;
+			entries.splice(entries.begin(), entries, it->second);
+			entry = *it->second;
+			missing = i;
+			break;
+		}
+	}
+
+	// Then resolve the others downwards
+	bool excluded = entry && entry->excluded;
+	MatcherSnapshot applicable = entry ? entry->applicable : MatcherSnapshot{};
+	bool known = entry != nullptr;
+	std::vector<std::shared_ptr<const Entry>> resolved;
+	for (size_t i = missing; i-- > 0;)
+	{
+		const fs::path& directory = directories[i];
+		if (!excluded)
+		{
+			// The root has no parent whose rules could exclude it
+			const fs::path parent = directory.parent_path();
+			if (known)
+				excluded = stack_decision(directory, applicable).value_or(false);
+			if (excluded)
+				applicable.clear();
+			else
+				push_applicable(directory, known ? &parent : nullptr, matchers, applicable);
+			known = true;
+		}
+		resolved.push_back(std::make_shared<const Entry>(
+			Entry{.directory = std::move(keys[i]), .excluded = excluded, .applicable = applicable}));
+	}
+	if (!resolved.empty())
+	{
+		entry = resolved.back();
+		std::lock_guard<std::mutex> lock(mutex);
+		if (matchers_generation == generation)
+		{
+			for (auto& resolved_entry : resolved)
+				insert(std::move(resolved_entry));
+		}
+	}
+
+	return entry->excluded || stack_decision(path, entry->applicable).value_or(false);
+}
+
+size_t DirectoryCache::size() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
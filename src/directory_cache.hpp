@@ -0,0 +1,60 @@
+#ifndef DIRECTORY_CACHE_H
+#define DIRECTORY_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "matcher_registry.hpp"
+
+// Memoized results of the directories of the queried paths, in least recently used order.
+// Each directory records if it is excluded, in which case everything below is too as in git, and
+// the stack of matchers whose rules can still apply below it, from the shallowest gitignore file
+// to the deepest. A path is then checked against these matchers only with git precedence, and in
+// O(1) below an excluded directory.
+//
+// The entries are valid for one generation of the matchers: a changed gitignore file drops the
+// entries of its directory and below, and queries made with the matchers of another generation
+// are answered without the cache.
+// The lock is only held to look the entries up and to insert them, the rules are evaluated
+// outside of it so that concurrent queries don't wait for each other.
+class DirectoryCache
+{
+	struct Entry
+	{
+		std::string directory;
+		bool excluded;
+		// Shallowest gitignore file first
+		MatcherSnapshot applicable;
+	};
+
+	size_t capacity;
+	uint64_t generation = 0;
+	// Most recently used first, shared with the queries using them
+	std::list<std::shared_ptr<const Entry>> entries;
+	std::unordered_map<std::string, std::list<std::shared_ptr<const Entry>>::iterator> index;
+	mutable std::mutex mutex;
+
+	// Must be called with the mutex locked
+	void insert(std::shared_ptr<const Entry> entry);
+
+  public:
+	explicit DirectoryCache(size_t capacity = 4096);
+
+	// Drops the entries of the directory and below, the others stay valid for the new generation
+	void invalidate(uint64_t new_generation, const std::filesystem::path& directory);
+	// Drops all the entries
+	void clear(uint64_t new_generation);
+
+	bool is_ignored(const std::filesystem::path& path, const MatcherSnapshot& matchers,
+					uint64_t matchers_generation);
+
+	size_t size() const;
+};
+
+#endif
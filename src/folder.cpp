@@ -0,0 +1,811 @@
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <string>
+
+#include <nlohmann/json.hpp>
+#include <tbox/tbox.h>
+
+#include "folder.hpp"
+#include "gitignore_parser.hpp"
+#include "ignore_sources.hpp"
+#include "metrics.hpp"
+#include "stignore.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+namespace nlohmann
+{
+	template<> struct adl_serializer<std::filesystem::file_time_type>
+	{
+		static void to_json(json& j, const std::filesystem::file_time_type& time)
+		{
+			// Store the time as duration since epoch
+			auto duration = time.time_since_epoch();
+			auto count = duration.count();
+			j = count;
+		}
+
+		static void from_json(const json& j, std::filesystem::file_time_type& time)
+		{
+			// Read the duration count from JSON
+			auto count = j.get<typename std::filesystem::file_time_type::duration::rep>();
+
+			// Create a duration and then a time_point from it
+			typename std::filesystem::file_time_type::duration duration(count);
+			time = std::filesystem::file_time_type(duration);
+		}
+	};
+
+	template<> struct adl_serializer<OrderedRuleSet>
+	{
+		static void to_json(json& j, const OrderedRuleSet& rules)
+		{
+			j = json::array();
+			for (const auto& rule : rules)
+				j.push_back(rule);
+		}
+
+		static void from_json(const json& j, OrderedRuleSet& rules)
+		{
+			rules.clear();
+			for (const auto& rule : j)
+				rules.insert(rule.get<std::string>());
+		}
+	};
+} // namespace nlohmann
+
+// JSON form of the state, kept for debugging (see the dump argument) and to import the state of
+// versions that saved it in synctignore.json
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(GitIgnoreFile, mtime, st_rules);
+
+// The gitignore files are keyed by their path rather than by their id
+void to_json(json& j, const State& state)
+{
+	json gitignore_files = json::object();
+	for (const auto& [path, gitignore_file] : state.gitignore_files)
+		gitignore_files[path_table().path(path).string()] = gitignore_file;
+
+	j = json{{"user_rules", state.user_rules},
+			 {"gitignore_files", std::move(gitignore_files)},
+			 {"autostart", state.autostart},
+			 {"max_alternatives", state.max_alternatives},
+			 {"max_pattern_length", state.max_pattern_length}};
+}
+
+void from_json(const json& j, State& state)
+{
+	const State defaults;
+	state.user_rules = j.value("user_rules", defaults.user_rules);
+	state.gitignore_files.clear();
+	if (j.contains("gitignore_files"))
+	{
+		for (const auto& [path, gitignore_file] : j.at("gitignore_files").items())
+			state.gitignore_files.emplace(path_table().intern(path),
+										  gitignore_file.get<GitIgnoreFile>());
+	}
+	state.autostart = j.value("autostart", defaults.autostart);
+	state.max_alternatives = j.value("max_alternatives", defaults.max_alternatives);
+	state.max_pattern_length = j.value("max_pattern_length", defaults.max_pattern_length);
+}
+
+namespace
+{
+	// Imports the state of versions that saved it in synctignore.json, false if there is none
+	bool import_json_state(const fs::path& root, State& state)
+	{
+		const fs::path json_path = root / "synctignore.json";
+		std::error_code ec;
+		if (!fs::exists(json_path, ec))
+			return false;
+		tb_trace_i("[config] importing %s", json_path.generic_string().c_str());
+		std::ifstream ifs(json_path);
+		state = json::parse(ifs).template get<State>();
+		return true;
+	}
+
+	void strip(std::string& str)
+	{
+		if (str.length() == 0)
+		{
+			return;
+		}
+
+		auto start_it = str.begin();
+		auto end_it = str.rbegin();
+		while (std::isspace(*start_it))
+		{
+			++start_it;
+			if (start_it == str.end())
+				break;
+		}
+		while (std::isspace(*end_it))
+		{
+			++end_it;
+			if (end_it == str.rend())
+				break;
+		}
+		int start_pos = start_it - str.begin();
+		int end_pos = end_it.base() - str.begin();
+		str = start_pos <= end_pos ? std::string(start_it, end_it.base()) : "";
+	}
+} // namespace
+
+struct CollectedIgnoreFiles
+{
+	std::map<PathId, GitIgnoreFile> files;
+	// Repositories using each excludes file
+	std::map<PathId, std::vector<fs::path>> excludes_bases;
+	// Directories whose tree wasn't walked, sorted
+	std::vector<fs::path> skipped;
+
+	// Whether the walk read the directory, the files found in it being all of them
+	bool walked(const fs::path& subtree, const fs::path& directory) const
+	{
+		if (!contains_path(subtree, directory))
+			return false;
+		// The skipped trees are disjoint and sorted, only the last one before can contain it
+		const auto it = std::upper_bound(skipped.begin(), skipped.end(), directory);
+		return it == skipped.begin() || !contains_path(*std::prev(it), directory);
+	}
+};
+
+namespace
+{
+	// Collects the .gitignore files of the tree, and the .git/info/exclude and excludes file of
+	// each repository. The .git directories themselves are not walked, nor the trees skip returns
+	// true for.
+	// The walk waits for its turn and reads the directories at the pace the throttle allows.
+	// Setting cancelled ends it early, what it collected being incomplete then.
+	CollectedIgnoreFiles collect_gitignore_files(
+		const fs::path& path, ScanThrottle& throttle, ScanProgress& progress,
+		const std::atomic<bool>& cancelled,
+		const std::function<bool(const fs::path&)>& skip = nullptr)
+	{
+		progress.state.store(ScanState::waiting);
+		ScanThrottle::Walker walker(throttle, &cancelled);
+		progress.start();
+		const TraceScope trace_scope("collect_gitignore_files");
+
+		CollectedIgnoreFiles collected;
+		const auto add_file = [&](const fs::path& file_path) {
+			std::error_code ec;
+			const auto mtime = fs::last_write_time(file_path, ec);
+			const PathId id = path_table().intern(file_path.lexically_normal());
+			collected.files.emplace(id, GitIgnoreFile{.mtime = mtime, .st_rules = {}});
+			progress.ignore_files++;
+			return id;
+		};
+
+		// A walk failing half way is over too
+		struct Finish
+		{
+			ScanProgress& progress;
+			~Finish()
+			{
+				progress.finish();
+			}
+		} finish{progress};
+
+		const fs::path root = normalize_path(path);
+		if (skip && skip(root))
+		{
+			collected.skipped.push_back(root);
+			return collected;
+		}
+		if (!walker.read_directory())
+			return collected;
+		progress.directories++;
+		for (fs::recursive_directory_iterator it(root), end; it != end; ++it)
+		{
+			const fs::path& entry_path = it->path();
+			if (entry_path.filename() == ".gitignore" && it->is_regular_file())
+			{
+				add_file(entry_path);
+			}
+			else if (it->is_directory() && !it->is_symlink() && entry_path.filename() != ".git")
+			{
+				// The iterator reads the directory when moving past it, links are not followed
+				if (skip && skip(entry_path))
+				{
+					it.disable_recursion_pending();
+					collected.skipped.push_back(entry_path.lexically_normal());
+					continue;
+				}
+				if (!walker.read_directory())
+					return collected;
+				progress.directories++;
+			}
+			else if (entry_path.filename() == ".git" && it->is_directory())
+			{
+				it.disable_recursion_pending();
+				const fs::path repository = entry_path.parent_path().lexically_normal();
+				std::error_code ec;
+				const fs::path info_exclude = entry_path / "info" / "exclude";
+				if (fs::is_regular_file(info_exclude, ec))
+					add_file(info_exclude);
+				if (const auto excludes_file = find_excludes_file(repository))
+					collected.excludes_bases[add_file(*excludes_file)].push_back(repository);
+			}
+		}
+		std::sort(collected.skipped.begin(), collected.skipped.end());
+		trace_counter("directories read", static_cast<int64_t>(progress.directories.load()));
+		trace_counter("ignore files found", static_cast<int64_t>(collected.files.size()));
+		return collected;
+	}
+
+	// Converts the rules of a file relative to parent, a path relative to the synced folder.
+	// As in git the last of duplicate rules is the one that counts.
+	void convert_ignore_rules(std::string_view content, const std::string& parent,
+							  OrderedRuleSet& ignore_rules)
+	{
+		for_each_line(content, [&](std::string_view line) {
+			const size_t first = line.find_first_not_of(" \t\v\f\r");
+			if (first == std::string_view::npos)
+				return;
+			line = line.substr(first, line.find_last_not_of(" \t\v\f\r") + 1 - first);
+			if (line.starts_with("#"))
+				return;
+
+			std::string_view negation = "";
+			if (line.starts_with("!"))
+			{
+				negation = "!";
+				line.remove_prefix(1);
+			}
+
+			std::string rule(negation);
+			rule += parent;
+			if (line.starts_with("/"))
+			{
+				ignore_rules.append(rule.append(line));
+				return;
+			}
+
+			if ((line.find('/') != std::string_view::npos) && (line.back() != '/'))
+			{
+				ignore_rules.append(rule.append("/").append(line));
+				return;
+			}
+
+			rule += '/';
+			ignore_rules.append(rule + std::string(line));
+			ignore_rules.append(rule.append("**/").append(line));
+		});
+	}
+
+	// Convert ignore rules from git to syncthing, the rules being repeated below each base
+	// directory
+	void convert_ignore_rules(std::string_view content, const fs::path& root,
+							  const std::vector<fs::path>& base_dirs, GitIgnoreFile& gitignorefile)
+	{
+		const TraceScope trace_scope("convert_ignore_rules");
+		metrics().files_converted.add();
+		auto& ignore_rules = gitignorefile.st_rules;
+		ignore_rules.clear();
+
+		for (const auto& base_dir : base_dirs)
+		{
+			fs::path relative_base = fs::relative(base_dir, root).lexically_normal();
+			// If the relative path is just ".", make it an empty path
+			if (relative_base == ".")
+				relative_base = "";
+			convert_ignore_rules(content, relative_base.generic_string(), ignore_rules);
+		}
+		trace_counter("rules converted", static_cast<int64_t>(ignore_rules.size()));
+	}
+} // namespace
+
+Folder::Folder(fs::path root, MatcherCache& cache, ScanThrottle& throttle)
+	: root_path(normalize_path(root)), state_file(root_path / "synctignore.state"),
+	  matcher_cache(cache), scan_throttle(throttle), registry(cache)
+{
+}
+
+Folder::~Folder()
+{
+	stop();
+}
+
+void Folder::load_state()
+{
+	if (state_file.load(state))
+	{
+		writer = std::make_unique<StateWriter>(state_file);
+		return;
+	}
+
+	// Import the state of previous versions
+	import_json_state(root_path, state);
+	writer = std::make_unique<StateWriter>(state_file);
+	writer->replace(state);
+}
+
+std::vector<fs::path> Folder::base_dirs(PathId path) const
+{
+	if (auto base = ignore_source_base(path_table().path(path)))
+		return {*base};
+	const auto it = excludes_bases.find(path);
+	return it != excludes_bases.end() ? it->second : std::vector<fs::path>{};
+}
+
+/// Returns the rules of all the ignore files, in syncthing precedence order.
+/// In git the last matching rule wins and deeper files override the upper ones, in syncthing
+/// the first matching rule wins. So the files of the deepest directories come first, the files
+/// of a same directory by decreasing precedence (.gitignore, then .git/info/exclude), and the
+/// rules of each file are reversed. The excludes files, whose rules are already repeated for
+/// each of their repositories, come last.
+OrderedRuleSet Folder::st_rules() const
+{
+	struct SortedFile
+	{
+		size_t depth;
+		IgnoreSourceKind kind;
+		fs::path path;
+		const GitIgnoreFile* file;
+	};
+	std::vector<SortedFile> files;
+	files.reserve(state.gitignore_files.size());
+	for (const auto& [path, file] : state.gitignore_files)
+	{
+		const fs::path file_path = path_table().path(path);
+		const IgnoreSourceKind kind = ignore_source_kind(file_path);
+		// Depth of the directory the rules are relative to
+		size_t depth = path_table().depth(path);
+		if (kind == IgnoreSourceKind::excludes_file)
+			depth = 0;
+		else
+			depth -= std::min<size_t>(depth, kind == IgnoreSourceKind::gitignore ? 1 : 3);
+		files.push_back({depth, kind, file_path, &file});
+	}
+	// Ids depend on the discovery order, sort by path too so the output doesn't
+	std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+		if (a.depth != b.depth)
+			return a.depth > b.depth;
+		return a.kind != b.kind ? a.kind > b.kind : a.path < b.path;
+	});
+
+	OrderedRuleSet rules;
+	for (const auto& [depth, kind, path, file] : files)
+	{
+		const auto& file_rules = file->st_rules;
+		for (auto it = file_rules.end(); it != file_rules.begin();)
+			rules.insert(*--it);
+	}
+	return rules;
+}
+
+// Converts the rules of an ignore file and refreshes its matcher, reading the file once
+void Folder::load_gitignore(PathId path)
+{
+	const fs::path file_path = path_table().path(path);
+	const MappedFile content(file_path);
+	const std::vector<fs::path> bases = base_dirs(path);
+	convert_ignore_rules(content.view(), root_path, bases, state.gitignore_files.at(path));
+	registry.refresh(path, content.view(),
+					 ignore_source_base(file_path) ? std::vector<fs::path>{} : bases);
+}
+
+void Folder::file_changed(PathId path)
+{
+	writer->update_file(path, state.gitignore_files.at(path));
+}
+
+void Folder::file_removed(PathId path)
+{
+	writer->remove_file(path);
+	registry.remove(path);
+}
+
+/// Loads the matchers of all the gitignore files in the registry
+void Folder::load_matchers()
+{
+	for (const auto& [path, gitignore_file] : state.gitignore_files)
+		registry.get(path);
+	matcher_cache.save();
+}
+
+void Folder::save_stignore() const
+{
+	const TraceScope trace_scope("save_stignore");
+	const auto rules_to_save = st_rules();
+	std::vector<std::string> rules(rules_to_save.begin(), rules_to_save.end());
+	const size_t removed = minimize_rules(rules);
+	tb_trace_i("[stignore] %lu redundant rules removed", static_cast<tb_size_t>(removed));
+	const size_t merged = compact_rules(
+		rules, {.max_alternatives = state.max_alternatives,
+				.max_pattern_length = state.max_pattern_length});
+	tb_trace_i("[stignore] %lu rules merged into alternations", static_cast<tb_size_t>(merged));
+	trace_counter("stignore rules", static_cast<int64_t>(rules.size()));
+	metrics().rules_emitted.add(rules.size());
+
+	std::string content;
+	for (const auto& rule : rules)
+		content.append(rule).append("\n");
+	content += "// USER RULES\n";
+	for (const auto& rule : state.user_rules)
+		content.append(rule).append("\n");
+
+	// Syncthing reloads its patterns whenever the file changes, the same content isn't written
+	// again. Both are read and written in text mode so that line endings compare equal.
+	const fs::path stignore_path = root_path / ".stignore";
+	{
+		std::ifstream ifs(stignore_path);
+		const std::string existing(std::istreambuf_iterator<char>(ifs), {});
+		if (ifs.is_open() && existing == content)
+		{
+			tb_trace_i("[stignore] %s is up to date", root_path.generic_string().c_str());
+			metrics().stignore_writes_skipped.add();
+			return;
+		}
+	}
+
+	tb_trace_i("[stignore] saving %s", root_path.generic_string().c_str());
+	std::ofstream(stignore_path, std::ios::out) << content;
+	metrics().stignore_writes.add();
+}
+
+void Folder::load_stignore()
+{
+	tb_trace_i("[stignore] loading %s", root_path.generic_string().c_str());
+	std::ifstream ifs(root_path / ".stignore");
+	int line_num = 0;
+	std::string line;
+
+	OrderedRuleSet rules;
+	bool has_user_section = false;
+	while (std::getline(ifs, line))
+	{
+		line_num++;
+		strip(line);
+		// Generated rules are minimized and merged when saved, so they can't be recognized
+		// one by one, only keep what comes after the user rules marker
+		if (line == "// USER RULES")
+		{
+			has_user_section = true;
+			rules.clear();
+			continue;
+		}
+		rules.insert(line);
+	}
+
+	const auto synctignore_rules = st_rules();
+	bool user_rules_changed = false;
+	// Consider any rule that is isn't in synctignore_rules as user rules
+	for (const auto& rule : rules)
+	{
+		if (rule.empty() || rule.starts_with("//"))
+			continue;
+
+		if (has_user_section || !synctignore_rules.contains(rule))
+		{
+			user_rules_changed |= state.user_rules.insert(rule);
+		}
+	}
+
+	if (user_rules_changed)
+		writer->update_user_rules(state.user_rules);
+}
+
+void Folder::create_stignore(CollectedIgnoreFiles& collected,
+							 ScanRecords::Clock::time_point started)
+{
+	scan_records.record_walk(root_path, started, {});
+	state.gitignore_files = std::move(collected.files);
+	excludes_bases = std::move(collected.excludes_bases);
+	for (const auto& [path, gitignore_file] : state.gitignore_files)
+		load_gitignore(path);
+	writer->replace(state);
+	load_matchers();
+	save_stignore();
+}
+
+// Checks if some gitignore files of the walked tree were modified, updates the stignore rules
+// accordingly. The trees the walk skipped are left as they are.
+void Folder::update_stignore(const ScanRequest& request, CollectedIgnoreFiles& collected,
+							 ScanRecords::Clock::time_point started)
+{
+	const auto& gitignore_files = collected.files;
+	const auto walked = [&](const fs::path& directory) {
+		return collected.walked(request.subtree, directory);
+	};
+
+	// The repositories outside of the walk still use their excludes file
+	auto previous_bases = std::move(excludes_bases);
+	excludes_bases = std::move(collected.excludes_bases);
+	for (const auto& [path, repositories] : previous_bases)
+	{
+		for (const auto& repository : repositories)
+		{
+			auto& bases = excludes_bases[path];
+			if (!walked(repository) &&
+				std::find(bases.begin(), bases.end(), repository) == bases.end())
+				bases.push_back(repository);
+		}
+	}
+	std::erase_if(excludes_bases, [](const auto& entry) { return entry.second.empty(); });
+	// Whether the repositories using an excludes file changed, in any order
+	const auto bases_changed = [&](PathId path) {
+		const auto sorted_bases = [](const auto& bases, PathId id) {
+			const auto it = bases.find(id);
+			std::vector<fs::path> sorted = it != bases.end() ? it->second : std::vector<fs::path>{};
+			std::sort(sorted.begin(), sorted.end());
+			return sorted;
+		};
+		return sorted_bases(previous_bases, path) != sorted_bases(excludes_bases, path);
+	};
+	std::map<PathId, GitIgnoreFile> updated_gitignore;
+
+	for (const auto& file : gitignore_files)
+	{
+
+		const auto existing_file_entry = state.gitignore_files.find(file.first);
+		// New discovered file
+		if (existing_file_entry == state.gitignore_files.end())
+		{
+			updated_gitignore.insert(file);
+			continue;
+		}
+
+		// File was modified. The repositories using an excludes file may have changed too, its
+		// rules are only converted again if they did.
+		if (file.second.mtime > existing_file_entry->second.mtime ||
+			(excludes_bases.contains(file.first) && bases_changed(file.first)))
+		{
+			updated_gitignore.insert(file);
+			// TODO Try to find a better way than deleting the key to put it back in the merge later
+			state.gitignore_files.erase(existing_file_entry);
+		}
+	}
+
+	// Remove deleted files, and the excludes files no repository uses anymore. An excludes file
+	// whose repositories were all outside of the walk keeps its rules, if some were walked its
+	// rules are rebuilt for the repositories left.
+	for (auto it = state.gitignore_files.begin(); it != state.gitignore_files.end();)
+	{
+		const auto base = ignore_source_base(path_table().path(it->first));
+		const bool removed = base ? walked(*base) && !gitignore_files.contains(it->first)
+								  : !excludes_bases.contains(it->first);
+		if (removed)
+		{
+			file_removed(it->first);
+			it = state.gitignore_files.erase(it); // erase returns next iterator
+			continue;
+		}
+		if (!base && !gitignore_files.contains(it->first) && bases_changed(it->first))
+		{
+			updated_gitignore.insert(*it);
+			it = state.gitignore_files.erase(it);
+			continue;
+		}
+		++it;
+	}
+
+	// Update the config with the updated files/ rules
+	std::vector<PathId> updated_paths;
+	for (const auto& [path, gitignore_file] : updated_gitignore)
+		updated_paths.push_back(path);
+	state.gitignore_files.merge(updated_gitignore);
+
+	for (const auto& path : updated_paths)
+	{
+		load_gitignore(path);
+		file_changed(path);
+	}
+	load_matchers();
+
+	save_stignore();
+	scan_records.record_walk(request.subtree, started, collected.skipped);
+}
+
+// The directory results cached for the previous snapshot are kept outside of the directory the
+// rules of the changed ignore file apply below, or dropped if the whole folder was reloaded or an
+// excludes file changed.
+void Folder::publish_snapshot(std::optional<PathId> changed_gitignore)
+{
+	const auto previous = published.load();
+	const uint64_t generation = previous ? previous->generation + 1 : 1;
+	const std::optional<fs::path> changed_base =
+		changed_gitignore ? ignore_source_base(path_table().path(*changed_gitignore))
+						  : std::nullopt;
+	if (changed_base)
+		directory_cache.invalidate(generation, *changed_base);
+	else
+		directory_cache.clear(generation);
+
+	std::set<PathId> excludes_files;
+	for (const auto& [path, bases] : excludes_bases)
+		excludes_files.insert(path);
+	published.publish(std::make_shared<const FolderSnapshot>(
+		FolderSnapshot{.generation = generation,
+					   .matchers = registry.snapshot(),
+					   .gitignore_count = state.gitignore_files.size(),
+					   .excludes_files = std::move(excludes_files)}));
+}
+
+// A .gitignore or .git/info/exclude file of the tree, or an excludes file in use
+bool Folder::may_read(const fs::path& file) const
+{
+	if (ignore_source_kind(file) != IgnoreSourceKind::excludes_file)
+		return contains_path(root_path, file);
+	const auto known_id = path_table().find(file);
+	const auto current = published.load();
+	return known_id && current && current->excludes_files.contains(*known_id);
+}
+
+void Folder::scan(const std::optional<ScanRequest>& request)
+{
+	std::lock_guard<std::mutex> scan_lock(scan_mutex);
+	const TraceScope trace_scope("scan");
+	const auto started = std::chrono::steady_clock::now();
+
+	// The first scan and the requests for a path outside of the folder read the whole tree. A file
+	// or a directory that no longer exists is rescanned from the directory holding it.
+	fs::path subtree = request ? normalize_path(request->subtree) : root_path;
+	std::error_code ec;
+	while (contains_path(root_path, subtree) && subtree != root_path &&
+		   !fs::is_directory(subtree, ec))
+		subtree = subtree.parent_path();
+
+	ScanRequest scoped{.subtree = root_path, .max_age = std::chrono::seconds(0)};
+	bool first_scan = false;
+	// The records of the previous walks, to skip the trees read recently enough
+	ScanRecords records;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopped)
+			return;
+		if (!writer)
+		{
+			// The first scan loads the saved state, and creates the .stignore file if there is none
+			load_state();
+			first_scan = !fs::exists(root_path / ".stignore");
+			if (!first_scan)
+				load_stignore();
+		}
+		else if (contains_path(root_path, subtree))
+		{
+			scoped = {.subtree = subtree,
+					  .max_age = request ? request->max_age : std::chrono::seconds(0)};
+		}
+		if (scoped.max_age.count() > 0)
+			records = scan_records;
+	}
+
+	if (scoped.max_age.count() > 0)
+		tb_trace_i("[reload] scanning %s, skipping what was read less than %llds ago",
+				   scoped.subtree.generic_string().c_str(),
+				   static_cast<long long>(scoped.max_age.count()));
+	else
+		tb_trace_i("[reload] scanning %s", scoped.subtree.generic_string().c_str());
+
+	// The walk may wait for the throttle for long, the folder isn't locked meanwhile
+	const auto walk_started = ScanRecords::Clock::now();
+	std::function<bool(const fs::path&)> skip;
+	if (scoped.max_age.count() > 0)
+	{
+		skip = [&](const fs::path& directory) {
+			return records.fresh(directory, scoped.max_age, walk_started);
+		};
+	}
+	auto collected =
+		collect_gitignore_files(scoped.subtree, scan_throttle, scan_progress, cancelled, skip);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// A cancelled walk is incomplete, it must not remove the files it didn't reach
+		if (stopped || cancelled)
+			return;
+		if (first_scan)
+			create_stignore(collected, walk_started);
+		else
+			update_stignore(scoped, collected, walk_started);
+		publish_snapshot();
+	}
+	metrics().scan_duration.observe(std::chrono::steady_clock::now() - started);
+}
+
+bool Folder::file_modified(const fs::path& file)
+{
+	// The changes of the other files don't wait for a scan merging its results
+	if (!may_read(file))
+		return false;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopped || !writer)
+		return false;
+
+	const PathId file_id = path_table().intern(file);
+	// The excludes file may have been dropped since the snapshot was published
+	if (ignore_source_kind(file) == IgnoreSourceKind::excludes_file &&
+		!excludes_bases.contains(file_id))
+		return false;
+
+	tb_trace_i("[watcher] ignore file modified at : %s", file.generic_string().c_str());
+
+	// An ignore file has changed, update its rules only, so that only its record is saved
+	auto it = state.gitignore_files.find(file_id);
+	if (it == state.gitignore_files.end())
+		it = state.gitignore_files.emplace(file_id, GitIgnoreFile{}).first;
+
+	std::error_code ec;
+	it->second.mtime = fs::last_write_time(file, ec);
+	load_gitignore(file_id);
+	file_changed(file_id);
+	matcher_cache.save();
+	save_stignore();
+	publish_snapshot(file_id);
+	return true;
+}
+
+bool Folder::file_deleted(const fs::path& file)
+{
+	if (!may_read(file))
+		return false;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopped || !writer)
+		return false;
+
+	const auto file_id = path_table().find(file);
+	if (!file_id || !state.gitignore_files.contains(*file_id))
+		return false;
+	state.gitignore_files.erase(*file_id);
+	excludes_bases.erase(*file_id);
+	file_removed(*file_id);
+
+	save_stignore();
+	publish_snapshot(*file_id);
+	return true;
+}
+
+void Folder::stop()
+{
+	// A walk in progress gives up instead of reading the rest of the tree at the throttled pace
+	cancelled = true;
+	scan_throttle.wake_walkers();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (stopped)
+		return;
+	stopped = true;
+	if (writer)
+		writer->stop();
+}
+
+std::vector<PathId> Folder::directories() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::set<PathId> directories;
+	for (const auto& [path, gitignore_file] : state.gitignore_files)
+		directories.insert(path_table().parent(path));
+	return std::vector<PathId>(directories.begin(), directories.end());
+}
+
+bool Folder::autostart() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return state.autostart;
+}
+
+bool Folder::is_ignored(const fs::path& path)
+{
+	// Answered from the last published snapshot, without locking the folder
+	const auto current = published.load();
+	if (!current)
+		return false;
+	return directory_cache.is_ignored(path, *current->matchers, current->generation);
+}
+
+std::string dump_folder_state(const fs::path& root)
+{
+	const fs::path normalized = normalize_path(root);
+	StateFile state_file(normalized / "synctignore.state");
+	State state;
+	if (!state_file.load(state))
+		import_json_state(normalized, state);
+	return json(state).dump(4);
+}
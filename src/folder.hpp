@@ -0,0 +1,130 @@
+#ifndef FOLDER_H
+#define FOLDER_H
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "directory_cache.hpp"
+#include "matcher_cache.hpp"
+#include "matcher_registry.hpp"
+#include "path_table.hpp"
+#include "scan_records.hpp"
+#include "scan_throttle.hpp"
+#include "snapshot.hpp"
+#include "state_file.hpp"
+
+// What the queries about a folder are answered from.
+// A new snapshot is published after each update so that queries never wait for a reload.
+struct FolderSnapshot
+{
+	uint64_t generation = 0;
+	std::shared_ptr<const MatcherSnapshot> matchers;
+	size_t gitignore_count = 0;
+	// Excludes files in use, so that the changes of the other files are told apart without
+	// locking the folder
+	std::set<PathId> excludes_files;
+};
+
+// Ignore files found by a walk of the tree, with their modification time
+struct CollectedIgnoreFiles;
+
+// A synced folder: the ignore files of its tree, the state kept between two runs and the
+// .stignore file generated at its root. Folders are isolated from each other, each with its own
+// state, matchers and cached directory results, only the matcher cache is shared.
+// All the methods can be called from any thread.
+class Folder
+{
+	const std::filesystem::path root_path;
+	StateFile state_file;
+	MatcherCache& matcher_cache;
+	ScanThrottle& scan_throttle;
+	ScanProgress scan_progress;
+	MatcherRegistry registry;
+	DirectoryCache directory_cache;
+	Published<FolderSnapshot> published;
+
+	// Scans of the folder run one at a time. Only another scan ever waits for it: the tree is
+	// walked without the mutex below locked, which is only held to merge what the walk found.
+	std::mutex scan_mutex;
+	// Set by stop, the walk in progress gives up without waiting for the throttle
+	std::atomic<bool> cancelled = false;
+
+	// Guards everything below
+	mutable std::mutex mutex;
+	State state;
+	// Saves the changes marked dirty in the background
+	std::unique_ptr<StateWriter> writer;
+	// Repositories using each excludes file, found again by each scan rather than saved
+	std::map<PathId, std::vector<std::filesystem::path>> excludes_bases;
+	// When the directories were last read, kept for the lifetime of the folder only
+	ScanRecords scan_records;
+	bool stopped = false;
+
+	// Must be called with the mutex locked
+	void load_state();
+	std::vector<std::filesystem::path> base_dirs(PathId path) const;
+	OrderedRuleSet st_rules() const;
+	void load_gitignore(PathId path);
+	void file_changed(PathId path);
+	void file_removed(PathId path);
+	void load_matchers();
+	void save_stignore() const;
+	void load_stignore();
+	void create_stignore(CollectedIgnoreFiles& collected, ScanRecords::Clock::time_point started);
+	void update_stignore(const ScanRequest& request, CollectedIgnoreFiles& collected,
+						 ScanRecords::Clock::time_point started);
+	void publish_snapshot(std::optional<PathId> changed_gitignore = std::nullopt);
+	// Whether the file may be one of the ignore files of the folder, without locking it
+	bool may_read(const std::filesystem::path& file) const;
+
+  public:
+	// The walks of the tree are throttled along with the ones of the other folders
+	Folder(std::filesystem::path root, MatcherCache& cache, ScanThrottle& throttle);
+	~Folder();
+
+	Folder(const Folder&) = delete;
+	Folder& operator=(const Folder&) = delete;
+
+	const std::filesystem::path& root() const
+	{
+		return root_path;
+	}
+
+	// Brings the folder up to date with its whole tree, or with the part of it the request is
+	// about. The first scan loads the saved state, creates the .stignore file if there is none,
+	// and always reads the whole tree.
+	void scan(const std::optional<ScanRequest>& request = std::nullopt);
+	// Updates the rules of a changed ignore file, false if the file isn't one of the folder
+	bool file_modified(const std::filesystem::path& file);
+	bool file_deleted(const std::filesystem::path& file);
+	// Saves the pending changes, the folder ignores any later call
+	void stop();
+
+	// Directories holding the ignore files, the ones to watch
+	std::vector<PathId> directories() const;
+	bool autostart() const;
+
+	bool is_ignored(const std::filesystem::path& path);
+	std::shared_ptr<const FolderSnapshot> snapshot() const
+	{
+		return published.load();
+	}
+	// Walk of the tree in progress, or the last one
+	const ScanProgress& progress() const
+	{
+		return scan_progress;
+	}
+};
+
+// Saved state of the folder as JSON, for debugging
+std::string dump_folder_state(const std::filesystem::path& root);
+
+#endif
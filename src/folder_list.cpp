@@ -0,0 +1,114 @@
+#include <algorithm>
+
+#include "folder_list.hpp"
+#include "syncthing_config.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	void add_unique(std::vector<fs::path>& paths, fs::path path)
+	{
+		if (std::find(paths.begin(), paths.end(), path) == paths.end())
+			paths.push_back(std::move(path));
+	}
+
+	void merge(FolderList& list, const FolderList& other)
+	{
+		for (const auto& root : other.roots)
+			add_unique(list.roots, root);
+		for (const auto& source : other.sources)
+			add_unique(list.sources, source);
+		list.complete &= other.complete;
+	}
+} // namespace
+
+FolderList parse_folder_list(std::string_view content, const fs::path& base)
+{
+	constexpr std::string_view syncthing_directive = "@syncthing";
+	constexpr std::string_view scan_directive = "@scan";
+
+	FolderList list;
+	for_each_line(content, [&](std::string_view line) {
+		const size_t first = line.find_first_not_of(" \t");
+		if (first == std::string_view::npos || line[first] == '#')
+			return;
+		line = line.substr(first, line.find_last_not_of(" \t") + 1 - first);
+
+		if (line == scan_directive || line.starts_with("@scan ") || line.starts_with("@scan\t"))
+		{
+			ScanOptions options = list.scan_options.value_or(ScanOptions{});
+			if (parse_scan_options(line.substr(scan_directive.size()), options))
+				list.scan_options = options;
+			return;
+		}
+
+		if (line == syncthing_directive || line.starts_with("@syncthing "))
+		{
+			std::string_view config = line.substr(syncthing_directive.size());
+			config.remove_prefix(std::min(config.size(), config.find_first_not_of(" \t")));
+			if (config.empty())
+			{
+				// Nothing to add while Syncthing has no config
+				if (const auto config_path = find_syncthing_config())
+					merge(list, syncthing_folder_list(*config_path));
+			}
+			else
+			{
+				merge(list, syncthing_folder_list(normalize_path(base / fs::path(config))));
+			}
+			return;
+		}
+
+		add_unique(list.roots, normalize_path(base / fs::path(line)));
+	});
+	return list;
+}
+
+std::optional<FolderList> read_folder_list(const fs::path& list_path)
+{
+	std::error_code ec;
+	if (!fs::is_regular_file(list_path, ec))
+		return std::nullopt;
+	const MappedFile content(list_path);
+	FolderList list = parse_folder_list(content.view(), list_path.parent_path());
+	add_unique(list.sources, normalize_path(list_path));
+	return list;
+}
+
+FolderList syncthing_folder_list(const fs::path& config_path)
+{
+	FolderList list;
+	list.sources.push_back(normalize_path(config_path));
+	const auto folders = read_syncthing_config_folders(config_path);
+	if (!folders)
+	{
+		list.complete = false;
+		return list;
+	}
+	for (const auto& folder : *folders)
+		add_unique(list.roots, normalize_path(folder));
+	return list;
+}
+
+std::optional<size_t> find_folder(const std::vector<fs::path>& roots, const fs::path& path)
+{
+	const fs::path normalized = normalize_path(path);
+	std::optional<size_t> found;
+	size_t found_length = 0;
+	for (size_t i = 0; i < roots.size(); i++)
+	{
+		const auto& root = roots[i];
+		if (!contains_path(root, normalized))
+			continue;
+
+		const size_t length = std::distance(root.begin(), root.end());
+		if (!found || length > found_length)
+		{
+			found = i;
+			found_length = length;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,40 @@
+#ifndef FOLDER_LIST_H
+#define FOLDER_LIST_H
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "scan_throttle.hpp"
+
+// Synced folders to manage and the files they were listed in
+struct FolderList
+{
+	std::vector<std::filesystem::path> roots;
+	// Files to watch, a change to one of them lists the folders again
+	std::vector<std::filesystem::path> sources;
+	// False if a source couldn't be read entirely, the current folders are then kept
+	bool complete = true;
+	// Budget of the scans, if the list sets one
+	std::optional<ScanOptions> scan_options;
+};
+
+// Folders listed in content, one root per line. Empty lines and lines starting with '#' are
+// skipped, relative paths are relative to base, duplicates are dropped. A "@syncthing" line
+// adds the folders of the local Syncthing, "@syncthing <config.xml>" those of a given config.
+// "@scan key=value ..." sets the scan options, see parse_scan_options, an invalid line is skipped.
+FolderList parse_folder_list(std::string_view content, const std::filesystem::path& base);
+
+// Folders listed in the file, which is a source of the list. Nothing if it doesn't exist.
+std::optional<FolderList> read_folder_list(const std::filesystem::path& list_path);
+
+// Folders of a Syncthing config.xml, which is the source of the list
+FolderList syncthing_folder_list(const std::filesystem::path& config_path);
+
+// Index of the deepest root containing the path, roots being normalized
+std::optional<size_t> find_folder(const std::vector<std::filesystem::path>& roots,
+								  const std::filesystem::path& path);
+
+#endif
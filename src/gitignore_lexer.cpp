@@ -0,0 +1,156 @@
+#include "gitignore_lexer.hpp"
+
+namespace
+{
+	bool is_special(char c)
+	{
+		return c == '\\' || c == '/' || c == '*' || c == '?' || c == '[';
+	}
+
+	// Trailing spaces are ignored unless they are escaped with a backslash
+	size_t trimmed_end(std::string_view line, size_t begin)
+	{
+		size_t end = line.size();
+		while (end > begin && line[end - 1] == ' ')
+		{
+			size_t backslashes = 0;
+			while (end - 1 - backslashes > begin && line[end - 2 - backslashes] == '\\')
+				backslashes++;
+			if (backslashes % 2 == 1)
+				break;
+			end--;
+		}
+		return end;
+	}
+} // namespace
+
+std::optional<LexedPattern> lex_gitignore_pattern(std::string_view line,
+												  std::optional<LexError>* error)
+{
+	// Comments and empty lines
+	if (line.empty() || line[0] == '#')
+		return std::nullopt;
+
+	LexedPattern pattern;
+	size_t pos = 0;
+	if (line[0] == '!')
+	{
+		pattern.negation = true;
+		pos = 1;
+	}
+
+	const size_t end = trimmed_end(line, pos);
+	auto& tokens = pattern.tokens;
+	const auto push = [&](GlobTokenKind kind, size_t begin, size_t size) {
+		tokens.push_back(GlobToken{.kind = kind,
+								   .text = line.substr(begin, size),
+								   .column = static_cast<uint32_t>(begin)});
+	};
+
+	while (pos < end)
+	{
+		const char c = line[pos];
+		if (c == '\\')
+		{
+			if (pos + 1 >= end)
+			{
+				if (error)
+					*error = LexError{.column = pos, .message = "trailing backslash"};
+				return std::nullopt;
+			}
+			push(line[pos + 1] == '/' ? GlobTokenKind::separator : GlobTokenKind::literal, pos + 1,
+				 1);
+			pos += 2;
+		}
+		else if (c == '/')
+		{
+			push(GlobTokenKind::separator, pos, 1);
+			pos++;
+		}
+		else if (c == '*')
+		{
+			size_t run = pos;
+			while (run < end && line[run] == '*')
+				run++;
+			// Multi-asterisks not forming a whole segment are single asterisks
+			const bool segment_start = tokens.empty() || tokens.back().kind == GlobTokenKind::separator;
+			const bool segment_end = run == end || line[run] == '/';
+			if (run - pos >= 2 && segment_start && segment_end)
+				push(GlobTokenKind::double_star, pos, run - pos);
+			else
+				push(GlobTokenKind::star, pos, run - pos);
+			pos = run;
+		}
+		else if (c == '?')
+		{
+			push(GlobTokenKind::question, pos, 1);
+			pos++;
+		}
+		else if (c == '[')
+		{
+			size_t j = pos + 1;
+			if (j < end && line[j] == '!')
+				j++;
+			if (j < end && line[j] == ']')
+				j++;
+			while (j < end && line[j] != ']')
+				j++;
+
+			// Without its closing bracket, a bracket is a literal
+			if (j >= end)
+			{
+				push(GlobTokenKind::literal, pos, 1);
+				pos++;
+			}
+			else
+			{
+				push(GlobTokenKind::char_class, pos + 1, j - pos - 1);
+				pos = j + 1;
+			}
+		}
+		else
+		{
+			size_t run = pos + 1;
+			while (run < end && !is_special(line[run]))
+				run++;
+			push(GlobTokenKind::literal, pos, run - pos);
+			pos = run;
+		}
+	}
+
+	// '/' alone doesn't match any files or directories
+	if (tokens.empty() || (tokens.size() == 1 && tokens[0].kind == GlobTokenKind::separator))
+		return std::nullopt;
+
+	pattern.directory_only = tokens.back().kind == GlobTokenKind::separator;
+	// A slash is a sign that we're tied to the base path of our rule set
+	for (size_t i = 0; i + 1 < tokens.size(); i++)
+	{
+		if (tokens[i].kind == GlobTokenKind::separator)
+		{
+			pattern.anchored = true;
+			break;
+		}
+	}
+
+	size_t first = 0;
+	if (tokens[first].kind == GlobTokenKind::separator)
+		first++;
+	if (first < tokens.size() && tokens[first].kind == GlobTokenKind::double_star)
+	{
+		pattern.anchored = false;
+		size_t rest = first + 1;
+		if (rest < tokens.size() && tokens[rest].kind == GlobTokenKind::separator)
+			rest++;
+		// '**' alone matches everything below the base path, it is kept as the whole pattern
+		if (rest < tokens.size())
+			first = rest;
+		else
+			tokens.resize(first + 1);
+	}
+	if (tokens.back().kind == GlobTokenKind::separator)
+		tokens.pop_back();
+	tokens.erase(tokens.begin(), tokens.begin() + first);
+
+	return pattern;
+}
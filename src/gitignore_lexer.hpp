@@ -0,0 +1,56 @@
+#ifndef GITIGNORE_LEXER_H
+#define GITIGNORE_LEXER_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class GlobTokenKind : uint8_t
+{
+	// Characters matched as they are, escapes resolved
+	literal,
+	// '*', any characters but a separator
+	star,
+	// '**' forming a whole path segment, any number of segments
+	double_star,
+	// '?', any character but a separator
+	question,
+	// '[...]', the text is what comes between the brackets
+	char_class,
+	// '/'
+	separator,
+};
+
+struct GlobToken
+{
+	GlobTokenKind kind;
+	// View into the lexed line
+	std::string_view text;
+	// Position of the token in the line
+	uint32_t column;
+};
+
+// A gitignore pattern split in glob tokens.
+// The leading and trailing separators and a leading '**/' are not tokens, they are flags.
+struct LexedPattern
+{
+	std::vector<GlobToken> tokens;
+	bool negation = false;
+	bool directory_only = false;
+	bool anchored = false;
+};
+
+struct LexError
+{
+	size_t column;
+	std::string message;
+};
+
+// Splits a gitignore line in glob tokens, in a single pass and without copying it.
+// Returns nothing for blank lines, comments and invalid patterns, the latter setting error.
+std::optional<LexedPattern> lex_gitignore_pattern(std::string_view line,
+												  std::optional<LexError>* error = nullptr);
+
+#endif
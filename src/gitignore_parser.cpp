@@ -23,42 +23,20 @@
 // C++ implementation of the python package gitignore_parser:
 // https://github.com/mherrmann/gitignore_parser
 
+#include <algorithm>
 #include <cstdint>
-#include <fstream>
 #include <iostream>
-#include <stdexcept>
 
+#include "gitignore_lexer.hpp"
 #include "gitignore_parser.hpp"
+#include "simd_scan.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 namespace fs = std::filesystem;
 
-void remove_trailing_characters(std::string& str, const char charToRemove)
-{
-	str.erase(str.find_last_not_of(charToRemove) + 1, std::string::npos);
-}
-
-std::string process_substring(const std::string& pattern, size_t i, size_t j)
-{
-	std::string stuff = pattern.substr(i, j); // Extract substring
-
-	// Replace '\' with '\\'
-	size_t pos = 0;
-	while ((pos = stuff.find('\\', pos)) != std::string::npos)
-	{
-		stuff.replace(pos, 1, "\\\\");
-		pos += 2; // Move past the newly inserted '\\'
-	}
-
-	// Remove all '/'
-	stuff.erase(std::remove(stuff.begin(), stuff.end(), '/'), stuff.end());
-
-	return stuff;
-}
-
 // Converts gitignore patterns to regex
-std::string fnmatch_pathname_to_regex(const std::string pattern, bool directory_only, bool negation,
-									  bool anchored)
+std::string fnmatch_pathname_to_regex(const LexedPattern& pattern)
 {
 	char sep = fs::path::preferred_separator;
 	std::string seps_group;
@@ -73,121 +51,209 @@ std::string fnmatch_pathname_to_regex(const std::string pattern, bool directory_
 	std::string nonsep = "[^" + (sep == '\\' ? "\\\\" : std::string(1, sep)) + "/]";
 
 	std::string regex_str;
-	size_t i = 0, n = pattern.size();
-
-	while (i < n)
+	const auto& tokens = pattern.tokens;
+	for (size_t i = 0; i < tokens.size(); i++)
 	{
-		char c = pattern[i++];
-		if (c == '*')
+		const GlobToken& token = tokens[i];
+		switch (token.kind)
 		{
-			try
-			{
-				if (i < n && pattern.at(i) == '*')
+			case GlobTokenKind::literal:
+				for (const char c : token.text)
+				{
+					if (std::string_view("\\^$.|?*+()[]{}").find(c) != std::string_view::npos)
+						regex_str += '\\';
+					regex_str += c;
+				}
+				break;
+			case GlobTokenKind::star:
+				regex_str += nonsep + "*";
+				break;
+			case GlobTokenKind::double_star:
+				if (i + 1 < tokens.size() && tokens[i + 1].kind == GlobTokenKind::separator)
 				{
 					i++;
-					if (i < n && pattern.at(i) == '/')
-					{
-						i++;
-						regex_str += "(.*" + seps_group + ")?";
-					}
-					else
-					{
-						regex_str += ".*";
-					}
+					regex_str += "(.*" + seps_group + ")?";
 				}
 				else
 				{
-					regex_str += nonsep + "*";
+					regex_str += ".*";
 				}
-			}
-			catch (const std::out_of_range&)
+				break;
+			case GlobTokenKind::question:
+				regex_str += nonsep;
+				break;
+			case GlobTokenKind::separator:
+				regex_str += seps_group;
+				break;
+			case GlobTokenKind::char_class:
 			{
-				regex_str += nonsep + "*";
-			}
-		}
-		else if (c == '?')
-		{
-			regex_str += nonsep;
-		}
-		else if (c == '/')
-		{
-			regex_str += seps_group;
-		}
-		else if (c == '[')
-		{
-			size_t j = i;
-			if (j < n && pattern[j] == '!')
-				j++;
-			if (j < n && pattern[j] == ']')
-				j++;
-
-			while (j < n && pattern[j] != ']')
-				j++;
-			if (j >= n)
-			{
-				regex_str += "\\[";
-			}
-			else
-			{
-				std::string cls = process_substring(pattern, i, j - i);
-				i = j + 1;
-				if (cls[0] == '!')
+				std::string cls;
+				for (const char c : token.text)
 				{
-					cls = '^' + cls.substr(1);
+					if (c == '\\')
+						cls += "\\\\";
+					else if (c != '/')
+						cls += c;
 				}
-				else
-				{
-					// cls = '\\' + cls;
-					cls = cls;
-				}
-
+				if (cls[0] == '!')
+					cls[0] = '^';
 				regex_str += "[" + cls + "]";
+				break;
 			}
 		}
-		else
+	}
+
+	if (pattern.anchored)
+		regex_str = "^" + regex_str;
+	else
+		regex_str = "(^|" + seps_group + ")" + regex_str;
+
+	// A negated directory rule only matches the directory itself, and only when the path names an
+	// entry, which the matcher of the rule checks
+	if (pattern.directory_only && !pattern.negation)
+		regex_str += "($|" + seps_group + ")";
+	else
+		regex_str += "$";
+
+	return regex_str;
+}
+
+namespace
+{
+	const std::regex& never_matching_regex()
+	{
+		static const std::regex regex("[^\\s\\S]");
+		return regex;
+	}
+
+	// Literal text that any path matched by the rule contains, and whether it ends the path
+	std::pair<std::string, bool> required_literal(const LexedPattern& pattern)
+	{
+		std::string longest;
+		std::string current;
+		for (const auto& token : pattern.tokens)
 		{
-			if (std::string("^$.|?*+()[]{}").find(c) != std::string::npos)
+			if (token.kind == GlobTokenKind::literal)
 			{
-				regex_str += '\\';
+				current += token.text;
+				continue;
 			}
-			regex_str += c;
+			if (current.size() > longest.size())
+				longest = std::move(current);
+			current.clear();
 		}
+		// A directory rule also matches what is below the directory
+		if (!current.empty() && !pattern.directory_only)
+			return {std::move(current), true};
+		if (current.size() > longest.size())
+			longest = std::move(current);
+		return {std::move(longest), false};
 	}
+} // namespace
 
-	if (anchored)
-		regex_str = "^" + regex_str;
-	else
-		regex_str = "(^|" + seps_group + ")" + regex_str;
+LazyRegexes::LazyRegexes(const LazyRegexes& other)
+	: sources(other.sources), source_ends(other.source_ends),
+	  compiled(std::make_unique<std::atomic<const std::regex*>[]>(other.size())),
+	  capacity(other.size())
+{
+}
+
+LazyRegexes& LazyRegexes::operator=(LazyRegexes other) noexcept
+{
+	std::swap(sources, other.sources);
+	std::swap(source_ends, other.source_ends);
+	std::swap(compiled, other.compiled);
+	std::swap(capacity, other.capacity);
+	std::swap(mutex, other.mutex);
+	return *this;
+}
 
-	if (directory_only)
+LazyRegexes::~LazyRegexes()
+{
+	if (!compiled)
+		return;
+	for (size_t i = 0; i < size(); i++)
 	{
-		if (!negation)
-			regex_str += "($|" + seps_group + ")";
-		else
-			regex_str += "/$";
+		const std::regex* regex = compiled[i].load(std::memory_order_relaxed);
+		if (regex != &never_matching_regex())
+			delete regex;
 	}
-	else
+}
+
+void LazyRegexes::reserve(size_t count)
+{
+	if (count <= capacity)
+		return;
+
+	auto grown = std::make_unique<std::atomic<const std::regex*>[]>(count);
+	for (size_t i = 0; i < size(); i++)
+		grown[i].store(compiled[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	compiled = std::move(grown);
+	capacity = count;
+}
+
+void LazyRegexes::push_back(std::string_view source)
+{
+	if (size() == capacity)
+		reserve(std::max<size_t>(16, capacity * 2));
+	sources += source;
+	source_ends.push_back(static_cast<uint32_t>(sources.size()));
+}
+
+const std::regex& LazyRegexes::get(size_t index) const
+{
+	if (const std::regex* regex = compiled[index].load(std::memory_order_acquire))
+		return *regex;
+
+	std::lock_guard<std::mutex> lock(*mutex);
+	const std::regex* regex = compiled[index].load(std::memory_order_relaxed);
+	if (!regex)
 	{
-		regex_str += "$";
+		try
+		{
+			regex = new std::regex(std::string(source(index)));
+		}
+		catch (const std::regex_error&)
+		{
+			regex = &never_matching_regex();
+		}
+		compiled[index].store(regex, std::memory_order_release);
 	}
+	return *regex;
+}
 
-	return regex_str;
+size_t LazyRegexes::compiled_count() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < size(); i++)
+	{
+		if (compiled[i].load(std::memory_order_relaxed))
+			count++;
+	}
+	return count;
 }
 
-bool IgnoreRule::match(const fs::path& abs_path) const
+std::optional<std::string> RuleSet::relative_path(uint32_t file, const fs::path& abs_path) const
 {
 	try
 	{
 		fs::path rel_path = normalize_path(abs_path);
+		const File& rules_file = files[file];
+		const fs::path* base_path = rules_file.base_path ? &*rules_file.base_path : nullptr;
+		for (const auto& shared : rules_file.shared_base_paths)
+		{
+			// The deepest directory containing the path
+			if (contains_path(shared, rel_path) &&
+				(!base_path || !contains_path(*base_path, rel_path) ||
+				 contains_path(*base_path, shared)))
+				base_path = &shared;
+		}
 		if (base_path)
 		{
-			fs::path directory = rel_path.parent_path();
-			if (!base_path.value().compare(directory))
-			{
-
-				// throw std::runtime_error("Given path is not in the subpath of the base path");
-			}
-			rel_path = std::filesystem::relative(normalize_path(abs_path), base_path.value());
+			rel_path = std::filesystem::relative(rel_path, *base_path);
+			// The rules of a gitignore file only apply below its directory
+			if (!rel_path.empty() && *rel_path.begin() == "..")
+				return std::nullopt;
 		}
 
 		std::string rel_str = rel_path.string();
@@ -196,102 +262,216 @@ bool IgnoreRule::match(const fs::path& abs_path) const
 			rel_str = ".";
 		if (rel_str.substr(0, 2) == "./")
 			rel_str.erase(0, 2);
-
-		if (directory_only && negation && abs_path.has_filename())
-			rel_str += '/';
-
-		return std::regex_search(rel_str, regex);
+		return rel_str;
 	}
 	catch (const std::filesystem::filesystem_error&)
 	{
-		return false;
+		return std::nullopt;
 	}
 }
 
-std::optional<IgnoreRule> rule_from_pattern(const std::string& orig_pattern,
-											const std::optional<fs::path>& base_path,
-											const std::optional<std::pair<fs::path, int>>& source)
+bool RuleSet::may_match(size_t rule, std::string_view rel_str) const
 {
-	std::string pattern = orig_pattern;
+	const std::string_view required = literal(rule);
+	if (required.empty())
+		return true;
+	if (flags[rule] & literal_suffix_flag)
+		return rel_str.ends_with(required);
+	return find_literal(rel_str, required) != std::string_view::npos;
+}
 
-	// Ignore comments and empty lines
-	if (pattern.empty() || pattern[0] == '#')
-		return std::nullopt;
+bool regex_matches(const LazyRegexes& regexes, uint32_t rule, std::string_view path)
+{
+	return std::regex_search(path.begin(), path.end(), regexes.get(rule));
+}
 
-	// Strip leading bang before examining double asterisks
-	bool negation = false;
-	if (pattern[0] == '!')
-	{
-		negation = true;
-		pattern.erase(0, 1);
-	}
+bool RuleSet::match_relative(size_t rule, const MatchSubject& subject) const
+{
+	return may_match(rule, subject.path) && match_rule(matchers[rule], subject, regexes);
+}
 
-	// Multi-asterisks not surrounded by slashes (or at the start/end) should
-	// be treated like single-asterisks.
-	pattern = std::regex_replace(pattern, std::regex(R"(([^/])\*{2,})"), "$1*");
-	pattern = std::regex_replace(pattern, std::regex(R"(\*{2,}([^/]))"), "*$1");
+bool RuleSet::match(size_t rule, const fs::path& abs_path) const
+{
+	const auto rel_str = relative_path(rule_files[rule], abs_path);
+	return rel_str && match_relative(rule, MatchSubject{*rel_str, abs_path.has_filename()});
+}
 
-	// Special-casing '/', which doesn't match any files or directories
-	remove_trailing_characters(pattern, ' ');
-	if (pattern == "/")
+std::optional<bool> RuleSet::decide_prefiltered(const fs::path& abs_path) const
+{
+	// Rules whose literal is in the relative path, plus the rules without literal
+	std::vector<std::optional<std::string>> rel_strs(files.size());
+	std::vector<uint32_t> candidates;
+	for (uint32_t file = 0; file < files.size(); file++)
+	{
+		rel_strs[file] = relative_path(file, abs_path);
+		if (!rel_strs[file])
+			continue;
+		const std::string& rel_str = *rel_strs[file];
+		prefilter.scan(rel_str, [&](uint32_t rule, size_t end) {
+			if (rule_files[rule] == file &&
+				(!(flags[rule] & literal_suffix_flag) || end == rel_str.size()))
+				candidates.push_back(rule);
+		});
+	}
+	for (const uint32_t rule : unfiltered_rules)
+	{
+		if (rel_strs[rule_files[rule]])
+			candidates.push_back(rule);
+	}
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	// Same order as the full scan, the other rules can't match
+	const bool names_entry = abs_path.has_filename();
+	const auto matches = [&](uint32_t rule) {
+		return match_relative(rule, MatchSubject{*rel_strs[rule_files[rule]], names_entry});
+	};
+	if (negations)
+	{
+		for (auto it = candidates.rbegin(); it != candidates.rend(); ++it)
+		{
+			if (matches(*it))
+				return !negation(*it);
+		}
 		return std::nullopt;
+	}
+	if (std::any_of(candidates.begin(), candidates.end(), matches))
+		return true;
+	return std::nullopt;
+}
 
-	bool directory_only = pattern[pattern.size() - 1] == '/';
-
-	// A slash is a sign that we're tied to the base_path of our rule
-	// set.
-	bool anchored = pattern.substr(0, pattern.size() - 1).find('/') != std::string::npos;
+std::optional<bool> RuleSet::decide(const fs::path& abs_path) const
+{
+	if (prefiltered)
+		return decide_prefiltered(abs_path);
+
+	// The rules of a file are contiguous, so the relative path is computed once per file
+	uint32_t current_file = UINT32_MAX;
+	std::optional<std::string> rel_str;
+	const bool names_entry = abs_path.has_filename();
+	const auto matches = [&](size_t rule) {
+		if (rule_files[rule] != current_file)
+		{
+			current_file = rule_files[rule];
+			rel_str = relative_path(current_file, abs_path);
+		}
+		return rel_str && match_relative(rule, MatchSubject{*rel_str, names_entry});
+	};
 
-	if (pattern[0] == '/')
-		pattern = pattern.substr(1);
-	if ((pattern[0] == '*') && (pattern.size() >= 2) && (pattern[1] == '*'))
+	if (negations)
 	{
-		pattern = pattern.substr(2);
-		anchored = false;
+		for (size_t rule = size(); rule-- > 0;)
+		{
+			if (matches(rule))
+				return !negation(rule);
+		}
+		return std::nullopt;
 	}
-	if (pattern[0] == '/')
-		pattern = pattern.substr(1);
-	if (pattern.back() == '/')
-		pattern = pattern.substr(0, pattern.size() - 1);
-
-	// patterns with leading hashes or exclamation marks are escaped with a
-	// backslash in front, unescape it
-	if ((pattern[0] == '\\') && (pattern[1] == '#' || pattern[1] == '!'))
+
+	for (size_t rule = 0; rule < size(); rule++)
 	{
-		pattern = pattern.substr(1);
+		if (matches(rule))
+			return true;
 	}
+	return std::nullopt;
+}
 
-	uint32_t i = pattern.size() - 1;
-	bool strip_trailing_slash = false;
+bool RuleSet::is_ignored(const fs::path& abs_path) const
+{
+	return decide(abs_path).value_or(false);
+}
 
-	// trailing spaces are ignored unless they are escaped with a backslash
-	while (i > 1 && pattern[i] == ' ')
+void RuleSet::build_prefilter()
+{
+	prefilter = LiteralAutomaton();
+	unfiltered_rules.clear();
+	for (uint32_t rule = 0; rule < size(); rule++)
 	{
-		if (pattern[i - 1] == '\\')
-		{
-			pattern = pattern.substr(0, i - 1) + pattern.substr(i);
-			i--;
-			strip_trailing_slash = false;
-		}
+		const std::string_view required = literal(rule);
+		if (required.empty())
+			unfiltered_rules.push_back(rule);
 		else
-		{
-			if (strip_trailing_slash)
-			{
-				pattern = pattern.substr(0, i);
-			}
-			i--;
-		}
+			prefilter.add(required, rule);
 	}
+	prefilter.build();
+	prefiltered = true;
+}
 
-	std::string regex_str = fnmatch_pathname_to_regex(pattern, directory_only, negation, anchored);
+bool RuleSet::applies_below(const fs::path& directory) const
+{
+	return std::any_of(files.begin(), files.end(), [&](const File& file) {
+		return !file.base_path || contains_path(*file.base_path, directory) ||
+			   std::any_of(file.shared_base_paths.begin(), file.shared_base_paths.end(),
+						   [&](const fs::path& base) { return contains_path(base, directory); });
+	});
+}
 
-	return IgnoreRule(orig_pattern, regex_str, negation, directory_only, anchored, base_path,
-					  source);
+void RuleSet::add_base_path(fs::path base_path)
+{
+	File& file = files.back();
+	if (file.base_path != base_path &&
+		std::find(file.shared_base_paths.begin(), file.shared_base_paths.end(), base_path) ==
+			file.shared_base_paths.end())
+		file.shared_base_paths.push_back(std::move(base_path));
 }
 
-// Parses a .gitignore file into rules
-std::vector<IgnoreRule> parse_gitignore(const fs::path& path,
-										std::optional<fs::path> base_dir = std::nullopt)
+void RuleSet::append(const std::vector<RuleDefinition>& definitions, const fs::path& source,
+					 std::optional<fs::path> base_path)
+{
+	prefiltered = false;
+	const uint32_t file = static_cast<uint32_t>(files.size());
+	files.push_back(
+		File{.source = source, .base_path = std::move(base_path), .shared_base_paths = {}});
+
+	const size_t count = size() + definitions.size();
+	pattern_ends.reserve(count);
+	regexes.reserve(count);
+	matchers.reserve(count);
+	literal_ends.reserve(count);
+	flags.reserve(count);
+	rule_files.reserve(count);
+	lines.reserve(count);
+	for (const auto& definition : definitions)
+	{
+		patterns += definition.pattern;
+		pattern_ends.push_back(static_cast<uint32_t>(patterns.size()));
+		// Compiled when first used, if the pattern needs a regex
+		const uint32_t rule = static_cast<uint32_t>(regexes.size());
+		regexes.push_back(definition.regex);
+		// The pattern was lexed once, when its definition was made
+		matchers.push_back(make_rule_matcher(definition.matcher, rule));
+		literals += definition.literal;
+		literal_ends.push_back(static_cast<uint32_t>(literals.size()));
+		flags.push_back((definition.negation ? negation_flag : 0) |
+						(definition.directory_only ? directory_only_flag : 0) |
+						(definition.anchored ? anchored_flag : 0) |
+						(definition.literal_suffix ? literal_suffix_flag : 0));
+		rule_files.push_back(file);
+		lines.push_back(definition.line);
+		negations |= definition.negation;
+	}
+}
+
+std::optional<RuleDefinition> definition_from_pattern(std::string_view line,
+													 std::optional<LexError>* error = nullptr)
+{
+	const std::optional<LexedPattern> pattern = lex_gitignore_pattern(line, error);
+	if (!pattern)
+		return std::nullopt;
+
+	auto [literal, literal_suffix] = required_literal(*pattern);
+	return RuleDefinition{.pattern = std::string(line),
+						  .regex = fnmatch_pathname_to_regex(*pattern),
+						  .negation = pattern->negation,
+						  .directory_only = pattern->directory_only,
+						  .anchored = pattern->anchored,
+						  .line = 0,
+						  .literal = std::move(literal),
+						  .literal_suffix = literal_suffix,
+						  .matcher = rule_matcher_definition(make_rule_matcher(*pattern, 0))};
+}
+
+std::optional<fs::path> resolve_base_dir(const fs::path& path, std::optional<fs::path> base_dir)
 {
 	if (!base_dir)
 	{
@@ -302,30 +482,61 @@ std::vector<IgnoreRule> parse_gitignore(const fs::path& path,
 	{
 		base_dir = std::optional(normalize_path(base_dir.value()));
 	}
-	// fs::path base = base_dir.empty() ? path.parent_path() : base_dir;
-	std::vector<IgnoreRule> rules;
-
-	if (!std::filesystem::exists(path))
-	{
-		return rules;
-	}
+	return base_dir;
+}
 
-	std::ifstream file(path);
-	std::string line;
+std::vector<RuleDefinition> definitions_from_content(std::string_view content,
+													 std::vector<ParseError>* errors)
+{
+	const TraceScope trace_scope("parse_gitignore");
+	std::vector<RuleDefinition> definitions;
 	int line_num = 0;
 
-	while (std::getline(file, line))
-	{
+	for_each_line(content, [&](std::string_view line) {
 		line_num++;
-		remove_trailing_characters(line, '\n');
-
-		std::optional<IgnoreRule> rule =
-			rule_from_pattern(line, base_dir, std::optional(std::make_pair(path, line_num)));
-		if (rule)
+		std::optional<LexError> error;
+		std::optional<RuleDefinition> definition = definition_from_pattern(line, &error);
+		if (definition)
 		{
-			rules.push_back(*rule);
+			definition->line = line_num;
+			definitions.push_back(std::move(*definition));
 		}
-	}
+		else if (error && errors)
+		{
+			errors->push_back(
+				ParseError{.line = line_num, .column = error->column, .message = error->message});
+		}
+	});
+
+	return definitions;
+}
 
+std::vector<RuleDefinition> parse_gitignore_definitions(const fs::path& path)
+{
+	const MappedFile content(path);
+	return definitions_from_content(content.view());
+}
+
+RuleSet rules_from_definitions(const std::vector<RuleDefinition>& definitions, const fs::path& path,
+							   std::optional<fs::path> base_dir)
+{
+	RuleSet rules;
+	rules.append(definitions, path, resolve_base_dir(path, base_dir));
 	return rules;
-}
\ No newline at end of file
+}
+
+// Parses a .gitignore file into rules
+RuleSet parse_gitignore(const fs::path& path, std::optional<fs::path> base_dir = std::nullopt)
+{
+	return rules_from_definitions(parse_gitignore_definitions(path), path, base_dir);
+}
+
+RuleSet parse_gitignore_content(std::string_view content, std::optional<fs::path> base_dir)
+{
+	if (base_dir)
+		base_dir = normalize_path(*base_dir);
+
+	RuleSet rules;
+	rules.append(definitions_from_content(content), fs::path(), base_dir);
+	return rules;
+}
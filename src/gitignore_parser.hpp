@@ -1,73 +1,273 @@
 #ifndef GITIGNORE_PARSER_H
 #define GITIGNORE_PARSER_H
 
-#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <regex>
 #include <string>
-#include <utility>
+#include <string_view>
 #include <vector>
 
-struct IgnoreRule
+#include "aho_corasick.hpp"
+#include "rule_matcher.hpp"
+
+// A gitignore line after preprocessing, the regex is not compiled yet.
+// Everything lexing the pattern gives is kept, so that the rule is built again without lexing.
+struct RuleDefinition
 {
 	std::string pattern;
-	std::regex regex;
+	std::string regex;
 	bool negation;
 	bool directory_only;
 	bool anchored;
-	std::optional<std::filesystem::path> base_path;
-	std::optional<std::pair<std::filesystem::path, int>> source;
+	int line;
+	// Literal text any path the rule matches contains, and whether it ends the path
+	std::string literal;
+	bool literal_suffix;
+	RuleMatcherDefinition matcher;
+};
+
+// Regexes compiled the first time they are used, from any thread.
+// A regex never used only costs its source and a pointer, which matters for large generated
+// gitignore files where most rules never match anything.
+class LazyRegexes
+{
+	std::string sources;
+	// End of each source in sources
+	std::vector<uint32_t> source_ends;
+	// Compiled regexes, null until first used
+	std::unique_ptr<std::atomic<const std::regex*>[]> compiled;
+	size_t capacity = 0;
+	// Serializes the compilations so that each regex is compiled once
+	std::unique_ptr<std::mutex> mutex = std::make_unique<std::mutex>();
+
+  public:
+	LazyRegexes() = default;
+	// The copy compiles its regexes again when they are used
+	LazyRegexes(const LazyRegexes& other);
+	LazyRegexes(LazyRegexes&& other) noexcept = default;
+	LazyRegexes& operator=(LazyRegexes other) noexcept;
+	~LazyRegexes();
+
+	// Adds a regex, must not be called while other threads use the regexes
+	void push_back(std::string_view source);
+	void reserve(size_t count);
+
+	size_t size() const
+	{
+		return source_ends.size();
+	}
+
+	std::string_view source(size_t index) const
+	{
+		const uint32_t begin = index ? source_ends[index - 1] : 0;
+		return std::string_view(sources).substr(begin, source_ends[index] - begin);
+	}
+
+	// Compiles the regex if needed, an invalid regex never matches
+	const std::regex& get(size_t index) const;
+	// Number of regexes compiled so far
+	size_t compiled_count() const;
+};
+
+// Rules of one or more gitignore files, stored as parallel arrays.
+// The patterns share one buffer, and the base path and source of the rules are stored once per
+// file and referred to by index, the rules of a file being contiguous.
+class RuleSet
+{
+	enum : uint8_t
+	{
+		negation_flag = 1 << 0,
+		directory_only_flag = 1 << 1,
+		anchored_flag = 1 << 2,
+		// The literal of the rule ends any path it matches, otherwise it is somewhere in it
+		literal_suffix_flag = 1 << 3,
+	};
+
+	struct File
+	{
+		std::filesystem::path source;
+		std::optional<std::filesystem::path> base_path;
+		// Other directories the rules apply below, for a file shared by several repositories
+		std::vector<std::filesystem::path> shared_base_paths;
+	};
+
+	std::string patterns;
+	// End of each pattern in patterns
+	std::vector<uint32_t> pattern_ends;
+	LazyRegexes regexes;
+	std::vector<RuleMatcher> matchers;
+	// Literal text required by each rule, checked before running its regex
+	std::string literals;
+	std::vector<uint32_t> literal_ends;
+	std::vector<uint8_t> flags;
+	std::vector<uint32_t> rule_files;
+	std::vector<int> lines;
+	std::vector<File> files;
+	bool negations = false;
+
+	// Literals of all the rules, finds the rules that may match a path in one scan
+	LiteralAutomaton prefilter;
+	// Rules without literal, always candidates
+	std::vector<uint32_t> unfiltered_rules;
+	bool prefiltered = false;
+
+	// Path relative to the base path of a file as the regexes expect it,
+	// nothing if the path is outside of the base path
+	std::optional<std::string> relative_path(uint32_t file,
+											 const std::filesystem::path& abs_path) const;
+	bool match_relative(size_t rule, const MatchSubject& subject) const;
+	// Returns false if the rule can't match the path, without running its regex
+	bool may_match(size_t rule, std::string_view rel_str) const;
+	std::optional<bool> decide_prefiltered(const std::filesystem::path& abs_path) const;
+
+  public:
+	// Appends the rules of a gitignore file
+	void append(const std::vector<RuleDefinition>& definitions,
+				const std::filesystem::path& source,
+				std::optional<std::filesystem::path> base_path);
+	// Applies the rules of the last appended file below one more normalized directory, the
+	// deepest directory containing a path being the one its rules are relative to
+	void add_base_path(std::filesystem::path base_path);
+
+	size_t size() const
+	{
+		return regexes.size();
+	}
+
+	bool empty() const
+	{
+		return regexes.size() == 0;
+	}
+
+	bool has_negations() const
+	{
+		return negations;
+	}
+
+	std::string_view pattern(size_t rule) const
+	{
+		const uint32_t begin = rule ? pattern_ends[rule - 1] : 0;
+		return std::string_view(patterns).substr(begin, pattern_ends[rule] - begin);
+	}
 
-	IgnoreRule(const std::string& p, const std::string& r, bool neg, bool dir_only, bool anch,
-			   const std::optional<std::filesystem::path>& base,
-			   const std::optional<std::pair<std::filesystem::path, int>>& src)
-		: pattern(p), regex(r), negation(neg), directory_only(dir_only), anchored(anch),
-		  base_path(base), source(src)
+	bool negation(size_t rule) const
 	{
+		return flags[rule] & negation_flag;
 	}
 
-	bool match(const std::filesystem::path& abs_path) const;
+	bool directory_only(size_t rule) const
+	{
+		return flags[rule] & directory_only_flag;
+	}
+
+	bool anchored(size_t rule) const
+	{
+		return flags[rule] & anchored_flag;
+	}
+
+	const std::optional<std::filesystem::path>& base_path(size_t rule) const
+	{
+		return files[rule_files[rule]].base_path;
+	}
+
+	const std::filesystem::path& source(size_t rule) const
+	{
+		return files[rule_files[rule]].source;
+	}
+
+	int line(size_t rule) const
+	{
+		return lines[rule];
+	}
+
+	std::string_view literal(size_t rule) const
+	{
+		const uint32_t begin = rule ? literal_ends[rule - 1] : 0;
+		return std::string_view(literals).substr(begin, literal_ends[rule] - begin);
+	}
+
+	// Number of rules whose regex was compiled so far
+	size_t compiled_count() const
+	{
+		return regexes.compiled_count();
+	}
+
+	bool match(size_t rule, const std::filesystem::path& abs_path) const;
+
+	// Indexes the literals of the rules, after which is_ignored only evaluates the rules whose
+	// literal is in the path. Appending rules drops the index.
+	void build_prefilter();
+
+	// Verdict of the last matching rule if there are negations, of any rule otherwise, nothing if
+	// no rule matches
+	std::optional<bool> decide(const std::filesystem::path& abs_path) const;
+	bool is_ignored(const std::filesystem::path& abs_path) const;
+
+	// True if some rules may apply to the paths in the normalized directory, those whose base path
+	// contains it. Compares paths lexically, without accessing the file system.
+	bool applies_below(const std::filesystem::path& directory) const;
 };
 
-std::vector<IgnoreRule> parse_gitignore(const std::filesystem::path& path,
-										std::optional<std::filesystem::path> base_dir);
+// Invalid line of a gitignore file, the line is ignored
+struct ParseError
+{
+	int line;
+	size_t column;
+	std::string message;
+};
+
+std::vector<RuleDefinition> parse_gitignore_definitions(const std::filesystem::path& path);
+// Same with the content of a gitignore file already in memory
+std::vector<RuleDefinition> definitions_from_content(std::string_view content,
+													 std::vector<ParseError>* errors = nullptr);
+RuleSet rules_from_definitions(const std::vector<RuleDefinition>& definitions,
+							   const std::filesystem::path& path,
+							   std::optional<std::filesystem::path> base_dir);
+
+RuleSet parse_gitignore(const std::filesystem::path& path,
+						std::optional<std::filesystem::path> base_dir);
+// Rules of gitignore content not coming from a file, matched against paths relative to base_dir
+// or as given without it
+RuleSet parse_gitignore_content(std::string_view content,
+								std::optional<std::filesystem::path> base_dir = std::nullopt);
 
 // Checks if a path is ignored based on rules
 class GitIgnoreMatcher
 {
-	std::vector<IgnoreRule> rules;
-	bool has_negations;
+	RuleSet rules;
 
   public:
+	explicit GitIgnoreMatcher(RuleSet ignore_rules) : rules(std::move(ignore_rules))
+	{
+		rules.build_prefilter();
+	}
+
 	GitIgnoreMatcher(const std::filesystem::path& gitignore_path,
 					 std::optional<std::filesystem::path> base_dir = std::nullopt)
-		: rules(parse_gitignore(gitignore_path, base_dir)),
-		  has_negations(
-			  std::any_of(rules.begin(), rules.end(), [](const auto& r) { return r.negation; }))
+		: rules(parse_gitignore(gitignore_path, base_dir))
 	{
+		rules.build_prefilter();
 	}
 
 	bool is_ignored(const std::filesystem::path& path) const
 	{
-		if (has_negations)
-		{
-			for (auto it = rules.rbegin(); it != rules.rend(); ++it)
-			{
-				if (it->match(path))
-					return !it->negation;
-			}
-			return false;
-		}
-		else
-		{
-			for (const auto& rule : rules)
-			{
-				if (rule.match(path))
-					return true;
-			}
-			return false;
-		}
+		return rules.is_ignored(path);
+	}
+
+	// Nothing if no rule matches, leaving the decision to the other gitignore files
+	std::optional<bool> decide(const std::filesystem::path& path) const
+	{
+		return rules.decide(path);
+	}
+
+	bool applies_below(const std::filesystem::path& directory) const
+	{
+		return rules.applies_below(directory);
 	}
 };
 
@@ -0,0 +1,95 @@
+#include <vector>
+
+#include "gitignore_stack.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+std::optional<bool> stack_decision(const fs::path& path, const MatcherSnapshot& stack)
+{
+	for (auto it = stack.rbegin(); it != stack.rend(); ++it)
+	{
+		if (const std::optional<bool> decision = (*it)->decide(path))
+			return decision;
+	}
+	return std::nullopt;
+}
+
+MatcherSnapshot load_directory_ignore_files(const fs::path& directory)
+{
+	MatcherSnapshot matchers;
+	for (const auto& source : directory_ignore_sources(directory))
+		matchers.push_back(std::make_shared<const GitIgnoreMatcher>(source.path, source.base_dir));
+	return matchers;
+}
+
+GitIgnoreStack::GitIgnoreStack(fs::path root_path, Loader directory_loader)
+	: root(normalize_path(root_path)), loader(std::move(directory_loader))
+{
+}
+
+const GitIgnoreStack::Frame& GitIgnoreStack::child_frame(const Frame& parent,
+														 const fs::path& directory)
+{
+	const auto it = frames.find(directory.native());
+	if (it != frames.end())
+		return it->second;
+
+	if (parent.excluded)
+		return frames.emplace(directory.native(), Frame{.excluded = true, .stack = {}})
+			.first->second;
+
+	Frame frame{.excluded = stack_decision(directory, parent.stack).value_or(false), .stack = {}};
+	// The ignore files of an excluded directory are not read, as in git
+	if (!frame.excluded)
+	{
+		frame.stack = parent.stack;
+		for (auto& matcher : loader(directory))
+			frame.stack.push_back(std::move(matcher));
+	}
+	return frames.emplace(directory.native(), std::move(frame)).first->second;
+}
+
+bool GitIgnoreStack::is_ignored(const fs::path& path)
+{
+	const fs::path normalized = normalize_path(path);
+	const fs::path relative = normalized.lexically_relative(root);
+	if (relative.empty() || relative == "." || *relative.begin() == "..")
+		return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto root_frame = frames.find(root.native());
+	if (root_frame == frames.end())
+		root_frame =
+			frames.emplace(root.native(), Frame{.excluded = false, .stack = loader(root)}).first;
+
+	// Directories from the root down to the parent of the path
+	const Frame* frame = &root_frame->second;
+	fs::path directory = root;
+	for (const auto& component : relative.parent_path())
+	{
+		if (frame->excluded)
+			break;
+		directory /= component;
+		frame = &child_frame(*frame, directory);
+	}
+
+	return frame->excluded || stack_decision(path, frame->stack).value_or(false);
+}
+
+void GitIgnoreStack::invalidate(const fs::path& directory)
+{
+	const fs::path normalized = normalize_path(directory);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::erase_if(frames, [&](const auto& entry) {
+		return contains_path(normalized, fs::path(entry.first));
+	});
+}
+
+size_t GitIgnoreStack::directory_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return frames.size();
+}
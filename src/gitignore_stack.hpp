@@ -0,0 +1,64 @@
+#ifndef GITIGNORE_STACK_H
+#define GITIGNORE_STACK_H
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "gitignore_parser.hpp"
+#include "ignore_sources.hpp"
+#include "matcher_registry.hpp"
+
+// Verdict of nested gitignore files on a path, the stack going from the shallowest file to the
+// deepest. As in git, the deepest file with a matching rule decides, so that it can override or
+// re-include what the upper files ignore. Nothing if no rule matches.
+std::optional<bool> stack_decision(const std::filesystem::path& path, const MatcherSnapshot& stack);
+
+// Matchers of the ignore files of a directory read from disk, lowest precedence first: the
+// excludes file and .git/info/exclude of a repository, then the .gitignore file
+MatcherSnapshot load_directory_ignore_files(const std::filesystem::path& directory);
+
+// Nested gitignore files of a tree, with git precedence.
+// The ignore files of a directory are loaded the first time a path below it is queried, then
+// each directory keeps its stack of matchers and whether it is excluded. A path is resolved in a
+// single pass down from the root, reusing the directories already resolved, and nothing below an
+// excluded directory can be re-included.
+class GitIgnoreStack
+{
+  public:
+	using Loader = std::function<MatcherSnapshot(const std::filesystem::path&)>;
+
+	explicit GitIgnoreStack(std::filesystem::path root,
+							Loader loader = load_directory_ignore_files);
+
+	// Paths outside of the root are never ignored
+	bool is_ignored(const std::filesystem::path& path);
+	// Loads the ignore files of the directory again on the next query, and resolves again the
+	// directories below
+	void invalidate(const std::filesystem::path& directory);
+	// Number of directories resolved so far
+	size_t directory_count() const;
+
+  private:
+	struct Frame
+	{
+		bool excluded;
+		MatcherSnapshot stack;
+	};
+
+	std::filesystem::path root;
+	Loader loader;
+	// Frames by directory path. The queried paths are not interned in the path table, which
+	// would keep every directory ever queried for the lifetime of the program.
+	std::unordered_map<std::string, Frame> frames;
+	mutable std::mutex mutex;
+
+	// Must be called with the mutex locked
+	const Frame& child_frame(const Frame& parent, const std::filesystem::path& directory);
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+#include "ignore_sources.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	std::string_view trim(std::string_view text)
+	{
+		const size_t first = text.find_first_not_of(" \t\r");
+		if (first == std::string_view::npos)
+			return {};
+		return text.substr(first, text.find_last_not_of(" \t\r") + 1 - first);
+	}
+
+	bool equals_ignore_case(std::string_view a, std::string_view b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+			return std::tolower(static_cast<unsigned char>(x)) ==
+				   std::tolower(static_cast<unsigned char>(y));
+		});
+	}
+
+	// Value of a git config variable, quotes and escapes resolved and comments removed
+	std::string config_value(std::string_view text)
+	{
+		std::string value;
+		bool quoted = false;
+		// Unquoted trailing spaces are dropped
+		size_t kept = 0;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			const char c = text[i];
+			if (c == '"')
+			{
+				quoted = !quoted;
+				kept = value.size();
+				continue;
+			}
+			if (!quoted && (c == '#' || c == ';'))
+				break;
+			if (c == '\\' && i + 1 < text.size())
+			{
+				const char escaped = text[++i];
+				value += escaped == 't' ? '\t' : escaped == 'n' ? '\n' : escaped;
+				kept = value.size();
+				continue;
+			}
+			value += c;
+			if (quoted || (c != ' ' && c != '\t'))
+				kept = value.size();
+		}
+		value.resize(kept);
+		return value;
+	}
+
+	std::optional<fs::path> excludes_file_from_config_file(const fs::path& config_path,
+														   const fs::path& home,
+														   const fs::path& base)
+	{
+		std::error_code ec;
+		if (!fs::is_regular_file(config_path, ec))
+			return std::nullopt;
+		const MappedFile content(config_path);
+		return excludes_file_from_config(content.view(), home, base);
+	}
+} // namespace
+
+IgnoreSourceKind ignore_source_kind(const fs::path& path)
+{
+	if (path.filename() == ".gitignore")
+		return IgnoreSourceKind::gitignore;
+	const fs::path info = path.parent_path();
+	if (path.filename() == "exclude" && info.filename() == "info" &&
+		info.parent_path().filename() == ".git")
+		return IgnoreSourceKind::info_exclude;
+	return IgnoreSourceKind::excludes_file;
+}
+
+std::optional<fs::path> ignore_source_base(const fs::path& path)
+{
+	switch (ignore_source_kind(path))
+	{
+		case IgnoreSourceKind::gitignore:
+			return path.parent_path();
+		case IgnoreSourceKind::info_exclude:
+			// The working tree of .git/info/exclude
+			return path.parent_path().parent_path().parent_path();
+		default:
+			return std::nullopt;
+	}
+}
+
+std::optional<fs::path> excludes_file_from_config(std::string_view content, const fs::path& home,
+												  const fs::path& base)
+{
+	std::optional<fs::path> excludes_file;
+	bool in_core = false;
+	for_each_line(content, [&](std::string_view line) {
+		line = trim(line);
+		if (line.empty() || line.front() == '#' || line.front() == ';')
+			return;
+
+		if (line.front() == '[')
+		{
+			const size_t end = line.find(']');
+			in_core = end != std::string_view::npos &&
+					  equals_ignore_case(trim(line.substr(1, end - 1)), "core");
+			line = end == std::string_view::npos ? std::string_view() : trim(line.substr(end + 1));
+			if (line.empty())
+				return;
+		}
+		if (!in_core)
+			return;
+
+		const size_t equal = line.find('=');
+		if (equal == std::string_view::npos ||
+			!equals_ignore_case(trim(line.substr(0, equal)), "excludesfile"))
+			return;
+
+		const std::string value = config_value(trim(line.substr(equal + 1)));
+		// The last value wins, an empty one unsets it
+		if (value.empty())
+			excludes_file.reset();
+		else if (value == "~" || value.starts_with("~/"))
+			excludes_file = home / fs::path(value.substr(std::min<size_t>(value.size(), 2)));
+		else
+			excludes_file = base / fs::path(value);
+	});
+	if (excludes_file)
+		excludes_file = excludes_file->lexically_normal();
+	return excludes_file;
+}
+
+std::optional<fs::path> find_excludes_file(const fs::path& repository, const fs::path& home,
+										   const std::optional<fs::path>& xdg_config_home)
+{
+	const fs::path config_home = xdg_config_home.value_or(home / ".config");
+
+	// The closest config wins: the repository, then ~/.gitconfig, then the XDG one
+	std::optional<fs::path> excludes_file =
+		excludes_file_from_config_file(repository / ".git" / "config", home, repository);
+	if (!excludes_file)
+		excludes_file = excludes_file_from_config_file(home / ".gitconfig", home, repository);
+	if (!excludes_file)
+		excludes_file =
+			excludes_file_from_config_file(config_home / "git" / "config", home, repository);
+	if (!excludes_file)
+		excludes_file = config_home / "git" / "ignore";
+
+	std::error_code ec;
+	if (!fs::is_regular_file(*excludes_file, ec))
+		return std::nullopt;
+	return normalize_path(*excludes_file);
+}
+
+std::optional<fs::path> find_excludes_file(const fs::path& repository)
+{
+	const std::optional<fs::path> home = home_directory();
+	if (!home)
+		return std::nullopt;
+	return find_excludes_file(repository, *home, environment_path("XDG_CONFIG_HOME"));
+}
+
+std::vector<IgnoreSource> directory_ignore_sources(const fs::path& directory)
+{
+	std::vector<IgnoreSource> sources;
+	std::error_code ec;
+	if (fs::is_directory(directory / ".git", ec))
+	{
+		if (auto excludes_file = find_excludes_file(directory))
+			sources.push_back({*excludes_file, directory, IgnoreSourceKind::excludes_file});
+
+		const fs::path info_exclude = directory / ".git" / "info" / "exclude";
+		if (fs::is_regular_file(info_exclude, ec))
+			sources.push_back({info_exclude, directory, IgnoreSourceKind::info_exclude});
+	}
+
+	const fs::path gitignore = directory / ".gitignore";
+	if (fs::is_regular_file(gitignore, ec))
+		sources.push_back({gitignore, directory, IgnoreSourceKind::gitignore});
+	return sources;
+}
@@ -0,0 +1,49 @@
+#ifndef IGNORE_SOURCES_H
+#define IGNORE_SOURCES_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Files git reads ignore rules from, by increasing precedence
+enum class IgnoreSourceKind : uint8_t
+{
+	// core.excludesFile, shared by the repositories using it
+	excludes_file,
+	// .git/info/exclude of a repository
+	info_exclude,
+	// .gitignore of a directory
+	gitignore,
+};
+
+IgnoreSourceKind ignore_source_kind(const std::filesystem::path& path);
+// Directory the rules of a .gitignore or .git/info/exclude file are relative to.
+// Nothing for an excludes file, whose rules are relative to each repository using it.
+std::optional<std::filesystem::path> ignore_source_base(const std::filesystem::path& path);
+
+// Value of core.excludesFile in the content of a git config file, '~' being the home directory
+// and a relative path being relative to base
+std::optional<std::filesystem::path> excludes_file_from_config(std::string_view content,
+															   const std::filesystem::path& home,
+															   const std::filesystem::path& base);
+// Excludes file of a repository, if it exists: the core.excludesFile of the repository, of the
+// user, or $XDG_CONFIG_HOME/git/ignore by default
+std::optional<std::filesystem::path> find_excludes_file(
+	const std::filesystem::path& repository, const std::filesystem::path& home,
+	const std::optional<std::filesystem::path>& xdg_config_home);
+// Same with the directories of the environment
+std::optional<std::filesystem::path> find_excludes_file(const std::filesystem::path& repository);
+
+struct IgnoreSource
+{
+	std::filesystem::path path;
+	std::filesystem::path base_dir;
+	IgnoreSourceKind kind;
+};
+
+// Files whose rules apply below a directory, from the lowest precedence to the highest
+std::vector<IgnoreSource> directory_ignore_sources(const std::filesystem::path& directory);
+
+#endif
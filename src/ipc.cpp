@@ -0,0 +1,105 @@
+#include "ipc.hpp"
+
+namespace
+{
+	constexpr size_t max_message_size = 64 * 1024;
+	constexpr tb_long_t timeout_ms = 5000;
+} // namespace
+
+std::string ipc_receive(tb_socket_ref_t sock)
+{
+	std::string message;
+	tb_byte_t data[512];
+	while (message.size() < max_message_size)
+	{
+		const tb_long_t real = tb_socket_recv(sock, data, sizeof(data));
+		if (real > 0)
+		{
+			message.append(reinterpret_cast<const char*>(data), real);
+			// Older clients send a fixed size, zero padded buffer
+			if (message.find_first_of(std::string_view("\n\0", 2)) != std::string::npos)
+				break;
+		}
+		else if (!real)
+		{
+			if (tb_socket_wait(sock, TB_SOCKET_EVENT_RECV, timeout_ms) <= 0)
+				break;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	const size_t end = message.find_first_of(std::string_view("\r\n\0", 3));
+	if (end != std::string::npos)
+		message.resize(end);
+	return message;
+}
+
+bool ipc_send(tb_socket_ref_t sock, std::string_view reply)
+{
+	size_t sent = 0;
+	while (sent < reply.size())
+	{
+		const tb_long_t real = tb_socket_send(
+			sock, reinterpret_cast<const tb_byte_t*>(reply.data()) + sent, reply.size() - sent);
+		if (real > 0)
+			sent += real;
+		else if (!real)
+		{
+			if (tb_socket_wait(sock, TB_SOCKET_EVENT_SEND, timeout_ms) <= 0)
+				return false;
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+std::optional<std::string> ipc_request(std::string_view command)
+{
+	tb_socket_ref_t sock = tb_socket_init(TB_SOCKET_TYPE_TCP, TB_IPADDR_FAMILY_IPV4);
+	tb_assert_and_check_return_val(sock, std::nullopt);
+
+	tb_ipaddr_t addr;
+	tb_ipaddr_set(&addr, "127.0.0.1", ipc_port, TB_IPADDR_FAMILY_IPV4);
+
+	tb_long_t ok;
+	while (!(ok = tb_socket_connect(sock, &addr)))
+	{
+		// wait it
+		if (tb_socket_wait(sock, TB_SOCKET_EVENT_CONN, timeout_ms) <= 0)
+			break;
+	}
+	if (ok <= 0)
+	{
+		tb_socket_exit(sock);
+		return std::nullopt;
+	}
+
+	tb_trace_i("[client] connected");
+	std::string request(command);
+	request += '\n';
+	if (!ipc_send(sock, request))
+	{
+		tb_socket_exit(sock);
+		return std::nullopt;
+	}
+
+	// The reply ends when the server closes the connection
+	std::string reply;
+	tb_byte_t data[512];
+	while (reply.size() < max_message_size)
+	{
+		const tb_long_t real = tb_socket_recv(sock, data, sizeof(data));
+		if (real > 0)
+			reply.append(reinterpret_cast<const char*>(data), real);
+		else if (!real && tb_socket_wait(sock, TB_SOCKET_EVENT_RECV, timeout_ms) > 0)
+			continue;
+		else
+			break;
+	}
+	tb_socket_exit(sock);
+	return reply;
+}
@@ -0,0 +1,23 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <tbox/tbox.h>
+
+// Local TCP endpoint of the running instance.
+// A request is a single command line, the reply is sent back before the connection is closed.
+constexpr tb_uint16_t ipc_port = 8484;
+// Replies longer than this, such as a trace, are fetched a chunk at a time
+constexpr size_t ipc_chunk_size = 32 * 1024;
+
+// Sends a command to the running instance and returns its reply
+std::optional<std::string> ipc_request(std::string_view command);
+
+// Reads one command line from a client, returns an empty string if nothing valid came
+std::string ipc_receive(tb_socket_ref_t sock);
+bool ipc_send(tb_socket_ref_t sock, std::string_view reply);
+
+#endif
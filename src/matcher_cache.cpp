@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "matcher_cache.hpp"
+
+namespace fs = std::filesystem;
+
+// Layout of the cache file, all integers in native byte order:
+//   header:  magic "SIGC", version, path separator, entry count, rule count, reserved (6 x u32)
+//   entries: content hash (u64), first rule, rule count (u32), sorted by hash
+//   rules:   line, flags, pattern offset, pattern size, regex offset, regex size, literal offset,
+//            literal size, matcher kind, operand offset, operand size (11 x u32)
+//   strings: patterns, regexes, literals and matcher operands, offsets are relative to the start
+//            of this block
+// The matcher kind is its index in RuleMatcher, the version changes along with the variant.
+namespace
+{
+	constexpr char magic[4] = {'S', 'I', 'G', 'C'};
+	constexpr size_t header_size = 6 * sizeof(uint32_t);
+	constexpr size_t entry_size = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+	constexpr size_t rule_size = 11 * sizeof(uint32_t);
+
+	constexpr uint32_t negation_flag = 1u << 0;
+	constexpr uint32_t directory_only_flag = 1u << 1;
+	constexpr uint32_t anchored_flag = 1u << 2;
+	constexpr uint32_t literal_suffix_flag = 1u << 3;
+
+	template<typename T> T read_at(std::string_view data, size_t offset)
+	{
+		T value;
+		std::memcpy(&value, data.data() + offset, sizeof(T));
+		return value;
+	}
+
+	template<typename T> void append(std::string& data, T value)
+	{
+		data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	// Appends the offset and size of the string in strings, then the string to strings
+	void append_string(std::string& data, std::string& strings, std::string_view string)
+	{
+		append<uint32_t>(data, static_cast<uint32_t>(strings.size()));
+		append<uint32_t>(data, static_cast<uint32_t>(string.size()));
+		strings += string;
+	}
+} // namespace
+
+MatcherCache::MatcherCache(fs::path path) : cache_path(std::move(path))
+{
+	map_file();
+}
+
+void MatcherCache::map_file()
+{
+	mapped = MappedFile(cache_path, FileAccess::mapped);
+	mapped_entries = 0;
+	mapped_rules = 0;
+
+	const std::string_view data = mapped.view();
+	if (data.size() < header_size || std::memcmp(data.data(), magic, sizeof(magic)) != 0 ||
+		read_at<uint32_t>(data, 4) != version ||
+		read_at<uint32_t>(data, 8) != static_cast<uint32_t>(fs::path::preferred_separator))
+	{
+		// Missing, from another version or another platform: start from scratch
+		mapped = MappedFile();
+		return;
+	}
+
+	const size_t entries_count = read_at<uint32_t>(data, 12);
+	const size_t rules_count = read_at<uint32_t>(data, 16);
+	if (header_size + entries_count * entry_size + rules_count * rule_size > data.size())
+	{
+		mapped = MappedFile();
+		return;
+	}
+	mapped_entries = entries_count;
+	mapped_rules = rules_count;
+}
+
+uint64_t MatcherCache::mapped_hash(size_t entry) const
+{
+	return read_at<uint64_t>(mapped.view(), header_size + entry * entry_size);
+}
+
+std::optional<std::vector<RuleDefinition>> MatcherCache::mapped_definitions(size_t entry) const
+{
+	const std::string_view data = mapped.view();
+	const size_t rules_start = header_size + mapped_entries * entry_size;
+	const size_t strings_start = rules_start + mapped_rules * rule_size;
+	const size_t position = header_size + entry * entry_size;
+
+	const size_t first_rule = read_at<uint32_t>(data, position + sizeof(uint64_t));
+	const size_t rule_count = read_at<uint32_t>(data, position + sizeof(uint64_t) + 4);
+	if (first_rule + rule_count > mapped_rules)
+		return std::nullopt;
+
+	std::vector<RuleDefinition> definitions;
+	definitions.reserve(rule_count);
+	for (size_t i = first_rule; i < first_rule + rule_count; i++)
+	{
+		const size_t rule = rules_start + i * rule_size;
+		const uint32_t flags = read_at<uint32_t>(data, rule + 4);
+		// The string whose offset and size are at the field of the rule
+		const auto read_string = [&](size_t field, std::string& string) {
+			const size_t offset = strings_start + read_at<uint32_t>(data, rule + field);
+			const size_t size = read_at<uint32_t>(data, rule + field + 4);
+			if (offset + size > data.size())
+				return false;
+			string = data.substr(offset, size);
+			return true;
+		};
+
+		RuleDefinition definition{
+			.pattern = {},
+			.regex = {},
+			.negation = (flags & negation_flag) != 0,
+			.directory_only = (flags & directory_only_flag) != 0,
+			.anchored = (flags & anchored_flag) != 0,
+			.line = static_cast<int>(read_at<uint32_t>(data, rule)),
+			.literal = {},
+			.literal_suffix = (flags & literal_suffix_flag) != 0,
+			.matcher = {.kind = read_at<uint32_t>(data, rule + 32), .operand = {}},
+		};
+		if (!read_string(8, definition.pattern) || !read_string(16, definition.regex) ||
+			!read_string(24, definition.literal) ||
+			!read_string(36, definition.matcher.operand))
+			return std::nullopt;
+		definitions.push_back(std::move(definition));
+	}
+	return definitions;
+}
+
+std::optional<std::vector<RuleDefinition>> MatcherCache::find_mapped(uint64_t hash) const
+{
+	// Binary search in the sorted entry table
+	size_t low = 0, high = mapped_entries;
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		const uint64_t entry_hash = mapped_hash(middle);
+		if (entry_hash < hash)
+			low = middle + 1;
+		else if (entry_hash > hash)
+			high = middle;
+		else
+			return mapped_definitions(middle);
+	}
+	return std::nullopt;
+}
+
+RuleSet MatcherCache::rules(const fs::path& gitignore_path, std::optional<fs::path> base_dir)
+{
+	const MappedFile content(gitignore_path);
+	if (!content.is_open())
+		return {};
+	return rules_from_content(gitignore_path, content.view(), base_dir);
+}
+
+RuleSet MatcherCache::rules_from_content(const fs::path& gitignore_path, std::string_view content,
+										 std::optional<fs::path> base_dir)
+{
+	const uint64_t hash = hash_bytes(content);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(hash);
+	if (it == entries.end())
+	{
+		std::optional<std::vector<RuleDefinition>> definitions = find_mapped(hash);
+		if (!definitions)
+		{
+			definitions = definitions_from_content(content);
+			dirty = true;
+			parsed++;
+		}
+		it = entries.emplace(hash, std::move(*definitions)).first;
+	}
+	return rules_from_definitions(it->second, gitignore_path, base_dir);
+}
+
+void MatcherCache::save()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!dirty)
+		return;
+
+	// The entries used in this run and the mapped ones not used, which stay for the other folders
+	// and the next runs, merged in hash order as required by the lookup
+	std::vector<std::pair<uint64_t, const std::vector<RuleDefinition>*>> merged;
+	std::vector<std::vector<RuleDefinition>> unused;
+	unused.reserve(mapped_entries);
+	auto used = entries.begin();
+	for (size_t entry = 0; entry < mapped_entries; entry++)
+	{
+		const uint64_t hash = mapped_hash(entry);
+		for (; used != entries.end() && used->first < hash; ++used)
+			merged.emplace_back(used->first, &used->second);
+		if (used != entries.end() && used->first == hash)
+			continue;
+		if (auto definitions = mapped_definitions(entry))
+		{
+			unused.push_back(std::move(*definitions));
+			merged.emplace_back(hash, &unused.back());
+		}
+	}
+	for (; used != entries.end(); ++used)
+		merged.emplace_back(used->first, &used->second);
+
+	size_t rules_count = 0;
+	for (const auto& [hash, definitions] : merged)
+		rules_count += definitions->size();
+
+	std::string data;
+	data.append(magic, sizeof(magic));
+	append<uint32_t>(data, version);
+	append<uint32_t>(data, static_cast<uint32_t>(fs::path::preferred_separator));
+	append<uint32_t>(data, static_cast<uint32_t>(merged.size()));
+	append<uint32_t>(data, static_cast<uint32_t>(rules_count));
+	append<uint32_t>(data, 0);
+
+	uint32_t first_rule = 0;
+	for (const auto& [hash, definitions] : merged)
+	{
+		append<uint64_t>(data, hash);
+		append<uint32_t>(data, first_rule);
+		append<uint32_t>(data, static_cast<uint32_t>(definitions->size()));
+		first_rule += static_cast<uint32_t>(definitions->size());
+	}
+
+	std::string strings;
+	for (const auto& [hash, definitions] : merged)
+	{
+		for (const auto& definition : *definitions)
+		{
+			const uint32_t flags = (definition.negation ? negation_flag : 0u) |
+								   (definition.directory_only ? directory_only_flag : 0u) |
+								   (definition.anchored ? anchored_flag : 0u) |
+								   (definition.literal_suffix ? literal_suffix_flag : 0u);
+			append<uint32_t>(data, static_cast<uint32_t>(definition.line));
+			append<uint32_t>(data, flags);
+			append_string(data, strings, definition.pattern);
+			append_string(data, strings, definition.regex);
+			append_string(data, strings, definition.literal);
+			append<uint32_t>(data, definition.matcher.kind);
+			append_string(data, strings, definition.matcher.operand);
+		}
+	}
+	data += strings;
+
+	// Write aside and swap, a mapping of the previous file stays valid
+	fs::path temp_path = cache_path;
+	temp_path += ".tmp";
+	{
+		std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+		ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+		if (!ofs)
+			return;
+	}
+	std::error_code ec;
+	fs::rename(temp_path, cache_path, ec);
+	if (!ec)
+		dirty = false;
+}
+
+size_t MatcherCache::parsed_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return parsed;
+}
@@ -0,0 +1,55 @@
+#ifndef MATCHER_CACHE_H
+#define MATCHER_CACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "gitignore_parser.hpp"
+#include "utils.hpp"
+
+// On-disk cache of parsed gitignore files, keyed by the hash of their content.
+// The file is a flat table of offsets meant to be memory-mapped, so a gitignore already seen is
+// turned back into rules without reading its lines nor lexing its patterns.
+class MatcherCache
+{
+	std::filesystem::path cache_path;
+	MappedFile mapped;
+	size_t mapped_entries = 0;
+	size_t mapped_rules = 0;
+
+	// Entries used since the cache was opened, written back along with the mapped ones
+	std::map<uint64_t, std::vector<RuleDefinition>> entries;
+	bool dirty = false;
+	size_t parsed = 0;
+	mutable std::mutex mutex;
+
+	void map_file();
+	uint64_t mapped_hash(size_t entry) const;
+	// Definitions of the mapped entry at the index, nothing if it is corrupt
+	std::optional<std::vector<RuleDefinition>> mapped_definitions(size_t entry) const;
+	std::optional<std::vector<RuleDefinition>> find_mapped(uint64_t hash) const;
+
+  public:
+	static constexpr uint32_t version = 6;
+
+	explicit MatcherCache(std::filesystem::path path);
+
+	// Rules of the gitignore file, parsed only if its content isn't in the cache
+	RuleSet rules(const std::filesystem::path& gitignore_path,
+				  std::optional<std::filesystem::path> base_dir = std::nullopt);
+	// Same with the content of the file already read
+	RuleSet rules_from_content(const std::filesystem::path& gitignore_path,
+							   std::string_view content,
+							   std::optional<std::filesystem::path> base_dir = std::nullopt);
+
+	// Writes the cache back to disk if new content was parsed
+	void save();
+	// Number of contents parsed since the cache was opened, the other ones being found in it
+	size_t parsed_count() const;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include "matcher_registry.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+MatcherRegistry::MatcherRegistry(MatcherCache& matcher_cache) : cache(matcher_cache)
+{
+}
+
+std::shared_ptr<const GitIgnoreMatcher> MatcherRegistry::load(PathId gitignore_id,
+															  bool check_content)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = entries.find(gitignore_id);
+	if (it != entries.end() && !check_content)
+		return it->second.matcher;
+
+	const fs::path gitignore_path = path_table().path(gitignore_id);
+	const MappedFile content(gitignore_path);
+	// A shared excludes file keeps the repositories it applies to
+	return update(gitignore_id, gitignore_path, content.view(),
+				  it != entries.end() ? it->second.base_dirs : std::vector<fs::path>{});
+}
+
+std::shared_ptr<const GitIgnoreMatcher> MatcherRegistry::update(
+	PathId gitignore_id, const fs::path& gitignore_path, std::string_view content,
+	const std::vector<fs::path>& base_dirs)
+{
+	uint64_t hash = hash_bytes(content);
+	for (const auto& base_dir : base_dirs)
+		hash = hash * 31 + hash_bytes(base_dir.generic_string());
+	const auto it = entries.find(gitignore_id);
+	if (it != entries.end() && it->second.hash == hash)
+		return it->second.matcher;
+
+	const TraceScope trace_scope("build_matcher");
+	std::optional<fs::path> base_dir = ignore_source_base(gitignore_path);
+	if (!base_dirs.empty())
+		base_dir = base_dirs.front();
+	RuleSet rules = cache.rules_from_content(gitignore_path, content, base_dir);
+	for (size_t i = 1; i < base_dirs.size(); i++)
+		rules.add_base_path(normalize_path(base_dirs[i]));
+
+	auto matcher = std::make_shared<const GitIgnoreMatcher>(std::move(rules));
+	entries.insert_or_assign(gitignore_id, Entry{.hash = hash,
+												 .matcher = matcher,
+												 .kind = ignore_source_kind(gitignore_path),
+												 .base_dirs = base_dirs});
+	current.reset();
+	return matcher;
+}
+
+std::shared_ptr<const GitIgnoreMatcher> MatcherRegistry::get(PathId gitignore_path)
+{
+	return load(gitignore_path, false);
+}
+
+std::shared_ptr<const GitIgnoreMatcher> MatcherRegistry::refresh(PathId gitignore_path)
+{
+	return load(gitignore_path, true);
+}
+
+std::shared_ptr<const GitIgnoreMatcher> MatcherRegistry::refresh(
+	PathId gitignore_path, std::string_view content, const std::vector<fs::path>& base_dirs)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return update(gitignore_path, path_table().path(gitignore_path), content, base_dirs);
+}
+
+void MatcherRegistry::remove(PathId gitignore_path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (entries.erase(gitignore_path) > 0)
+		current.reset();
+}
+
+std::shared_ptr<const MatcherSnapshot> MatcherRegistry::snapshot()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!current)
+	{
+		std::vector<const Entry*> sorted;
+		sorted.reserve(entries.size());
+		for (const auto& [path, entry] : entries)
+			sorted.push_back(&entry);
+		std::stable_sort(sorted.begin(), sorted.end(),
+						 [](const Entry* a, const Entry* b) { return a->kind < b->kind; });
+
+		auto matchers = std::make_shared<MatcherSnapshot>();
+		matchers->reserve(entries.size());
+		for (const Entry* entry : sorted)
+			matchers->push_back(entry->matcher);
+		current = std::move(matchers);
+	}
+	return current;
+}
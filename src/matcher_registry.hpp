@@ -0,0 +1,66 @@
+#ifndef MATCHER_REGISTRY_H
+#define MATCHER_REGISTRY_H
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "gitignore_parser.hpp"
+#include "ignore_sources.hpp"
+#include "matcher_cache.hpp"
+#include "path_table.hpp"
+
+using MatcherSnapshot = std::vector<std::shared_ptr<const GitIgnoreMatcher>>;
+
+// Shared matchers of the gitignore files, one per file.
+// A matcher is only rebuilt when the content hash of its file changes, and the list of all the
+// matchers is built once per change and shared by every caller. The list goes from the lowest
+// precedence kind of file to the highest, see IgnoreSourceKind.
+//
+// The rules of a file are relative to its directory, or to the working tree of .git/info/exclude.
+// An excludes file shared by several repositories has a single matcher applying below all of
+// them, so its rules are parsed and compiled once.
+class MatcherRegistry
+{
+	struct Entry
+	{
+		uint64_t hash;
+		std::shared_ptr<const GitIgnoreMatcher> matcher;
+		IgnoreSourceKind kind;
+		std::vector<std::filesystem::path> base_dirs;
+	};
+
+	MatcherCache& cache;
+	std::map<PathId, Entry> entries;
+	std::shared_ptr<const MatcherSnapshot> current;
+	mutable std::mutex mutex;
+
+	std::shared_ptr<const GitIgnoreMatcher> load(PathId gitignore_path, bool check_content);
+	// Must be called with the mutex locked
+	std::shared_ptr<const GitIgnoreMatcher> update(
+		PathId gitignore_path, const std::filesystem::path& path, std::string_view content,
+		const std::vector<std::filesystem::path>& base_dirs);
+
+  public:
+	explicit MatcherRegistry(MatcherCache& matcher_cache);
+
+	// Matcher of the gitignore file, loaded the first time only
+	std::shared_ptr<const GitIgnoreMatcher> get(PathId gitignore_path);
+	// Reloads the matcher of the gitignore file if its content changed
+	std::shared_ptr<const GitIgnoreMatcher> refresh(PathId gitignore_path);
+	// Same with the content of the file already read, and the directories its rules apply below
+	// for an excludes file
+	std::shared_ptr<const GitIgnoreMatcher> refresh(
+		PathId gitignore_path, std::string_view content,
+		const std::vector<std::filesystem::path>& base_dirs = {});
+	void remove(PathId gitignore_path);
+
+	// Matchers of all the registered files
+	std::shared_ptr<const MatcherSnapshot> snapshot();
+};
+
+#endif
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "metrics.hpp"
+
+namespace
+{
+	std::atomic<size_t> next_shard = 0;
+
+	// Threads are spread over the shards in the order they first record
+	size_t thread_shard()
+	{
+		thread_local const size_t shard = next_shard.fetch_add(1, std::memory_order_relaxed);
+		return shard;
+	}
+
+	std::string format_number(double value)
+	{
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+		return buffer;
+	}
+
+	void append_header(std::string& text, const char* name, const char* type, const char* help)
+	{
+		text += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+	}
+
+	void append_counter(std::string& text, const char* name, const char* help,
+						const Counter& counter)
+	{
+		append_header(text, name, "counter", help);
+		text += std::string(name) + " " + std::to_string(counter.value()) + "\n";
+	}
+
+	void append_gauge(std::string& text, const char* name, const char* help, const Gauge& gauge)
+	{
+		append_header(text, name, "gauge", help);
+		text += std::string(name) + " " + std::to_string(gauge.value()) + "\n";
+	}
+
+	void append_histogram(std::string& text, const char* name, const char* help,
+						  const LatencyHistogram& histogram)
+	{
+		append_header(text, name, "histogram", help);
+		const LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+		const auto& bounds = histogram.bounds();
+		uint64_t cumulative = 0;
+		for (size_t i = 0; i < snapshot.counts.size(); i++)
+		{
+			cumulative += snapshot.counts[i];
+			const std::string bound = i < bounds.size() ? format_number(bounds[i]) : "+Inf";
+			text += std::string(name) + "_bucket{le=\"" + bound + "\"} " +
+					std::to_string(cumulative) + "\n";
+		}
+		text += std::string(name) + "_sum " +
+				format_number(std::chrono::duration<double>(snapshot.sum).count()) + "\n";
+		text += std::string(name) + "_count " + std::to_string(snapshot.count) + "\n";
+	}
+} // namespace
+
+LatencyHistogram::LatencyHistogram(std::vector<double> bounds) : upper_bounds(std::move(bounds))
+{
+	if (upper_bounds.size() >= max_buckets ||
+		!std::is_sorted(upper_bounds.begin(), upper_bounds.end()))
+		throw std::invalid_argument("invalid histogram bounds");
+	for (const double bound : upper_bounds)
+	{
+		const std::chrono::duration<double> seconds(bound);
+		upper_bounds_nanoseconds.push_back(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(seconds).count());
+	}
+}
+
+void LatencyHistogram::observe(std::chrono::nanoseconds duration)
+{
+	const int64_t nanoseconds = std::max<int64_t>(0, duration.count());
+	// A value equal to a bound belongs to its bucket
+	const size_t bucket = std::lower_bound(upper_bounds_nanoseconds.begin(),
+										   upper_bounds_nanoseconds.end(), nanoseconds) -
+						  upper_bounds_nanoseconds.begin();
+	Shard& shard = shards[thread_shard() % shard_count];
+	shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	shard.sum_nanoseconds.fetch_add(static_cast<uint64_t>(nanoseconds), std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+	// Observations made while reading may be counted in the buckets but not in the sum, or the
+	// other way around, which the monitoring tolerates
+	Snapshot snapshot;
+	snapshot.counts.assign(upper_bounds.size() + 1, 0);
+	uint64_t sum = 0;
+	for (const Shard& shard : shards)
+	{
+		for (size_t i = 0; i < snapshot.counts.size(); i++)
+			snapshot.counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+		sum += shard.sum_nanoseconds.load(std::memory_order_relaxed);
+	}
+	snapshot.sum = std::chrono::nanoseconds(sum);
+	for (const uint64_t count : snapshot.counts)
+		snapshot.count += count;
+	return snapshot;
+}
+
+std::string Metrics::prometheus_text() const
+{
+	std::string text;
+	append_counter(text, "synctignore_events_received_total",
+				   "Changes reported by the file watcher.", events_received);
+	append_counter(text, "synctignore_events_coalesced_total",
+				   "Scan and refresh requests merged into one already queued.", events_coalesced);
+	append_counter(text, "synctignore_events_dropped_total",
+				   "Changes about no file the managed folders read.", events_dropped);
+	append_counter(text, "synctignore_files_converted_total",
+				   "Ignore files converted to Syncthing rules.", files_converted);
+	append_counter(text, "synctignore_rules_emitted_total",
+				   "Generated rules written to .stignore files.", rules_emitted);
+
+	append_header(text, "synctignore_stignore_writes_total", "counter",
+				  "Updates of .stignore files, skipped when the content didn't change.");
+	text += "synctignore_stignore_writes_total{result=\"performed\"} " +
+			std::to_string(stignore_writes.value()) + "\n";
+	text += "synctignore_stignore_writes_total{result=\"skipped\"} " +
+			std::to_string(stignore_writes_skipped.value()) + "\n";
+
+	append_histogram(text, "synctignore_scan_duration_seconds", "Duration of the folder scans.",
+					 scan_duration);
+	append_gauge(text, "synctignore_worker_queue_depth", "Tasks waiting for a worker thread.",
+				 worker_queue_depth);
+	append_gauge(text, "synctignore_scan_queue_depth", "Scan requests waiting to run.",
+				 scan_queue_depth);
+	return text;
+}
+
+Metrics& metrics()
+{
+	static Metrics instance;
+	return instance;
+}
@@ -0,0 +1,113 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Counter
+{
+	std::atomic<uint64_t> count = 0;
+
+  public:
+	void add(uint64_t value = 1)
+	{
+		count.fetch_add(value, std::memory_order_relaxed);
+	}
+	uint64_t value() const
+	{
+		return count.load(std::memory_order_relaxed);
+	}
+};
+
+class Gauge
+{
+	std::atomic<int64_t> current = 0;
+
+  public:
+	void set(int64_t value)
+	{
+		current.store(value, std::memory_order_relaxed);
+	}
+	int64_t value() const
+	{
+		return current.load(std::memory_order_relaxed);
+	}
+};
+
+// Distribution of durations over fixed buckets.
+// Recording never locks: each thread counts in one of a few shards of atomic buckets, on cache
+// lines of their own, and the shards are only added up when the histogram is read.
+class LatencyHistogram
+{
+  public:
+	static constexpr size_t max_buckets = 24;
+
+	struct Snapshot
+	{
+		// Count of each bucket, not cumulative, the last one being above all the bounds
+		std::vector<uint64_t> counts;
+		std::chrono::nanoseconds sum{0};
+		uint64_t count = 0;
+	};
+
+	// Upper bounds of the buckets in seconds, increasing, at most max_buckets - 1 of them
+	explicit LatencyHistogram(std::vector<double> upper_bounds);
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+	void observe(std::chrono::nanoseconds duration);
+	Snapshot snapshot() const;
+	const std::vector<double>& bounds() const
+	{
+		return upper_bounds;
+	}
+
+  private:
+	static constexpr size_t shard_count = 16;
+
+	struct alignas(64) Shard
+	{
+		std::array<std::atomic<uint64_t>, max_buckets> counts{};
+		std::atomic<uint64_t> sum_nanoseconds = 0;
+	};
+
+	const std::vector<double> upper_bounds;
+	// Same bounds, compared without converting each duration
+	std::vector<int64_t> upper_bounds_nanoseconds;
+	std::array<Shard, shard_count> shards;
+};
+
+// What the daemon counts, for monitoring
+struct Metrics
+{
+	// Changes reported by the file watcher
+	Counter events_received;
+	// Scan and refresh requests merged into one already queued
+	Counter events_coalesced;
+	// Changes about no file the folders read
+	Counter events_dropped;
+	Counter files_converted;
+	Counter rules_emitted;
+	Counter stignore_writes;
+	// Writes skipped as the file already had the same content
+	Counter stignore_writes_skipped;
+	LatencyHistogram scan_duration{
+		{0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300}};
+	// Set when the metrics are read
+	Gauge worker_queue_depth;
+	Gauge scan_queue_depth;
+
+	// Prometheus text exposition format
+	std::string prometheus_text() const;
+};
+
+// Metrics of the whole program
+Metrics& metrics();
+
+#endif
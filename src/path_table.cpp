@@ -0,0 +1,116 @@
+#include <mutex>
+
+#include "path_table.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	uint64_t child_key(PathId parent, std::string_view name)
+	{
+		return hash_bytes(name) ^ (parent.value * 0x9e3779b97f4a7c15ull);
+	}
+} // namespace
+
+PathTable::PathTable()
+{
+	nodes.push_back(Node{.parent = PathId{}, .name_offset = 0, .name_size = 0, .depth = 0});
+}
+
+std::optional<PathId> PathTable::find_child(PathId parent, std::string_view name) const
+{
+	const auto [first, last] = children.equal_range(child_key(parent, name));
+	for (auto it = first; it != last; ++it)
+	{
+		const Node& node = nodes[it->second.value];
+		if (node.parent == parent && name_of(node) == name)
+			return it->second;
+	}
+	return std::nullopt;
+}
+
+PathId PathTable::intern(const fs::path& path)
+{
+	// Most lookups are for known paths, only take the exclusive lock to add some
+	if (const auto id = find(path))
+		return *id;
+
+	std::unique_lock<std::shared_mutex> lock(mutex);
+	PathId id;
+	for (const auto& component : path)
+	{
+		// A trailing separator ends the path with an empty component, the path is the same
+		if (component.empty())
+			continue;
+		const std::string name = component.string();
+		if (const auto child = find_child(id, name))
+		{
+			id = *child;
+			continue;
+		}
+
+		const PathId child{static_cast<uint32_t>(nodes.size())};
+		nodes.push_back(Node{.parent = id,
+							 .name_offset = static_cast<uint32_t>(names.size()),
+							 .name_size = static_cast<uint32_t>(name.size()),
+							 .depth = nodes[id.value].depth + 1});
+		names += name;
+		children.emplace(child_key(id, name), child);
+		id = child;
+	}
+	return id;
+}
+
+std::optional<PathId> PathTable::find(const fs::path& path) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	PathId id;
+	for (const auto& component : path)
+	{
+		if (component.empty())
+			continue;
+		const auto child = find_child(id, component.string());
+		if (!child)
+			return std::nullopt;
+		id = *child;
+	}
+	return id;
+}
+
+fs::path PathTable::path(PathId id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	std::vector<const Node*> components;
+	for (PathId current = id; current.value != 0; current = nodes[current.value].parent)
+		components.push_back(&nodes[current.value]);
+
+	fs::path result;
+	for (auto it = components.rbegin(); it != components.rend(); ++it)
+		result /= fs::path(std::string(name_of(**it)));
+	return result;
+}
+
+PathId PathTable::parent(PathId id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return nodes[id.value].parent;
+}
+
+size_t PathTable::depth(PathId id) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return nodes[id.value].depth;
+}
+
+size_t PathTable::size() const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	return nodes.size();
+}
+
+PathTable& path_table()
+{
+	static PathTable table;
+	return table;
+}
@@ -0,0 +1,77 @@
+#ifndef PATH_TABLE_H
+#define PATH_TABLE_H
+
+#include <compare>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Identifier of a path interned in a PathTable, the empty path is 0
+struct PathId
+{
+	uint32_t value = 0;
+
+	auto operator<=>(const PathId&) const = default;
+};
+
+template<> struct std::hash<PathId>
+{
+	size_t operator()(PathId id) const noexcept
+	{
+		return std::hash<uint32_t>{}(id.value);
+	}
+};
+
+// Interned paths, stored as a tree of components.
+// A path is its last component and the id of its parent, so the common prefixes are stored once
+// and comparing two paths is comparing two integers. Ids are never reused, a path keeps its id
+// for the lifetime of the table.
+class PathTable
+{
+	struct Node
+	{
+		PathId parent;
+		uint32_t name_offset;
+		uint32_t name_size;
+		uint32_t depth;
+	};
+
+	// Names of all the components, one after the other
+	std::string names;
+	std::vector<Node> nodes;
+	// Hash of a parent and a name to the id of the child
+	std::unordered_multimap<uint64_t, PathId> children;
+	mutable std::shared_mutex mutex;
+
+	std::string_view name_of(const Node& node) const
+	{
+		return std::string_view(names).substr(node.name_offset, node.name_size);
+	}
+
+	std::optional<PathId> find_child(PathId parent, std::string_view name) const;
+
+  public:
+	PathTable();
+
+	// Returns the id of the path, adding it if needed
+	PathId intern(const std::filesystem::path& path);
+	// Returns the id of the path if it was interned
+	std::optional<PathId> find(const std::filesystem::path& path) const;
+
+	std::filesystem::path path(PathId id) const;
+	PathId parent(PathId id) const;
+	// Number of components of the path
+	size_t depth(PathId id) const;
+	size_t size() const;
+};
+
+// Table shared by the whole program
+PathTable& path_table();
+
+#endif
@@ -0,0 +1,273 @@
+#include <utility>
+
+#include "rule_matcher.hpp"
+
+namespace
+{
+	DirectoryMode directory_mode(const LexedPattern& pattern)
+	{
+		if (!pattern.directory_only)
+			return DirectoryMode::none;
+		return pattern.negation ? DirectoryMode::entry : DirectoryMode::contents;
+	}
+
+	template<typename Test>
+	RuleMatcher segment_rule(Test test, bool anchored, DirectoryMode mode)
+	{
+		if (anchored)
+		{
+			switch (mode)
+			{
+				case DirectoryMode::contents:
+					return SegmentRule<Test, true, DirectoryMode::contents>{std::move(test)};
+				case DirectoryMode::entry:
+					return SegmentRule<Test, true, DirectoryMode::entry>{std::move(test)};
+				default:
+					return SegmentRule<Test, true, DirectoryMode::none>{std::move(test)};
+			}
+		}
+		switch (mode)
+		{
+			case DirectoryMode::contents:
+				return SegmentRule<Test, false, DirectoryMode::contents>{std::move(test)};
+			case DirectoryMode::entry:
+				return SegmentRule<Test, false, DirectoryMode::entry>{std::move(test)};
+			default:
+				return SegmentRule<Test, false, DirectoryMode::none>{std::move(test)};
+		}
+	}
+
+	template<template<DirectoryMode> class Rule, typename Data>
+	RuleMatcher directory_rule(Data data, DirectoryMode mode)
+	{
+		switch (mode)
+		{
+			case DirectoryMode::contents:
+				return Rule<DirectoryMode::contents>{std::move(data)};
+			case DirectoryMode::entry:
+				return Rule<DirectoryMode::entry>{std::move(data)};
+			default:
+				return Rule<DirectoryMode::none>{std::move(data)};
+		}
+	}
+
+	const std::string& test_operand(const NameTest& test)
+	{
+		return test.name;
+	}
+
+	const std::string& test_operand(const PrefixTest& test)
+	{
+		return test.prefix;
+	}
+
+	const std::string& test_operand(const SuffixTest& test)
+	{
+		return test.suffix;
+	}
+
+	const std::string& test_operand(const GlobTest& test)
+	{
+		return test.glob;
+	}
+
+	// How each kind of matcher is stored and built again
+	template<typename Matcher> struct StoredMatcher;
+
+	template<typename Test, bool Anchored, DirectoryMode Mode>
+	struct StoredMatcher<SegmentRule<Test, Anchored, Mode>>
+	{
+		static std::string operand(const SegmentRule<Test, Anchored, Mode>& matcher)
+		{
+			return test_operand(matcher.test);
+		}
+		static RuleMatcher make(std::string operand, uint32_t)
+		{
+			return SegmentRule<Test, Anchored, Mode>{Test{std::move(operand)}};
+		}
+	};
+
+	template<DirectoryMode Mode> struct StoredMatcher<PathRule<Mode>>
+	{
+		static std::string operand(const PathRule<Mode>& matcher)
+		{
+			return matcher.literal;
+		}
+		static RuleMatcher make(std::string operand, uint32_t)
+		{
+			return PathRule<Mode>{std::move(operand)};
+		}
+	};
+
+	template<DirectoryMode Mode> struct StoredMatcher<RegexRule<Mode>>
+	{
+		static std::string operand(const RegexRule<Mode>&)
+		{
+			return {};
+		}
+		static RuleMatcher make(std::string, uint32_t rule)
+		{
+			return RegexRule<Mode>{rule};
+		}
+	};
+
+	template<size_t... Kinds>
+	RuleMatcher make_stored_matcher(uint32_t kind, std::string operand, uint32_t rule,
+									std::index_sequence<Kinds...>)
+	{
+		using Make = RuleMatcher (*)(std::string, uint32_t);
+		static constexpr Make makers[] = {
+			&StoredMatcher<std::variant_alternative_t<Kinds, RuleMatcher>>::make...};
+		return makers[kind](std::move(operand), rule);
+	}
+} // namespace
+
+bool GlobTest::operator()(std::string_view segment) const
+{
+	// Without separators, backtracking to the last star is enough
+	size_t g = 0;
+	size_t s = 0;
+	size_t star_g = std::string::npos;
+	size_t star_s = 0;
+	while (s < segment.size())
+	{
+		if (g < glob.size() && glob[g] == '*')
+		{
+			star_g = ++g;
+			star_s = s;
+			continue;
+		}
+		if (g < glob.size())
+		{
+			const bool any = glob[g] == '?';
+			const size_t width = glob[g] == '\\' ? 2 : 1;
+			if (any || glob[g + width - 1] == segment[s])
+			{
+				g += width;
+				s++;
+				continue;
+			}
+		}
+		if (star_g == std::string::npos)
+			return false;
+		g = star_g;
+		s = ++star_s;
+	}
+	while (g < glob.size() && glob[g] == '*')
+		g++;
+	return g == glob.size();
+}
+
+RuleMatcher make_rule_matcher(const LexedPattern& pattern, uint32_t rule)
+{
+	const DirectoryMode mode = directory_mode(pattern);
+
+	bool literal_only = true;
+	bool has_separator = false;
+	for (const auto& token : pattern.tokens)
+	{
+		switch (token.kind)
+		{
+			case GlobTokenKind::literal:
+				break;
+			case GlobTokenKind::separator:
+				has_separator = true;
+				break;
+			case GlobTokenKind::star:
+			case GlobTokenKind::question:
+				literal_only = false;
+				break;
+			default:
+				// '**' and character classes are left to the regex
+				return directory_rule<RegexRule>(rule, mode);
+		}
+	}
+	if (pattern.tokens.empty() || (has_separator && (!literal_only || !pattern.anchored)))
+		return directory_rule<RegexRule>(rule, mode);
+
+	if (has_separator)
+	{
+		std::string literal;
+		for (const auto& token : pattern.tokens)
+		{
+			if (token.kind == GlobTokenKind::separator)
+				literal += '/';
+			else
+				literal += token.text;
+		}
+		return directory_rule<PathRule>(std::move(literal), mode);
+	}
+
+	// Literals, '*' and '?' within a single segment
+	std::string glob;
+	size_t stars = 0;
+	size_t questions = 0;
+	for (const auto& token : pattern.tokens)
+	{
+		if (token.kind == GlobTokenKind::star)
+		{
+			glob += '*';
+			stars++;
+		}
+		else if (token.kind == GlobTokenKind::question)
+		{
+			glob += '?';
+			questions++;
+		}
+		else
+		{
+			for (const char c : token.text)
+			{
+				if (c == '*' || c == '?' || c == '\\')
+					glob += '\\';
+				glob += c;
+			}
+		}
+	}
+
+	const auto& tokens = pattern.tokens;
+	const bool anchored = pattern.anchored;
+	if (literal_only)
+	{
+		std::string name;
+		for (const auto& token : tokens)
+			name += token.text;
+		return segment_rule(NameTest{std::move(name)}, anchored, mode);
+	}
+	if (questions == 0 && stars == 1)
+	{
+		// The literal tokens on the other side of the star
+		std::string literal;
+		for (const auto& token : tokens)
+		{
+			if (token.kind == GlobTokenKind::literal)
+				literal += token.text;
+		}
+		if (tokens.back().kind == GlobTokenKind::star)
+			return segment_rule(PrefixTest{std::move(literal)}, anchored, mode);
+		if (tokens.front().kind == GlobTokenKind::star)
+			return segment_rule(SuffixTest{std::move(literal)}, anchored, mode);
+	}
+	return segment_rule(GlobTest{std::move(glob)}, anchored, mode);
+}
+
+RuleMatcherDefinition rule_matcher_definition(const RuleMatcher& matcher)
+{
+	return std::visit(
+		[&](const auto& kind) {
+			using Matcher = std::decay_t<decltype(kind)>;
+			return RuleMatcherDefinition{.kind = static_cast<uint32_t>(matcher.index()),
+										 .operand = StoredMatcher<Matcher>::operand(kind)};
+		},
+		matcher);
+}
+
+RuleMatcher make_rule_matcher(const RuleMatcherDefinition& definition, uint32_t rule)
+{
+	constexpr size_t kinds = std::variant_size_v<RuleMatcher>;
+	// Only a damaged cache has other kinds, the regex of the rule still matches
+	if (definition.kind >= kinds)
+		return RegexRule<DirectoryMode::none>{rule};
+	return make_stored_matcher(definition.kind, definition.operand, rule,
+							   std::make_index_sequence<kinds>());
+}
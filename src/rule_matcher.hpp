@@ -0,0 +1,236 @@
+#ifndef RULE_MATCHER_H
+#define RULE_MATCHER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include "gitignore_lexer.hpp"
+#include "simd_scan.hpp"
+
+class LazyRegexes;
+
+// How the directory-only flag of a rule affects its matching
+enum class DirectoryMode : uint8_t
+{
+	// Not a directory rule, the rule matches the path itself
+	none,
+	// A directory rule also matches the paths below the directory
+	contents,
+	// A negated directory rule only matches a path naming an entry, not one ending with a separator
+	entry,
+};
+
+// Path relative to the base of the rules, as matched by a rule
+struct MatchSubject
+{
+	std::string_view path;
+	// The path has a filename, it doesn't end with a separator
+	bool names_entry;
+};
+
+// Tests of a single path segment, for the patterns without separator
+struct NameTest
+{
+	std::string name;
+
+	bool operator()(std::string_view segment) const
+	{
+		return segment == name;
+	}
+};
+
+// 'literal*'
+struct PrefixTest
+{
+	std::string prefix;
+
+	bool operator()(std::string_view segment) const
+	{
+		return segment.starts_with(prefix);
+	}
+};
+
+// '*literal'
+struct SuffixTest
+{
+	std::string suffix;
+
+	bool operator()(std::string_view segment) const
+	{
+		return segment.ends_with(suffix);
+	}
+};
+
+// Any other mix of literals, '*' and '?'.
+// The glob keeps '*' and '?' as wildcards, a literal '*', '?' or '\' is escaped with a '\'.
+struct GlobTest
+{
+	std::string glob;
+
+	bool operator()(std::string_view segment) const;
+};
+
+// Single segment pattern, the segment tested depends on the flags of the rule
+template<typename Test, bool Anchored, DirectoryMode Mode>
+struct SegmentRule
+{
+	Test test;
+
+	bool match(const MatchSubject& subject, const LazyRegexes&) const
+	{
+		if constexpr (Mode == DirectoryMode::entry)
+		{
+			if (!subject.names_entry)
+				return false;
+		}
+
+		const std::string_view path = subject.path;
+		if constexpr (Anchored && Mode == DirectoryMode::contents)
+		{
+			// The directory is the first segment
+			return test(path.substr(0, find_separator(path)));
+		}
+		else if constexpr (Anchored)
+		{
+			return find_separator(path) == std::string_view::npos && test(path);
+		}
+		else if constexpr (Mode == DirectoryMode::contents)
+		{
+			// The directory is any segment
+			size_t begin = 0;
+			while (true)
+			{
+				const size_t end = find_separator(path, begin);
+				if (test(path.substr(begin, end - begin)))
+					return true;
+				if (end == std::string_view::npos)
+					return false;
+				begin = end + 1;
+			}
+		}
+		else
+		{
+			return test(path.substr(find_last_separator(path) + 1));
+		}
+	}
+};
+
+// Pattern made of literal segments only, anchored by its separators
+template<DirectoryMode Mode>
+struct PathRule
+{
+	std::string literal;
+
+	bool match(const MatchSubject& subject, const LazyRegexes&) const
+	{
+		if constexpr (Mode == DirectoryMode::entry)
+		{
+			if (!subject.names_entry)
+				return false;
+		}
+
+		const std::string_view path = subject.path;
+		if constexpr (Mode == DirectoryMode::contents)
+		{
+			return path.size() >= literal.size() && same_path(path.substr(0, literal.size())) &&
+				   (path.size() == literal.size() || is_separator(path[literal.size()]));
+		}
+		else
+		{
+			return path.size() == literal.size() && same_path(path);
+		}
+	}
+
+  private:
+	// Any separator of the path matches a separator of the literal
+	bool same_path(std::string_view path) const
+	{
+		for (size_t i = 0; i < literal.size(); i++)
+		{
+			if (path[i] != literal[i] && !(literal[i] == '/' && is_separator(path[i])))
+				return false;
+		}
+		return true;
+	}
+};
+
+// True if the regex of a rule matches the path, compiling it on first use
+bool regex_matches(const LazyRegexes& regexes, uint32_t rule, std::string_view path);
+
+// Patterns spanning several segments with wildcards, matched with their regex.
+// The regex handles the anchoring and the directory flag, but can't know if the path named an
+// entry.
+template<DirectoryMode Mode>
+struct RegexRule
+{
+	uint32_t rule;
+
+	bool match(const MatchSubject& subject, const LazyRegexes& regexes) const
+	{
+		if constexpr (Mode == DirectoryMode::entry)
+		{
+			if (!subject.names_entry)
+				return false;
+		}
+		return regex_matches(regexes, rule, subject.path);
+	}
+};
+
+// Matcher of a rule, specialized on the shape of its pattern so that matching doesn't branch on
+// the flags of the rule
+using RuleMatcher = std::variant<
+	SegmentRule<NameTest, false, DirectoryMode::none>,
+	SegmentRule<NameTest, false, DirectoryMode::contents>,
+	SegmentRule<NameTest, false, DirectoryMode::entry>,
+	SegmentRule<NameTest, true, DirectoryMode::none>,
+	SegmentRule<NameTest, true, DirectoryMode::contents>,
+	SegmentRule<NameTest, true, DirectoryMode::entry>,
+	SegmentRule<PrefixTest, false, DirectoryMode::none>,
+	SegmentRule<PrefixTest, false, DirectoryMode::contents>,
+	SegmentRule<PrefixTest, false, DirectoryMode::entry>,
+	SegmentRule<PrefixTest, true, DirectoryMode::none>,
+	SegmentRule<PrefixTest, true, DirectoryMode::contents>,
+	SegmentRule<PrefixTest, true, DirectoryMode::entry>,
+	SegmentRule<SuffixTest, false, DirectoryMode::none>,
+	SegmentRule<SuffixTest, false, DirectoryMode::contents>,
+	SegmentRule<SuffixTest, false, DirectoryMode::entry>,
+	SegmentRule<SuffixTest, true, DirectoryMode::none>,
+	SegmentRule<SuffixTest, true, DirectoryMode::contents>,
+	SegmentRule<SuffixTest, true, DirectoryMode::entry>,
+	SegmentRule<GlobTest, false, DirectoryMode::none>,
+	SegmentRule<GlobTest, false, DirectoryMode::contents>,
+	SegmentRule<GlobTest, false, DirectoryMode::entry>,
+	SegmentRule<GlobTest, true, DirectoryMode::none>,
+	SegmentRule<GlobTest, true, DirectoryMode::contents>,
+	SegmentRule<GlobTest, true, DirectoryMode::entry>,
+	PathRule<DirectoryMode::none>,
+	PathRule<DirectoryMode::contents>,
+	PathRule<DirectoryMode::entry>,
+	RegexRule<DirectoryMode::none>,
+	RegexRule<DirectoryMode::contents>,
+	RegexRule<DirectoryMode::entry>>;
+
+// Picks the matcher of a lexed pattern, rule is its index for the regex fallback
+RuleMatcher make_rule_matcher(const LexedPattern& pattern, uint32_t rule);
+
+// What a matcher is built from, so that it can be stored and built again without lexing
+struct RuleMatcherDefinition
+{
+	// Index of the matcher in RuleMatcher
+	uint32_t kind;
+	// Name, prefix, suffix, glob or path tested, empty for a regex
+	std::string operand;
+};
+
+RuleMatcherDefinition rule_matcher_definition(const RuleMatcher& matcher);
+RuleMatcher make_rule_matcher(const RuleMatcherDefinition& definition, uint32_t rule);
+
+inline bool match_rule(const RuleMatcher& matcher, const MatchSubject& subject,
+					   const LazyRegexes& regexes)
+{
+	return std::visit([&](const auto& kind) { return kind.match(subject, regexes); }, matcher);
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "scan_records.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+bool ScanRequest::covers(const ScanRequest& other) const
+{
+	return contains_path(subtree, other.subtree) && max_age <= other.max_age;
+}
+
+std::optional<ScanRecords::Clock::time_point> ScanRecords::read_time(
+	const fs::path& directory) const
+{
+	// The deepest record at or above the directory
+	for (fs::path current = directory;; current = current.parent_path())
+	{
+		const auto it = records.find(current);
+		if (it != records.end())
+			return it->second;
+		if (!current.has_relative_path())
+			return std::nullopt;
+	}
+}
+
+std::optional<ScanRecords::Clock::time_point> ScanRecords::oldest(const fs::path& directory) const
+{
+	auto oldest_time = read_time(directory);
+	if (!oldest_time)
+		return std::nullopt;
+	// Paths compare component by component, so the records below the directory follow it
+	for (auto it = records.upper_bound(directory);
+		 it != records.end() && contains_path(directory, it->first); ++it)
+		oldest_time = std::min(*oldest_time, it->second);
+	return oldest_time;
+}
+
+bool ScanRecords::fresh(const fs::path& directory, std::chrono::seconds max_age,
+						Clock::time_point now) const
+{
+	const auto oldest_time = oldest(directory);
+	return oldest_time && now - *oldest_time < max_age;
+}
+
+void ScanRecords::record_walk(const fs::path& subtree, Clock::time_point time,
+							  const std::vector<fs::path>& skipped)
+{
+	// The skipped directories keep the time they were read, which the subtree won't give anymore
+	std::vector<std::pair<fs::path, Clock::time_point>> kept;
+	for (const auto& directory : skipped)
+	{
+		if (const auto skipped_time = read_time(directory))
+			kept.emplace_back(directory, *skipped_time);
+	}
+
+	for (auto it = records.lower_bound(subtree);
+		 it != records.end() && contains_path(subtree, it->first);)
+	{
+		const bool below_skipped =
+			std::any_of(skipped.begin(), skipped.end(),
+						[&](const auto& directory) { return contains_path(directory, it->first); });
+		it = below_skipped ? std::next(it) : records.erase(it);
+	}
+
+	records[subtree] = time;
+	for (auto& [directory, skipped_time] : kept)
+		records[std::move(directory)] = skipped_time;
+}
+
+void ScanRecords::clear()
+{
+	records.clear();
+}
+
+size_t ScanRecords::size() const
+{
+	return records.size();
+}
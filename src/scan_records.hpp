@@ -0,0 +1,49 @@
+#ifndef SCAN_RECORDS_H
+#define SCAN_RECORDS_H
+
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <vector>
+
+// Part of a folder to rescan: the directories below subtree that weren't read for max_age, all of
+// them with a max_age of 0
+struct ScanRequest
+{
+	std::filesystem::path subtree;
+	std::chrono::seconds max_age{0};
+
+	// Whether running this request makes the other one useless
+	bool covers(const ScanRequest& other) const;
+};
+
+// When the directories of a tree were last read by a scan.
+// A record holds for its directory and everything below it, except below deeper records, so that
+// a walk of a whole tree is a single record. Deeper records are left by walks skipping the
+// directories read recently enough.
+class ScanRecords
+{
+  public:
+	using Clock = std::chrono::steady_clock;
+
+	// Time the directory was last read, nothing if it never was
+	std::optional<Clock::time_point> read_time(const std::filesystem::path& directory) const;
+	// Time the least recently read directory of the tree was read
+	std::optional<Clock::time_point> oldest(const std::filesystem::path& directory) const;
+	// Whether the whole tree was read less than max_age before now
+	bool fresh(const std::filesystem::path& directory, std::chrono::seconds max_age,
+			   Clock::time_point now) const;
+
+	// Records a walk started at time, which read the whole subtree except below the skipped
+	// directories
+	void record_walk(const std::filesystem::path& subtree, Clock::time_point time,
+					 const std::vector<std::filesystem::path>& skipped);
+	void clear();
+	size_t size() const;
+
+  private:
+	std::map<std::filesystem::path, Clock::time_point> records;
+};
+
+#endif
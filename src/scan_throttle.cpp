@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+#include <tbox/tbox.h>
+
+#include "scan_throttle.hpp"
+
+#if defined(TB_CONFIG_OS_WINDOWS)
+	#include <windows.h>
+#elif defined(TB_CONFIG_OS_MACOSX)
+	#include <sys/resource.h>
+#elif defined(__linux__) && !defined(__COSMOPOLITAN__)
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+namespace
+{
+	// Walkers can read this many seconds worth of directories in a burst after being idle
+	constexpr double burst_seconds = 0.1;
+
+#if defined(__linux__) && !defined(__COSMOPOLITAN__) && defined(SYS_ioprio_set)
+	constexpr int ioprio_who_process = 1;
+	constexpr int ioprio_class_shift = 13;
+	constexpr int ioprio_class_idle = 3;
+#endif
+
+	// Lowers the I/O priority of the calling thread, returns the previous one to restore
+	bool lower_io_priority(int& previous)
+	{
+#if defined(TB_CONFIG_OS_WINDOWS)
+		previous = 0;
+		return SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(TB_CONFIG_OS_MACOSX)
+		previous = getiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD);
+		return previous >= 0 &&
+			   setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE) == 0;
+#elif defined(__linux__) && !defined(__COSMOPOLITAN__) && defined(SYS_ioprio_set)
+		// On Linux the I/O priority of a thread is the one of its task id, 0 being the caller
+		previous = static_cast<int>(syscall(SYS_ioprio_get, ioprio_who_process, 0));
+		return previous >= 0 && syscall(SYS_ioprio_set, ioprio_who_process, 0,
+										ioprio_class_idle << ioprio_class_shift) == 0;
+#else
+		previous = 0;
+		return false;
+#endif
+	}
+
+	void restore_io_priority(int previous)
+	{
+#if defined(TB_CONFIG_OS_WINDOWS)
+		(void)previous;
+		SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+#elif defined(TB_CONFIG_OS_MACOSX)
+		setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, previous);
+#elif defined(__linux__) && !defined(__COSMOPOLITAN__) && defined(SYS_ioprio_set)
+		syscall(SYS_ioprio_set, ioprio_who_process, 0, previous);
+#else
+		(void)previous;
+#endif
+	}
+
+	template<typename T> bool parse_number(std::string_view text, T& value)
+	{
+		const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+		return ec == std::errc() && end == text.data() + text.size();
+	}
+} // namespace
+
+bool parse_scan_options(std::string_view text, ScanOptions& options)
+{
+	ScanOptions parsed = options;
+	while (!text.empty())
+	{
+		const size_t first = text.find_first_not_of(" \t");
+		if (first == std::string_view::npos)
+			break;
+		text.remove_prefix(first);
+		const std::string_view setting = text.substr(0, text.find_first_of(" \t"));
+		text.remove_prefix(setting.size());
+
+		const size_t equal = setting.find('=');
+		if (equal == std::string_view::npos)
+			return false;
+		const std::string_view key = setting.substr(0, equal);
+		const std::string_view value = setting.substr(equal + 1);
+		if (key == "max_rate")
+		{
+			// from_chars for floating point isn't everywhere yet, the rate is a whole number
+			uint64_t rate = 0;
+			if (!parse_number(value, rate))
+				return false;
+			parsed.max_directories_per_second = static_cast<double>(rate);
+		}
+		else if (key == "max_walkers")
+		{
+			if (!parse_number(value, parsed.max_walkers))
+				return false;
+		}
+		else if (key == "idle_io" && (value == "on" || value == "off"))
+		{
+			parsed.idle_io_priority = value == "on";
+		}
+		else
+		{
+			return false;
+		}
+	}
+	options = parsed;
+	return true;
+}
+
+std::string format_scan_options(const ScanOptions& options)
+{
+	return "max_rate=" +
+		   std::to_string(static_cast<uint64_t>(std::llround(options.max_directories_per_second))) +
+		   " max_walkers=" + std::to_string(options.max_walkers) +
+		   " idle_io=" + (options.idle_io_priority ? "on" : "off");
+}
+
+ScanThrottle::ScanThrottle(ScanOptions options)
+	: current(options), refilled(std::chrono::steady_clock::now())
+{
+}
+
+void ScanThrottle::set_options(const ScanOptions& options)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		current = options;
+		const double burst = std::max(1.0, options.max_directories_per_second * burst_seconds);
+		tokens = std::min(tokens, burst);
+	}
+	// More walkers may be allowed now, and at another rate
+	slot_cv.notify_all();
+	rate_cv.notify_all();
+}
+
+void ScanThrottle::wake_walkers()
+{
+	// Notified with the mutex locked, so that a walker checking its flag can't miss it
+	std::lock_guard<std::mutex> lock(mutex);
+	slot_cv.notify_all();
+	rate_cv.notify_all();
+}
+
+ScanOptions ScanThrottle::options() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return current;
+}
+
+ScanThrottle::Walker::Walker(ScanThrottle& scan_throttle, const std::atomic<bool>* cancel)
+	: throttle(scan_throttle), cancelled(cancel)
+{
+	bool lower_priority;
+	{
+		std::unique_lock<std::mutex> lock(throttle.mutex);
+		throttle.slot_cv.wait(lock, [this] {
+			return is_cancelled() || !throttle.current.max_walkers ||
+				   throttle.active_walkers < throttle.current.max_walkers;
+		});
+		// A cancelled walk doesn't take a slot, it reads nothing
+		if (is_cancelled())
+			return;
+		throttle.active_walkers++;
+		active = true;
+		lower_priority = throttle.current.idle_io_priority;
+	}
+	if (lower_priority)
+		idle_io = lower_io_priority(previous_io_priority);
+}
+
+ScanThrottle::Walker::~Walker()
+{
+	if (!active)
+		return;
+	if (idle_io)
+		restore_io_priority(previous_io_priority);
+	{
+		std::lock_guard<std::mutex> lock(throttle.mutex);
+		throttle.active_walkers--;
+	}
+	throttle.slot_cv.notify_one();
+}
+
+bool ScanThrottle::Walker::read_directory()
+{
+	std::unique_lock<std::mutex> lock(throttle.mutex);
+	while (true)
+	{
+		if (is_cancelled())
+			return false;
+		const double rate = throttle.current.max_directories_per_second;
+		const auto now = std::chrono::steady_clock::now();
+		if (rate <= 0)
+		{
+			throttle.refilled = now;
+			return true;
+		}
+
+		// Token bucket: the walkers share rate tokens a second, and can save up a small burst
+		const double elapsed = std::chrono::duration<double>(now - throttle.refilled).count();
+		throttle.tokens =
+			std::min(std::max(1.0, rate * burst_seconds), throttle.tokens + elapsed * rate);
+		throttle.refilled = now;
+		if (throttle.tokens >= 1)
+		{
+			throttle.tokens -= 1;
+			return true;
+		}
+
+		const auto wait = std::chrono::duration<double>((1 - throttle.tokens) / rate);
+		throttle.rate_cv.wait_for(lock, wait);
+	}
+}
+
+int64_t ScanProgress::now()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+void ScanProgress::start()
+{
+	directories.store(0);
+	ignore_files.store(0);
+	started.store(now());
+	finished.store(0);
+	state.store(ScanState::scanning);
+}
+
+void ScanProgress::finish()
+{
+	finished.store(now());
+	state.store(ScanState::idle);
+}
+
+std::chrono::milliseconds ScanProgress::elapsed() const
+{
+	const int64_t start = started.load();
+	if (!start)
+		return std::chrono::milliseconds(0);
+	const int64_t end = finished.load();
+	return std::chrono::milliseconds((end ? end : now()) - start);
+}
+
+const char* scan_state_name(ScanState state)
+{
+	switch (state)
+	{
+		case ScanState::waiting:
+			return "waiting";
+		case ScanState::scanning:
+			return "scanning";
+		default:
+			return "idle";
+	}
+}
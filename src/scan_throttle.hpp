@@ -0,0 +1,111 @@
+#ifndef SCAN_THROTTLE_H
+#define SCAN_THROTTLE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Budget of the tree walks, shared by all the folders
+struct ScanOptions
+{
+	// Directories read per second by all the walkers together, 0 for no limit
+	double max_directories_per_second = 0;
+	// Walkers reading the disk at the same time, 0 for no limit
+	size_t max_walkers = 0;
+	// Walkers read with the idle I/O priority of the platform, so that they only use the disk
+	// when nothing else does
+	bool idle_io_priority = false;
+};
+
+// Applies "key=value" settings separated by spaces: max_rate, max_walkers and idle_io (on or
+// off). False if one of them isn't valid, the options being left as they were.
+bool parse_scan_options(std::string_view text, ScanOptions& options);
+std::string format_scan_options(const ScanOptions& options);
+
+// Limits the tree walks to the scan options.
+// Each walk holds a Walker for its duration, which waits for a free walker slot, and asks for a
+// token of the shared rate limit before reading each directory.
+class ScanThrottle
+{
+	ScanOptions current;
+	size_t active_walkers = 0;
+	// Directory reads the walkers can do right away, refilled at the maximum rate
+	double tokens = 0;
+	std::chrono::steady_clock::time_point refilled;
+	mutable std::mutex mutex;
+	std::condition_variable slot_cv;
+	// Walkers waiting for a rate token
+	std::condition_variable rate_cv;
+
+  public:
+	explicit ScanThrottle(ScanOptions options = {});
+
+	ScanThrottle(const ScanThrottle&) = delete;
+	ScanThrottle& operator=(const ScanThrottle&) = delete;
+
+	// Applies to the walks in progress too
+	void set_options(const ScanOptions& options);
+	ScanOptions options() const;
+	// Wakes the waiting walkers, so that those whose walk was cancelled give up
+	void wake_walkers();
+
+	class Walker
+	{
+		ScanThrottle& throttle;
+		// Set by the owner of the walk to stop it, the waits end when the throttle wakes them
+		const std::atomic<bool>* cancelled;
+		bool active = false;
+		bool idle_io = false;
+		int previous_io_priority = 0;
+
+		bool is_cancelled() const
+		{
+			return cancelled && cancelled->load();
+		}
+
+	  public:
+		// Waits for a walker slot, and lowers the I/O priority of the calling thread if asked to
+		explicit Walker(ScanThrottle& scan_throttle, const std::atomic<bool>* cancel = nullptr);
+		~Walker();
+
+		Walker(const Walker&) = delete;
+		Walker& operator=(const Walker&) = delete;
+
+		// Waits until the walker can read one more directory, false if the walk was cancelled
+		bool read_directory();
+	};
+};
+
+enum class ScanState : uint8_t
+{
+	idle,
+	// Waiting for a walker slot
+	waiting,
+	scanning,
+};
+
+// Progress of the current or last scan of a folder, updated by the walker and read from any thread
+struct ScanProgress
+{
+	std::atomic<ScanState> state = ScanState::idle;
+	std::atomic<uint64_t> directories = 0;
+	std::atomic<uint64_t> ignore_files = 0;
+	// Milliseconds of the steady clock
+	std::atomic<int64_t> started = 0;
+	std::atomic<int64_t> finished = 0;
+
+	static int64_t now();
+	void start();
+	void finish();
+	// Duration of the current scan until now, or of the last one
+	std::chrono::milliseconds elapsed() const;
+};
+
+const char* scan_state_name(ScanState state);
+
+#endif
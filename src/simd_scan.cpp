@@ -0,0 +1,305 @@
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#include "simd_scan.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SIMD_SCAN_X86 1
+#include <immintrin.h>
+#define SIMD_SCAN_TARGET(name) __attribute__((target(name)))
+#elif defined(_M_X64)
+// MSVC, SSE2 is always there but AVX2 would need a cpuid check
+#define SIMD_SCAN_X86 1
+#define SIMD_SCAN_SSE2_ONLY 1
+#include <intrin.h>
+#define SIMD_SCAN_TARGET(name)
+#endif
+
+namespace
+{
+	constexpr char alt_separator = std::filesystem::path::preferred_separator == '\\' ? '\\' : '/';
+
+	size_t find_separator_scalar(std::string_view text, size_t from)
+	{
+		for (size_t i = from; i < text.size(); i++)
+		{
+			if (is_separator(text[i]))
+				return i;
+		}
+		return std::string_view::npos;
+	}
+
+	size_t find_last_separator_scalar(std::string_view text, size_t end)
+	{
+		for (size_t i = end; i-- > 0;)
+		{
+			if (is_separator(text[i]))
+				return i;
+		}
+		return std::string_view::npos;
+	}
+
+	size_t find_literal_scalar(std::string_view text, std::string_view literal, size_t from)
+	{
+		return text.find(literal, from);
+	}
+
+#ifdef SIMD_SCAN_X86
+	SIMD_SCAN_TARGET("sse2")
+	size_t find_separator_sse2(std::string_view text, size_t from)
+	{
+		const __m128i slash = _mm_set1_epi8('/');
+		const __m128i alt = _mm_set1_epi8(alt_separator);
+		size_t i = from;
+		for (; i + 16 <= text.size(); i += 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(block, slash), _mm_cmpeq_epi8(block, alt))));
+			if (mask)
+				return i + std::countr_zero(mask);
+		}
+		return find_separator_scalar(text, i);
+	}
+
+	SIMD_SCAN_TARGET("sse2")
+	size_t find_last_separator_sse2(std::string_view text)
+	{
+		const __m128i slash = _mm_set1_epi8('/');
+		const __m128i alt = _mm_set1_epi8(alt_separator);
+		size_t end = text.size();
+		for (; end >= 16; end -= 16)
+		{
+			const __m128i block =
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + end - 16));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(block, slash), _mm_cmpeq_epi8(block, alt))));
+			if (mask)
+				return end - 16 + std::bit_width(mask) - 1;
+		}
+		return find_last_separator_scalar(text, end);
+	}
+
+	// Compares the first and last bytes of the literal at 16 positions at once, the rest of the
+	// literal is only compared where both are equal
+	SIMD_SCAN_TARGET("sse2")
+	size_t find_literal_sse2(std::string_view text, std::string_view literal)
+	{
+		const size_t size = literal.size();
+		if (size < 2 || text.size() < size)
+			return text.find(literal);
+
+		const __m128i first = _mm_set1_epi8(literal.front());
+		const __m128i last = _mm_set1_epi8(literal.back());
+		size_t i = 0;
+		for (; i + size - 1 + 16 <= text.size(); i += 16)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+			const __m128i b =
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i + size - 1));
+			unsigned mask = static_cast<unsigned>(
+				_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+			while (mask)
+			{
+				const size_t position = i + std::countr_zero(mask);
+				if (!std::memcmp(text.data() + position + 1, literal.data() + 1, size - 2))
+					return position;
+				mask &= mask - 1;
+			}
+		}
+		return find_literal_scalar(text, literal, i);
+	}
+#endif
+
+#if defined(SIMD_SCAN_X86) && !defined(SIMD_SCAN_SSE2_ONLY)
+	SIMD_SCAN_TARGET("avx2")
+	size_t find_separator_avx2(std::string_view text, size_t from)
+	{
+		const __m256i slash = _mm256_set1_epi8('/');
+		const __m256i alt = _mm256_set1_epi8(alt_separator);
+		size_t i = from;
+		for (; i + 32 <= text.size(); i += 32)
+		{
+			const __m256i block =
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + i));
+			const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, slash), _mm256_cmpeq_epi8(block, alt))));
+			if (mask)
+				return i + std::countr_zero(mask);
+		}
+		// Path segments are short, so the remaining half block is still compared at once
+		if (i + 16 <= text.size())
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + i));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(block, _mm256_castsi256_si128(slash)),
+							 _mm_cmpeq_epi8(block, _mm256_castsi256_si128(alt)))));
+			if (mask)
+				return i + std::countr_zero(mask);
+			i += 16;
+		}
+		return find_separator_scalar(text, i);
+	}
+
+	SIMD_SCAN_TARGET("avx2")
+	size_t find_last_separator_avx2(std::string_view text)
+	{
+		const __m256i slash = _mm256_set1_epi8('/');
+		const __m256i alt = _mm256_set1_epi8(alt_separator);
+		size_t end = text.size();
+		for (; end >= 32; end -= 32)
+		{
+			const __m256i block =
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + end - 32));
+			const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+				_mm256_or_si256(_mm256_cmpeq_epi8(block, slash), _mm256_cmpeq_epi8(block, alt))));
+			if (mask)
+				return end - 32 + std::bit_width(mask) - 1;
+		}
+		if (end >= 16)
+		{
+			const __m128i block =
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + end - 16));
+			const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(block, _mm256_castsi256_si128(slash)),
+							 _mm_cmpeq_epi8(block, _mm256_castsi256_si128(alt)))));
+			if (mask)
+				return end - 16 + std::bit_width(mask) - 1;
+			end -= 16;
+		}
+		return find_last_separator_scalar(text, end);
+	}
+
+	SIMD_SCAN_TARGET("avx2")
+	size_t find_literal_avx2(std::string_view text, std::string_view literal)
+	{
+		const size_t size = literal.size();
+		if (size < 2 || text.size() < size)
+			return text.find(literal);
+
+		const __m256i first = _mm256_set1_epi8(literal.front());
+		const __m256i last = _mm256_set1_epi8(literal.back());
+		size_t i = 0;
+		for (; i + size - 1 + 32 <= text.size(); i += 32)
+		{
+			const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + i));
+			const __m256i b =
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text.data() + i + size - 1));
+			unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+			while (mask)
+			{
+				const size_t position = i + std::countr_zero(mask);
+				if (!std::memcmp(text.data() + position + 1, literal.data() + 1, size - 2))
+					return position;
+				mask &= mask - 1;
+			}
+		}
+		return find_literal_scalar(text, literal, i);
+	}
+#endif
+
+	ScanLevel detect_level()
+	{
+#if defined(SIMD_SCAN_X86) && !defined(SIMD_SCAN_SSE2_ONLY)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return ScanLevel::avx2;
+		return ScanLevel::sse2;
+#elif defined(SIMD_SCAN_X86)
+		return ScanLevel::sse2;
+#else
+		return ScanLevel::scalar;
+#endif
+	}
+
+	std::atomic<ScanLevel>& current_level()
+	{
+		static std::atomic<ScanLevel> level(detect_level());
+		return level;
+	}
+} // namespace
+
+ScanLevel scan_level()
+{
+	return current_level().load(std::memory_order_relaxed);
+}
+
+ScanLevel best_scan_level()
+{
+	static const ScanLevel level = detect_level();
+	return level;
+}
+
+void set_scan_level(ScanLevel level)
+{
+	current_level().store(std::min(level, best_scan_level()), std::memory_order_relaxed);
+}
+
+const char* scan_level_name(ScanLevel level)
+{
+	switch (level)
+	{
+		case ScanLevel::avx2:
+			return "avx2";
+		case ScanLevel::sse2:
+			return "sse2";
+		default:
+			return "scalar";
+	}
+}
+
+size_t find_separator(std::string_view text, size_t from)
+{
+	if (from >= text.size())
+		return std::string_view::npos;
+	switch (scan_level())
+	{
+#if defined(SIMD_SCAN_X86) && !defined(SIMD_SCAN_SSE2_ONLY)
+		case ScanLevel::avx2:
+			return find_separator_avx2(text, from);
+#endif
+#ifdef SIMD_SCAN_X86
+		case ScanLevel::sse2:
+			return find_separator_sse2(text, from);
+#endif
+		default:
+			return find_separator_scalar(text, from);
+	}
+}
+
+size_t find_last_separator(std::string_view text)
+{
+	switch (scan_level())
+	{
+#if defined(SIMD_SCAN_X86) && !defined(SIMD_SCAN_SSE2_ONLY)
+		case ScanLevel::avx2:
+			return find_last_separator_avx2(text);
+#endif
+#ifdef SIMD_SCAN_X86
+		case ScanLevel::sse2:
+			return find_last_separator_sse2(text);
+#endif
+		default:
+			return find_last_separator_scalar(text, text.size());
+	}
+}
+
+size_t find_literal(std::string_view text, std::string_view literal)
+{
+	switch (scan_level())
+	{
+#if defined(SIMD_SCAN_X86) && !defined(SIMD_SCAN_SSE2_ONLY)
+		case ScanLevel::avx2:
+			return find_literal_avx2(text, literal);
+#endif
+#ifdef SIMD_SCAN_X86
+		case ScanLevel::sse2:
+			return find_literal_sse2(text, literal);
+#endif
+		default:
+			return find_literal_scalar(text, literal, 0);
+	}
+}
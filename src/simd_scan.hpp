@@ -0,0 +1,37 @@
+#ifndef SIMD_SCAN_H
+#define SIMD_SCAN_H
+
+#include <cstddef>
+#include <filesystem>
+#include <string_view>
+
+// Byte scanning kernels of the matcher, vectorized where the CPU allows it.
+// The implementation is picked once at runtime: AVX2 or SSE2 on x86-64, scalar elsewhere.
+enum class ScanLevel
+{
+	scalar,
+	sse2,
+	avx2,
+};
+
+ScanLevel scan_level();
+// Highest level supported by the CPU
+ScanLevel best_scan_level();
+// Forces a level, for tests and benchmarks, a level the CPU lacks is lowered to the best one
+void set_scan_level(ScanLevel level);
+const char* scan_level_name(ScanLevel level);
+
+// '/' or the preferred separator of the platform
+inline bool is_separator(char c)
+{
+	return c == '/' || c == std::filesystem::path::preferred_separator;
+}
+
+// Position of the first path separator at or after from, npos if none
+size_t find_separator(std::string_view text, size_t from = 0);
+// Position of the last path separator, npos if none
+size_t find_last_separator(std::string_view text);
+// Position of the first occurrence of literal, npos if none
+size_t find_literal(std::string_view text, std::string_view literal);
+
+#endif
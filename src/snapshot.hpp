@@ -0,0 +1,34 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <atomic>
+#include <memory>
+
+// Immutable value published by one writer and read by any number of threads.
+// Readers take a reference to the current generation and never wait on the writer, which builds
+// the next generation aside and swaps it in. A generation is freed by whoever drops the last
+// reference to it, so readers can keep using an old one safely.
+template<typename T>
+class Published
+{
+	std::atomic<std::shared_ptr<const T>> current;
+
+  public:
+	Published() = default;
+
+	explicit Published(std::shared_ptr<const T> initial) : current(std::move(initial))
+	{
+	}
+
+	std::shared_ptr<const T> load() const
+	{
+		return current.load(std::memory_order_acquire);
+	}
+
+	void publish(std::shared_ptr<const T> next)
+	{
+		current.store(std::move(next), std::memory_order_release);
+	}
+};
+
+#endif
@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "state_file.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+// Layout of the state file, integers in native byte order:
+//   header: magic "SIGS", version (u32)
+//   records: body size (u32), body, FNV-1a hash of the body (u64)
+//   body: record type (u8), then the payload of the type
+// Strings are a size (u32) followed by their bytes.
+namespace
+{
+	constexpr char magic[4] = {'S', 'I', 'G', 'S'};
+	constexpr size_t header_size = sizeof(magic) + sizeof(uint32_t);
+	constexpr size_t framing_size = sizeof(uint32_t) + sizeof(uint64_t);
+
+	enum class RecordType : uint8_t
+	{
+		settings = 1,
+		user_rules = 2,
+		gitignore_file = 3,
+		removed_gitignore_file = 4,
+	};
+
+	class Writer
+	{
+		std::string& data;
+
+	  public:
+		explicit Writer(std::string& output) : data(output)
+		{
+		}
+
+		template<typename T> void write(T value)
+		{
+			data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		void write(std::string_view value)
+		{
+			write<uint32_t>(static_cast<uint32_t>(value.size()));
+			data.append(value);
+		}
+
+		void write(const OrderedRuleSet& rules)
+		{
+			write<uint32_t>(static_cast<uint32_t>(rules.size()));
+			for (const auto& rule : rules)
+				write(std::string_view(rule));
+		}
+	};
+
+	// Bounds-checked reads, a failed read leaves the reader in the failed state
+	class Reader
+	{
+		std::string_view data;
+		bool failed = false;
+
+	  public:
+		explicit Reader(std::string_view input) : data(input)
+		{
+		}
+
+		bool ok() const
+		{
+			return !failed;
+		}
+
+		template<typename T> T read()
+		{
+			T value{};
+			if (failed || data.size() < sizeof(T))
+			{
+				failed = true;
+				return value;
+			}
+			std::memcpy(&value, data.data(), sizeof(T));
+			data.remove_prefix(sizeof(T));
+			return value;
+		}
+
+		std::string_view read_string()
+		{
+			const uint32_t size = read<uint32_t>();
+			if (failed || data.size() < size)
+			{
+				failed = true;
+				return {};
+			}
+			std::string_view value = data.substr(0, size);
+			data.remove_prefix(size);
+			return value;
+		}
+
+		void read_rules(OrderedRuleSet& rules)
+		{
+			rules.clear();
+			const uint32_t count = read<uint32_t>();
+			for (uint32_t i = 0; i < count && !failed; i++)
+				rules.insert(std::string(read_string()));
+		}
+	};
+
+	// Frames the record, the hash being the one of its body
+	StateFile::Record make_record(std::string key, RecordType type, const std::string& payload)
+	{
+		std::string body;
+		body.reserve(payload.size() + 1);
+		body += static_cast<char>(type);
+		body += payload;
+
+		StateFile::Record record{.key = std::move(key),
+								 .data = {},
+								 .hash = hash_bytes(body),
+								 .removal = type == RecordType::removed_gitignore_file};
+		Writer writer(record.data);
+		writer.write<uint32_t>(static_cast<uint32_t>(body.size()));
+		record.data += body;
+		writer.write<uint64_t>(record.hash);
+		return record;
+	}
+
+	std::string file_key(const fs::path& path)
+	{
+		return "f:" + path.generic_string();
+	}
+
+	// Replaces the file at once, false if it couldn't be written
+	bool replace_file(const fs::path& path, std::string_view data)
+	{
+		fs::path temp_path = path;
+		temp_path += ".tmp";
+		{
+			std::ofstream ofs(temp_path, std::ios::binary | std::ios::trunc);
+			ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+			if (!ofs)
+				return false;
+		}
+		std::error_code ec;
+		fs::rename(temp_path, path, ec);
+		return !ec;
+	}
+} // namespace
+
+StateFile::StateFile(fs::path state_path) : path(std::move(state_path))
+{
+}
+
+bool StateFile::exists() const
+{
+	return fs::exists(path);
+}
+
+bool StateFile::load(State& state)
+{
+	persisted.clear();
+	live_size = 0;
+	file_size = 0;
+	needs_rewrite = true;
+
+	const MappedFile file(path, FileAccess::mapped);
+	std::string_view data = file.view();
+	if (data.size() < header_size || std::memcmp(data.data(), magic, sizeof(magic)) != 0)
+		return false;
+
+	uint32_t file_version;
+	std::memcpy(&file_version, data.data() + sizeof(magic), sizeof(file_version));
+	if (file_version != version)
+		return false;
+
+	state = State{};
+	size_t offset = header_size;
+	bool torn = false;
+	while (offset < data.size())
+	{
+		Reader frame(data.substr(offset));
+		const uint32_t body_size = frame.read<uint32_t>();
+		if (!frame.ok() || data.size() - offset < framing_size + body_size)
+		{
+			torn = true;
+			break;
+		}
+
+		const std::string_view body = data.substr(offset + sizeof(uint32_t), body_size);
+		uint64_t hash;
+		std::memcpy(&hash, body.data() + body_size, sizeof(hash));
+		if (body.empty() || hash_bytes(body) != hash)
+		{
+			torn = true;
+			break;
+		}
+
+		Reader reader(body.substr(1));
+		std::string key;
+		switch (static_cast<RecordType>(body[0]))
+		{
+			case RecordType::settings:
+				state.autostart = reader.read<uint8_t>() != 0;
+				state.max_alternatives = reader.read<uint64_t>();
+				state.max_pattern_length = reader.read<uint64_t>();
+				key = "s";
+				break;
+			case RecordType::user_rules:
+				reader.read_rules(state.user_rules);
+				key = "u";
+				break;
+			case RecordType::gitignore_file:
+			{
+				const fs::path file_path(std::string(reader.read_string()));
+				const PathId file_id = path_table().intern(file_path);
+				GitIgnoreFile gitignore_file;
+				const int64_t mtime = reader.read<int64_t>();
+				gitignore_file.mtime =
+					fs::file_time_type(fs::file_time_type::duration(mtime));
+				reader.read_rules(gitignore_file.st_rules);
+				key = file_key(file_path);
+				state.gitignore_files.insert_or_assign(file_id, std::move(gitignore_file));
+				break;
+			}
+			case RecordType::removed_gitignore_file:
+			{
+				const fs::path file_path(std::string(reader.read_string()));
+				if (const auto file_id = path_table().find(file_path))
+					state.gitignore_files.erase(*file_id);
+				key = file_key(file_path);
+				break;
+			}
+			default:
+				torn = true;
+				break;
+		}
+		if (torn || !reader.ok())
+		{
+			torn = true;
+			break;
+		}
+
+		const size_t size = framing_size + body_size;
+		if (const auto it = persisted.find(key); it != persisted.end())
+		{
+			live_size -= it->second.size;
+			persisted.erase(it);
+		}
+		if (static_cast<RecordType>(body[0]) != RecordType::removed_gitignore_file)
+		{
+			persisted.emplace(key, RecordInfo{.hash = hash, .offset = offset, .size = size});
+			live_size += size;
+		}
+		offset += size;
+	}
+
+	file_size = offset;
+	// Appending after a torn record would hide the new records behind it
+	needs_rewrite = torn;
+	return true;
+}
+
+StateFile::Record StateFile::settings_record(const State& state)
+{
+	std::string payload;
+	Writer writer(payload);
+	writer.write<uint8_t>(state.autostart ? 1 : 0);
+	writer.write<uint64_t>(state.max_alternatives);
+	writer.write<uint64_t>(state.max_pattern_length);
+	return make_record("s", RecordType::settings, payload);
+}
+
+StateFile::Record StateFile::user_rules_record(const OrderedRuleSet& user_rules)
+{
+	std::string payload;
+	Writer(payload).write(user_rules);
+	return make_record("u", RecordType::user_rules, payload);
+}
+
+StateFile::Record StateFile::file_record(PathId path, const GitIgnoreFile& gitignore_file)
+{
+	const fs::path file_path = path_table().path(path);
+	std::string payload;
+	Writer writer(payload);
+	writer.write(std::string_view(file_path.generic_string()));
+	writer.write<int64_t>(gitignore_file.mtime.time_since_epoch().count());
+	writer.write(gitignore_file.st_rules);
+	return make_record(file_key(file_path), RecordType::gitignore_file, payload);
+}
+
+StateFile::Record StateFile::removed_file_record(PathId path)
+{
+	const fs::path file_path = path_table().path(path);
+	std::string payload;
+	Writer(payload).write(std::string_view(file_path.generic_string()));
+	return make_record(file_key(file_path), RecordType::removed_gitignore_file, payload);
+}
+
+bool StateFile::save(const State& state)
+{
+	const TraceScope trace_scope("save_state");
+	std::vector<Record> records;
+	records.reserve(state.gitignore_files.size() + 2);
+	records.push_back(settings_record(state));
+	records.push_back(user_rules_record(state.user_rules));
+	for (const auto& [file_id, gitignore_file] : state.gitignore_files)
+		records.push_back(file_record(file_id, gitignore_file));
+
+	// Nothing of the previous log is kept
+	persisted.clear();
+	live_size = 0;
+	std::vector<const Record*> changes;
+	for (const auto& record : records)
+		changes.push_back(&record);
+	return rewrite(changes);
+}
+
+bool StateFile::append(const std::vector<Record>& records)
+{
+	const TraceScope trace_scope("save_state");
+	std::vector<const Record*> changes;
+	size_t changes_size = 0;
+	// Size of the live records once the changes are applied
+	size_t next_live_size = live_size;
+	for (const auto& record : records)
+	{
+		const auto it = persisted.find(record.key);
+		if (record.removal ? it == persisted.end()
+						   : it != persisted.end() && it->second.hash == record.hash)
+			continue;
+		changes.push_back(&record);
+		changes_size += record.data.size();
+		if (it != persisted.end())
+			next_live_size -= it->second.size;
+		if (!record.removal)
+			next_live_size += record.data.size();
+	}
+
+	if (changes.empty() && !needs_rewrite)
+		return true;
+
+	// Rewrite when the log is mostly stale records
+	const size_t appended_size = file_size + changes_size;
+	if (needs_rewrite || appended_size > 2 * (header_size + next_live_size) + 64 * 1024)
+		return rewrite(changes);
+
+	std::string data;
+	data.reserve(changes_size);
+	for (const Record* record : changes)
+		data += record->data;
+	std::ofstream ofs(path, std::ios::binary | std::ios::app);
+	ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+	if (!ofs)
+	{
+		needs_rewrite = true;
+		return false;
+	}
+
+	size_t offset = file_size;
+	for (const Record* record : changes)
+	{
+		if (record->removal)
+			persisted.erase(record->key);
+		else
+			persisted.insert_or_assign(
+				record->key,
+				RecordInfo{.hash = record->hash, .offset = offset, .size = record->data.size()});
+		offset += record->data.size();
+	}
+	file_size = appended_size;
+	live_size = next_live_size;
+	return true;
+}
+
+bool StateFile::rewrite(const std::vector<const Record*>& changes)
+{
+	std::unordered_map<std::string_view, const Record*> changed;
+	for (const Record* record : changes)
+		changed.emplace(record->key, record);
+
+	std::string data(magic, sizeof(magic));
+	Writer(data).write<uint32_t>(version);
+	std::unordered_map<std::string, RecordInfo> written;
+
+	// The live records are copied from the log as they are, without serializing them again
+	{
+		const MappedFile log(path, FileAccess::mapped);
+		const std::string_view log_data = log.view();
+		for (const auto& [key, info] : persisted)
+		{
+			if (changed.contains(key) || info.offset + info.size > log_data.size())
+				continue;
+			// A record the file no longer holds, if it was replaced meanwhile, is dropped
+			const std::string_view record = log_data.substr(info.offset, info.size);
+			uint64_t hash;
+			std::memcpy(&hash, record.data() + record.size() - sizeof(hash), sizeof(hash));
+			if (hash != info.hash)
+				continue;
+			written.emplace(key,
+							RecordInfo{.hash = hash, .offset = data.size(), .size = info.size});
+			data += record;
+		}
+	}
+	for (const Record* record : changes)
+	{
+		if (record->removal)
+			continue;
+		written.insert_or_assign(
+			record->key,
+			RecordInfo{.hash = record->hash, .offset = data.size(), .size = record->data.size()});
+		data += record->data;
+	}
+
+	if (!replace_file(path, data))
+		return false;
+	persisted = std::move(written);
+	live_size = data.size() - header_size;
+	file_size = data.size();
+	needs_rewrite = false;
+	return true;
+}
+
+StateWriter::StateWriter(StateFile& state_file, std::chrono::milliseconds delay,
+						 std::chrono::milliseconds max_delay)
+	: file(state_file), delay(delay), max_delay(max_delay), worker([this] { run(); })
+{
+}
+
+StateWriter::~StateWriter()
+{
+	stop();
+}
+
+void StateWriter::touch()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (!has_changes)
+		first_change = now;
+	last_change = now;
+	has_changes = true;
+	cv.notify_all();
+}
+
+void StateWriter::update_file(PathId path, const GitIgnoreFile& gitignore_file)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dirty_files.insert_or_assign(path, gitignore_file);
+	touch();
+}
+
+void StateWriter::remove_file(PathId path)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dirty_files.insert_or_assign(path, std::nullopt);
+	touch();
+}
+
+void StateWriter::update_user_rules(const OrderedRuleSet& user_rules)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dirty_user_rules = user_rules;
+	touch();
+}
+
+void StateWriter::update_settings(const State& state)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	State settings;
+	settings.autostart = state.autostart;
+	settings.max_alternatives = state.max_alternatives;
+	settings.max_pattern_length = state.max_pattern_length;
+	dirty_settings = std::move(settings);
+	touch();
+}
+
+void StateWriter::replace(const State& state)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	dirty_state = state;
+	dirty_files.clear();
+	dirty_user_rules.reset();
+	dirty_settings.reset();
+	touch();
+}
+
+void StateWriter::write_pending()
+{
+	std::lock_guard<std::mutex> save_lock(save_mutex);
+
+	decltype(dirty_files) files;
+	std::optional<OrderedRuleSet> user_rules;
+	std::optional<State> settings;
+	std::optional<State> state;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!has_changes)
+			return;
+		state.swap(dirty_state);
+		files.swap(dirty_files);
+		user_rules.swap(dirty_user_rules);
+		settings.swap(dirty_settings);
+		has_changes = false;
+	}
+
+	bool written;
+	if (state)
+	{
+		// The changes that came after the whole state was replaced are applied to it
+		for (auto& [path, gitignore_file] : files)
+		{
+			if (gitignore_file)
+				state->gitignore_files.insert_or_assign(path, std::move(*gitignore_file));
+			else
+				state->gitignore_files.erase(path);
+		}
+		files.clear();
+		if (user_rules)
+			state->user_rules = std::move(*user_rules);
+		if (settings)
+		{
+			state->autostart = settings->autostart;
+			state->max_alternatives = settings->max_alternatives;
+			state->max_pattern_length = settings->max_pattern_length;
+		}
+		user_rules.reset();
+		settings.reset();
+		written = file.save(*state);
+	}
+	else
+	{
+		// Only the records of the changes are serialized
+		std::vector<StateFile::Record> records;
+		records.reserve(files.size() + 2);
+		for (const auto& [path, gitignore_file] : files)
+			records.push_back(gitignore_file ? StateFile::file_record(path, *gitignore_file)
+											 : StateFile::removed_file_record(path));
+		if (user_rules)
+			records.push_back(StateFile::user_rules_record(*user_rules));
+		if (settings)
+			records.push_back(StateFile::settings_record(*settings));
+		written = file.append(records);
+	}
+	if (written)
+		return;
+
+	// Saved along with the next changes, unless the whole state was replaced meanwhile
+	std::lock_guard<std::mutex> lock(mutex);
+	if (dirty_state)
+		return;
+	dirty_state = std::move(state);
+	for (auto& [path, gitignore_file] : files)
+		dirty_files.try_emplace(path, std::move(gitignore_file));
+	if (!dirty_user_rules)
+		dirty_user_rules = std::move(user_rules);
+	if (!dirty_settings)
+		dirty_settings = std::move(settings);
+	// Tried again after the delay or on stop
+	touch();
+}
+
+void StateWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping)
+	{
+		cv.wait(lock, [this] { return has_changes || stopping; });
+		if (stopping)
+			break;
+
+		// Debounce: wait for a quiet period, bounded by max_delay
+		const auto deadline = std::min(last_change + delay, first_change + max_delay);
+		if (std::chrono::steady_clock::now() < deadline)
+		{
+			cv.wait_until(lock, deadline, [this] { return stopping; });
+			continue;
+		}
+
+		lock.unlock();
+		write_pending();
+		lock.lock();
+	}
+}
+
+void StateWriter::flush()
+{
+	write_pending();
+}
+
+void StateWriter::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stopping)
+			return;
+		stopping = true;
+		cv.notify_all();
+	}
+	if (worker.joinable())
+		worker.join();
+	write_pending();
+}
@@ -0,0 +1,150 @@
+#ifndef STATE_FILE_H
+#define STATE_FILE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "path_table.hpp"
+#include "stignore.hpp"
+
+struct GitIgnoreFile
+{
+	std::filesystem::file_time_type mtime;
+	// Syncthing rules in the order of the gitignore lines
+	OrderedRuleSet st_rules;
+};
+
+// Everything synctignore keeps between two runs
+struct State
+{
+	OrderedRuleSet user_rules;
+	// Gitignore files by their path in path_table()
+	std::map<PathId, GitIgnoreFile> gitignore_files;
+	bool autostart = false;
+	// Complexity limits of the {a,b,c} patterns created when compacting the rules
+	size_t max_alternatives = CompactOptions{}.max_alternatives;
+	size_t max_pattern_length = CompactOptions{}.max_pattern_length;
+};
+
+// Binary state file, an append-only log of records.
+// Each gitignore file, the user rules and the settings are separate records, only the records of
+// what changed are serialized and appended, and a later record replaces an earlier one with the
+// same key. Once the log is mostly made of stale records, it is rewritten with copies of the live
+// ones. Loading replays the log in one pass, a torn record at the end is dropped.
+class StateFile
+{
+  public:
+	// Serialized record, as written to the log
+	struct Record
+	{
+		std::string key;
+		std::string data;
+		uint64_t hash;
+		// Drops the record of the key rather than replacing it
+		bool removal;
+	};
+
+	static constexpr uint32_t version = 1;
+
+	explicit StateFile(std::filesystem::path state_path);
+
+	bool exists() const;
+
+	// Returns false if there is no valid state file
+	bool load(State& state);
+	// Replaces the log with the records of the whole state, false if the file couldn't be written
+	bool save(const State& state);
+	// Appends the records whose content changed, one per key at most, false if the file couldn't
+	// be written, nothing being saved then
+	bool append(const std::vector<Record>& records);
+
+	static Record settings_record(const State& state);
+	static Record user_rules_record(const OrderedRuleSet& user_rules);
+	static Record file_record(PathId path, const GitIgnoreFile& gitignore_file);
+	static Record removed_file_record(PathId path);
+
+  private:
+	struct RecordInfo
+	{
+		uint64_t hash;
+		// Position of the record in the file
+		size_t offset;
+		size_t size;
+	};
+
+	std::filesystem::path path;
+	// Latest record of each key in the log
+	std::unordered_map<std::string, RecordInfo> persisted;
+	// Size of the records in persisted
+	size_t live_size = 0;
+	size_t file_size = 0;
+	bool needs_rewrite = true;
+
+	// Writes a new log made of copies of the live records and of the changed records
+	bool rewrite(const std::vector<const Record*>& changes);
+};
+
+// Write-behind persistence of the state.
+// Changed records are marked dirty and copied, a worker thread appends them to the file once no
+// change came for `delay`, at the latest `max_delay` after the first pending change, and on stop.
+// Callers never wait on the disk.
+class StateWriter
+{
+	StateFile& file;
+	const std::chrono::milliseconds delay;
+	const std::chrono::milliseconds max_delay;
+
+	// Changes not saved yet, a missing file means it was removed
+	std::map<PathId, std::optional<GitIgnoreFile>> dirty_files;
+	std::optional<OrderedRuleSet> dirty_user_rules;
+	std::optional<State> dirty_settings;
+	// Whole state replacing the saved one, applied before the other changes
+	std::optional<State> dirty_state;
+	std::chrono::steady_clock::time_point first_change;
+	std::chrono::steady_clock::time_point last_change;
+	bool has_changes = false;
+	bool stopping = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	// Serializes the saves of the worker and of flush
+	std::mutex save_mutex;
+
+	std::thread worker;
+
+	void run();
+	void touch();
+	void write_pending();
+
+  public:
+	explicit StateWriter(StateFile& state_file,
+						 std::chrono::milliseconds delay = std::chrono::milliseconds(500),
+						 std::chrono::milliseconds max_delay = std::chrono::milliseconds(5000));
+	~StateWriter();
+
+	StateWriter(const StateWriter&) = delete;
+	StateWriter& operator=(const StateWriter&) = delete;
+
+	void update_file(PathId path, const GitIgnoreFile& gitignore_file);
+	void remove_file(PathId path);
+	void update_user_rules(const OrderedRuleSet& user_rules);
+	void update_settings(const State& state);
+	// Marks the whole state dirty
+	void replace(const State& state);
+
+	// Saves the pending changes now, from the calling thread
+	void flush();
+	// Saves the pending changes and stops the worker
+	void stop();
+};
+
+#endif
@@ -0,0 +1,468 @@
+#include <algorithm>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "stignore.hpp"
+
+bool OrderedRuleSet::insert(std::string rule)
+{
+	if (contains(rule))
+		return false;
+
+	index.emplace(std::hash<std::string_view>{}(rule), rules.size());
+	rules.push_back(std::move(rule));
+	return true;
+}
+
+void OrderedRuleSet::append(std::string rule)
+{
+	const size_t hash = std::hash<std::string_view>{}(rule);
+	const auto [first, last] = index.equal_range(hash);
+	const auto found =
+		std::find_if(first, last, [&](const auto& entry) { return rules[entry.second] == rule; });
+	if (found != last)
+	{
+		const size_t position = found->second;
+		index.erase(found);
+		rules.erase(rules.begin() + static_cast<std::ptrdiff_t>(position));
+		for (auto& [rule_hash, rule_position] : index)
+		{
+			if (rule_position > position)
+				rule_position--;
+		}
+	}
+	index.emplace(hash, rules.size());
+	rules.push_back(std::move(rule));
+}
+
+bool OrderedRuleSet::contains(std::string_view rule) const
+{
+	const auto [first, last] = index.equal_range(std::hash<std::string_view>{}(rule));
+	return std::any_of(first, last, [&](const auto& entry) { return rules[entry.second] == rule; });
+}
+
+void OrderedRuleSet::clear()
+{
+	rules.clear();
+	index.clear();
+}
+
+namespace
+{
+	// Shape of a syncthing pattern, split in path segments.
+	// A pattern starting with a slash only matches from the folder root, any other pattern also
+	// matches at any depth (syncthing adds a "**/" variant of it), hence the alternatives.
+	struct PatternShape
+	{
+		bool negation = false;
+		// Patterns using syntax not understood here (flags, escapes, includes) are left alone
+		bool opaque = false;
+		// True if the pattern can cover other patterns than itself
+		bool broad = false;
+		std::vector<std::vector<std::string_view>> alternatives;
+	};
+
+	bool has_glob_characters(std::string_view segment)
+	{
+		return segment.find_first_of("*?[{") != std::string_view::npos;
+	}
+
+	std::vector<std::string_view> split_segments(std::string_view pattern)
+	{
+		std::vector<std::string_view> segments;
+		size_t start = 0;
+		while (start <= pattern.size())
+		{
+			size_t end = pattern.find('/', start);
+			if (end == std::string_view::npos)
+				end = pattern.size();
+			segments.push_back(pattern.substr(start, end - start));
+			start = end + 1;
+		}
+		return segments;
+	}
+
+	PatternShape parse_shape(std::string_view rule)
+	{
+		PatternShape shape;
+		if (rule.starts_with("!"))
+		{
+			shape.negation = true;
+			rule.remove_prefix(1);
+		}
+
+		if (rule.empty() || rule.starts_with("(?") || rule.starts_with("#") ||
+			rule.starts_with("//") || rule.find('\\') != std::string_view::npos)
+		{
+			shape.opaque = true;
+			return shape;
+		}
+
+		const bool rooted = rule.starts_with("/");
+		if (rooted)
+			rule.remove_prefix(1);
+
+		std::vector<std::string_view> segments = split_segments(rule);
+		for (const auto& segment : segments)
+		{
+			// A double asterisk inside a segment crosses separators in ways we don't model
+			if (segment.empty() || (segment != "**" && segment.find("**") != std::string_view::npos))
+			{
+				shape.opaque = true;
+				return shape;
+			}
+			if (has_glob_characters(segment))
+				shape.broad = true;
+		}
+
+		if (!rooted)
+		{
+			std::vector<std::string_view> any_depth = {"**"};
+			any_depth.insert(any_depth.end(), segments.begin(), segments.end());
+			shape.alternatives.push_back(std::move(any_depth));
+			shape.broad = true;
+		}
+		shape.alternatives.push_back(std::move(segments));
+		return shape;
+	}
+
+	// Matches a literal name against a glob made only of '*' and '?'
+	bool simple_glob_match(std::string_view glob, std::string_view name)
+	{
+		size_t g = 0, n = 0;
+		size_t star = std::string_view::npos, resume = 0;
+		while (n < name.size())
+		{
+			if (g < glob.size() && (glob[g] == '?' || glob[g] == name[n]))
+			{
+				g++;
+				n++;
+			}
+			else if (g < glob.size() && glob[g] == '*')
+			{
+				star = g++;
+				resume = n;
+			}
+			else if (star != std::string_view::npos)
+			{
+				g = star + 1;
+				n = ++resume;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		while (g < glob.size() && glob[g] == '*')
+			g++;
+		return g == glob.size();
+	}
+
+	// True if every name matched by segment b is matched by segment a
+	bool segment_covers(std::string_view a, std::string_view b)
+	{
+		if (a == b)
+			return true;
+		if (has_glob_characters(b) || a.find_first_of("[{") != std::string_view::npos)
+			return false;
+		return simple_glob_match(a, b);
+	}
+
+	// True if every path matched by the segments b is matched by the segments a.
+	// In syncthing a "**" segment stands for one or more path components.
+	bool segments_cover(const std::vector<std::string_view>& a, size_t ai,
+						const std::vector<std::string_view>& b, size_t bi)
+	{
+		if (ai == a.size())
+			return bi == b.size();
+
+		if (a[ai] == "**")
+		{
+			for (size_t next = bi + 1; next <= b.size(); next++)
+			{
+				if (segments_cover(a, ai + 1, b, next))
+					return true;
+			}
+			return false;
+		}
+
+		if (bi == b.size() || b[bi] == "**")
+			return false;
+
+		return segment_covers(a[ai], b[bi]) && segments_cover(a, ai + 1, b, bi + 1);
+	}
+
+	bool pattern_covers(const PatternShape& a, const PatternShape& b)
+	{
+		return std::all_of(b.alternatives.begin(), b.alternatives.end(), [&a](const auto& b_alt) {
+			return std::any_of(a.alternatives.begin(), a.alternatives.end(),
+							   [&b_alt](const auto& a_alt) {
+								   return segments_cover(a_alt, 0, b_alt, 0);
+							   });
+		});
+	}
+
+	// True if the segment can be put inside an {a,b,c} alternation as is
+	bool can_alternate(std::string_view segment)
+	{
+		return !segment.empty() && segment != "**" &&
+			   segment.find_first_of("{},\\") == std::string_view::npos;
+	}
+
+	std::string join_segments(const std::vector<std::string_view>& segments)
+	{
+		std::string pattern;
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			if (i > 0)
+				pattern += '/';
+			pattern += segments[i];
+		}
+		return pattern;
+	}
+
+	// Merges the rules of a run having the same polarity, varying the segment at `position`.
+	// Merged rules take the place of the first rule of their group.
+	void compact_run(std::vector<std::string>& run, bool negation, size_t position,
+					 const CompactOptions& options)
+	{
+		struct Candidate
+		{
+			size_t index;
+			std::string_view segment;
+		};
+
+		const size_t prefix_size = negation ? 1 : 0;
+		std::vector<std::vector<std::string_view>> segments(run.size());
+		std::map<std::string, std::vector<Candidate>> groups;
+		for (size_t i = 0; i < run.size(); i++)
+		{
+			const std::string_view pattern = std::string_view(run[i]).substr(prefix_size);
+			if (pattern.starts_with("(?") || pattern.starts_with("//"))
+				continue;
+
+			segments[i] = split_segments(pattern);
+			if (position >= segments[i].size() || !can_alternate(segments[i][position]))
+				continue;
+
+			// The key is the pattern without the varying segment, the size makes it unambiguous
+			auto key_segments = segments[i];
+			key_segments[position] = {};
+			const std::string key = std::to_string(segments[i].size()) + ':' +
+									join_segments(key_segments);
+			groups[key].push_back({i, segments[i][position]});
+		}
+
+		std::vector<bool> dropped(run.size(), false);
+		std::vector<std::string> replacements(run.size());
+		for (const auto& [key, candidates] : groups)
+		{
+			if (candidates.size() < 2)
+				continue;
+
+			size_t chunk_start = 0;
+			while (chunk_start < candidates.size())
+			{
+				const size_t base_length = run[candidates[chunk_start].index].size() -
+										   candidates[chunk_start].segment.size() + 2;
+
+				std::vector<std::string_view> alternatives;
+				std::unordered_set<std::string_view> seen;
+				size_t length = base_length;
+				size_t chunk_end = chunk_start;
+				for (; chunk_end < candidates.size(); chunk_end++)
+				{
+					const std::string_view alternative = candidates[chunk_end].segment;
+					if (seen.contains(alternative))
+						continue;
+
+					const size_t new_length =
+						length + alternative.size() + (alternatives.empty() ? 0 : 1);
+					if (!alternatives.empty() && (alternatives.size() >= options.max_alternatives ||
+												  new_length > options.max_pattern_length))
+						break;
+
+					seen.insert(alternative);
+					alternatives.push_back(alternative);
+					length = new_length;
+				}
+
+				const size_t chunk_first = candidates[chunk_start].index;
+				if (alternatives.size() > 1)
+				{
+					std::string alternation = "{";
+					for (size_t i = 0; i < alternatives.size(); i++)
+					{
+						if (i > 0)
+							alternation += ',';
+						alternation += alternatives[i];
+					}
+					alternation += '}';
+
+					auto merged = segments[chunk_first];
+					merged[position] = alternation;
+					replacements[chunk_first] = (negation ? "!" : "") + join_segments(merged);
+				}
+				for (size_t i = chunk_start + 1; i < chunk_end; i++)
+					dropped[candidates[i].index] = true;
+
+				chunk_start = chunk_end;
+			}
+		}
+
+		std::vector<std::string> compacted;
+		compacted.reserve(run.size());
+		for (size_t i = 0; i < run.size(); i++)
+		{
+			if (dropped[i])
+				continue;
+			compacted.push_back(replacements[i].empty() ? std::move(run[i])
+														: std::move(replacements[i]));
+		}
+		run = std::move(compacted);
+	}
+} // namespace
+
+size_t minimize_rules(std::vector<std::string>& rules)
+{
+	const size_t count = rules.size();
+	std::vector<PatternShape> shapes;
+	shapes.reserve(count);
+
+	// negations_before[i] is the number of negated rules in [0, i)
+	std::vector<size_t> negations_before(count + 1, 0);
+	for (size_t i = 0; i < count; i++)
+	{
+		shapes.push_back(parse_shape(rules[i]));
+		negations_before[i + 1] = negations_before[i] + (shapes[i].negation ? 1 : 0);
+	}
+
+	// Only broad rules can cover something else than themselves, index them by their last
+	// segment so a rule is only compared against the ones that could possibly cover it.
+	std::unordered_map<std::string_view, std::vector<size_t>> broad_by_last_segment;
+	std::vector<size_t> broad_with_glob_tail;
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto& shape = shapes[i];
+		if (shape.opaque || !shape.broad)
+			continue;
+
+		const std::string_view last = shape.alternatives.front().back();
+		if (has_glob_characters(last))
+			broad_with_glob_tail.push_back(i);
+		else
+			broad_by_last_segment[last].push_back(i);
+	}
+
+	auto opposite_between = [&](size_t first, size_t last, bool negation) {
+		const size_t negations = negations_before[last] - negations_before[first + 1];
+		return negation ? negations != (last - first - 1) : negations != 0;
+	};
+
+	auto covered_by = [&](size_t i, size_t j) {
+		if (j == i || rules[j] == rules[i])
+			return false;
+
+		if (j < i)
+			return pattern_covers(shapes[j], shapes[i]);
+
+		// A later rule only takes over if nothing in between can change the outcome.
+		// Rules covering each other both ways are kept to not drop both of them.
+		return shapes[j].negation == shapes[i].negation &&
+			   !opposite_between(i, j, shapes[i].negation) &&
+			   pattern_covers(shapes[j], shapes[i]) && !pattern_covers(shapes[i], shapes[j]);
+	};
+
+	std::vector<bool> removed(count, false);
+	std::unordered_set<std::string_view> seen;
+	for (size_t i = 0; i < count; i++)
+	{
+		const auto& shape = shapes[i];
+		if (shape.opaque)
+			continue;
+
+		// The first occurrence of a rule always shadows the next ones
+		if (!seen.insert(rules[i]).second)
+		{
+			removed[i] = true;
+			continue;
+		}
+
+		const std::string_view last = shape.alternatives.front().back();
+		bool covered = std::any_of(broad_with_glob_tail.begin(), broad_with_glob_tail.end(),
+								   [&](size_t j) { return covered_by(i, j); });
+
+		if (!covered && !has_glob_characters(last))
+		{
+			const auto candidates = broad_by_last_segment.find(last);
+			if (candidates != broad_by_last_segment.end())
+			{
+				covered = std::any_of(candidates->second.begin(), candidates->second.end(),
+									  [&](size_t j) { return covered_by(i, j); });
+			}
+		}
+		removed[i] = covered;
+	}
+
+	std::vector<std::string> kept;
+	kept.reserve(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!removed[i])
+			kept.push_back(std::move(rules[i]));
+	}
+
+	const size_t removed_count = count - kept.size();
+	rules = std::move(kept);
+	return removed_count;
+}
+
+size_t compact_rules(std::vector<std::string>& rules, const CompactOptions& options)
+{
+	const size_t count = rules.size();
+	std::vector<std::string> compacted;
+	compacted.reserve(count);
+
+	// Within a run of consecutive rules of the same polarity, the order doesn't matter: whichever
+	// rule of the run matches first, the outcome is the same. Includes end a run as the polarity
+	// of what they bring is unknown.
+	size_t run_start = 0;
+	while (run_start < count)
+	{
+		const bool negation = rules[run_start].starts_with("!");
+		size_t run_end = run_start;
+		while (run_end < count && rules[run_end].starts_with("!") == negation &&
+			   !rules[run_end].starts_with("#"))
+		{
+			run_end++;
+		}
+		if (run_end == run_start)
+		{
+			compacted.push_back(std::move(rules[run_start++]));
+			continue;
+		}
+
+		std::vector<std::string> run(std::make_move_iterator(rules.begin() + run_start),
+									 std::make_move_iterator(rules.begin() + run_end));
+
+		size_t max_segments = 0;
+		for (const auto& rule : run)
+		{
+			const size_t segments = std::count(rule.begin(), rule.end(), '/') + 1;
+			max_segments = std::max(max_segments, segments);
+		}
+
+		// Vary the last segments first, that's where sibling names and extensions are
+		for (size_t position = max_segments; position-- > 0;)
+			compact_run(run, negation, position, options);
+
+		compacted.insert(compacted.end(), std::make_move_iterator(run.begin()),
+						 std::make_move_iterator(run.end()));
+		run_start = run_end;
+	}
+
+	rules = std::move(compacted);
+	return count - rules.size();
+}
@@ -0,0 +1,73 @@
+#ifndef STIGNORE_H
+#define STIGNORE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Set of rules keeping the insertion order.
+// The order of the rules matters (the first matching rule wins in syncthing, the last one in git),
+// duplicates are detected with a hash index.
+class OrderedRuleSet
+{
+	std::vector<std::string> rules;
+	// Hash of a rule to its position in rules
+	std::unordered_multimap<size_t, size_t> index;
+
+  public:
+	using const_iterator = std::vector<std::string>::const_iterator;
+
+	// Appends the rule if it isn't already there, returns true if it was inserted
+	bool insert(std::string rule);
+	// Appends the rule, dropping its earlier occurrence, for rules where the last duplicate counts
+	void append(std::string rule);
+	bool contains(std::string_view rule) const;
+	void clear();
+
+	size_t size() const
+	{
+		return rules.size();
+	}
+
+	bool empty() const
+	{
+		return rules.empty();
+	}
+
+	const_iterator begin() const
+	{
+		return rules.begin();
+	}
+
+	const_iterator end() const
+	{
+		return rules.end();
+	}
+};
+
+// Removes the rules of a .stignore rule set that can no longer decide anything.
+// Syncthing stops at the first rule matching a path, so a rule is dropped when a broader rule
+// comes before it, or when a broader rule of the same polarity comes after it without any rule of
+// the opposite polarity in between. Exact duplicates are dropped the same way.
+// Returns the number of removed rules.
+size_t minimize_rules(std::vector<std::string>& rules);
+
+// Limits the complexity of the patterns created by compact_rules
+struct CompactOptions
+{
+	// Maximum number of alternatives in a single {a,b,c} group
+	size_t max_alternatives = 16;
+	// Maximum length of a merged pattern
+	size_t max_pattern_length = 256;
+};
+
+// Merges the rules differing only by one path segment into a single {a,b,c} alternation,
+// e.g. /**/*.pyc and /**/*.pyo become /**/{*.pyc,*.pyo}.
+// Only consecutive rules of the same polarity are merged, so the first matching rule of a path
+// still has the same polarity in the compacted set.
+// Returns the number of rules saved.
+size_t compact_rules(std::vector<std::string>& rules, const CompactOptions& options = {});
+
+#endif
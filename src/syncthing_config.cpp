@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "syncthing_config.hpp"
+#include "utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	bool is_xml_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	void append_utf8(std::string& text, uint32_t code_point)
+	{
+		if (code_point < 0x80)
+		{
+			text += static_cast<char>(code_point);
+		}
+		else if (code_point < 0x800)
+		{
+			text += static_cast<char>(0xC0 | (code_point >> 6));
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x10000)
+		{
+			text += static_cast<char>(0xE0 | (code_point >> 12));
+			text += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+		else if (code_point < 0x110000)
+		{
+			text += static_cast<char>(0xF0 | (code_point >> 18));
+			text += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+			text += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			text += static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+	}
+
+	// End of the tag starting at pos, the '>' not counting inside quoted attribute values
+	size_t tag_end(std::string_view xml, size_t pos)
+	{
+		char quote = 0;
+		for (; pos < xml.size(); pos++)
+		{
+			const char c = xml[pos];
+			if (quote)
+			{
+				if (c == quote)
+					quote = 0;
+			}
+			else if (c == '"' || c == '\'')
+			{
+				quote = c;
+			}
+			else if (c == '>')
+			{
+				return pos;
+			}
+		}
+		return std::string_view::npos;
+	}
+
+	// Raw value of an attribute in the text of a start tag, after its name
+	std::optional<std::string_view> attribute(std::string_view attributes, std::string_view name)
+	{
+		size_t pos = 0;
+		while (pos < attributes.size())
+		{
+			while (pos < attributes.size() && is_xml_space(attributes[pos]))
+				pos++;
+			const size_t name_start = pos;
+			while (pos < attributes.size() && attributes[pos] != '=' &&
+				   !is_xml_space(attributes[pos]))
+				pos++;
+			const std::string_view attribute_name = attributes.substr(name_start, pos - name_start);
+			while (pos < attributes.size() && is_xml_space(attributes[pos]))
+				pos++;
+			if (pos >= attributes.size() || attributes[pos] != '=')
+				return std::nullopt;
+			pos++;
+			while (pos < attributes.size() && is_xml_space(attributes[pos]))
+				pos++;
+			if (pos >= attributes.size() || (attributes[pos] != '"' && attributes[pos] != '\''))
+				return std::nullopt;
+
+			const char quote = attributes[pos++];
+			const size_t value_end = attributes.find(quote, pos);
+			if (value_end == std::string_view::npos)
+				return std::nullopt;
+			if (attribute_name == name)
+				return attributes.substr(pos, value_end - pos);
+			pos = value_end + 1;
+		}
+		return std::nullopt;
+	}
+} // namespace
+
+std::string decode_xml_entities(std::string_view text)
+{
+	std::string decoded;
+	decoded.reserve(text.size());
+	size_t pos = 0;
+	while (pos < text.size())
+	{
+		const size_t amp = text.find('&', pos);
+		decoded.append(text.substr(pos, amp - pos));
+		if (amp == std::string_view::npos)
+			break;
+
+		const size_t semicolon = text.find(';', amp);
+		if (semicolon == std::string_view::npos)
+		{
+			decoded.append(text.substr(amp));
+			break;
+		}
+		const std::string_view entity = text.substr(amp + 1, semicolon - amp - 1);
+		if (entity == "amp")
+			decoded += '&';
+		else if (entity == "lt")
+			decoded += '<';
+		else if (entity == "gt")
+			decoded += '>';
+		else if (entity == "quot")
+			decoded += '"';
+		else if (entity == "apos")
+			decoded += '\'';
+		else if (entity.size() > 1 && entity[0] == '#')
+		{
+			const bool hex = entity[1] == 'x' || entity[1] == 'X';
+			const std::string digits(entity.substr(hex ? 2 : 1));
+			append_utf8(decoded, static_cast<uint32_t>(std::strtoul(digits.c_str(), nullptr,
+																	 hex ? 16 : 10)));
+		}
+		else
+			decoded.append(text.substr(amp, semicolon + 1 - amp));
+		pos = semicolon + 1;
+	}
+	return decoded;
+}
+
+std::optional<std::vector<fs::path>> syncthing_config_folders(std::string_view xml,
+															  const fs::path& home)
+{
+	std::vector<fs::path> folders;
+	// Depth of the elements open at pos, the root element being at depth 1
+	size_t depth = 0;
+	size_t pos = 0;
+	while ((pos = xml.find('<', pos)) != std::string_view::npos)
+	{
+		const std::string_view rest = xml.substr(pos);
+		size_t end;
+		if (rest.starts_with("<!--"))
+			end = xml.find("-->", pos);
+		else if (rest.starts_with("<![CDATA["))
+			end = xml.find("]]>", pos);
+		else if (rest.starts_with("<?"))
+			end = xml.find("?>", pos);
+		else
+			end = tag_end(xml, pos);
+		if (end == std::string_view::npos)
+			return std::nullopt;
+
+		const std::string_view tag = xml.substr(pos + 1, end - pos - 1);
+		pos = end + 1;
+		if (tag.starts_with('!') || tag.starts_with('?'))
+			continue;
+
+		if (tag.starts_with('/'))
+		{
+			if (!depth)
+				return std::nullopt;
+			// The document is complete once the root element is closed
+			if (--depth == 0)
+				return folders;
+			continue;
+		}
+
+		const bool self_closing = tag.ends_with('/');
+		size_t name_end = 0;
+		while (name_end < tag.size() && !is_xml_space(tag[name_end]) && tag[name_end] != '/')
+			name_end++;
+		if (depth == 1 && tag.substr(0, name_end) == "folder")
+		{
+			if (const auto path = attribute(tag.substr(name_end), "path"))
+			{
+				const std::string folder = decode_xml_entities(*path);
+				if (folder == "~" || folder.starts_with("~/") || folder.starts_with("~\\"))
+				{
+					const size_t prefix = std::min<size_t>(folder.size(), 2);
+					folders.push_back(home / fs::path(folder.substr(prefix)));
+				}
+				else if (!folder.empty())
+				{
+					folders.push_back(fs::path(folder));
+				}
+			}
+		}
+
+		if (!self_closing)
+		{
+			depth++;
+		}
+		else if (!depth)
+		{
+			// A self-closing root element
+			return folders;
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<std::vector<fs::path>> read_syncthing_config_folders(const fs::path& config_path)
+{
+	std::error_code ec;
+	if (!fs::is_regular_file(config_path, ec))
+		return std::nullopt;
+	const MappedFile content(config_path);
+	return syncthing_config_folders(content.view(), home_directory().value_or(fs::path()));
+}
+
+std::optional<fs::path> find_syncthing_config()
+{
+	std::vector<fs::path> candidates;
+	if (auto config_dir = environment_path("STCONFDIR"))
+		candidates.push_back(*config_dir / "config.xml");
+	if (auto home_dir = environment_path("STHOMEDIR"))
+		candidates.push_back(*home_dir / "config.xml");
+
+	const std::optional<fs::path> home = home_directory();
+#if defined(TB_CONFIG_OS_WINDOWS)
+	if (auto local_app_data = environment_path("LOCALAPPDATA"))
+		candidates.push_back(*local_app_data / "Syncthing" / "config.xml");
+#elif defined(TB_CONFIG_OS_MACOSX)
+	if (home)
+		candidates.push_back(*home / "Library" / "Application Support" / "Syncthing" /
+							 "config.xml");
+#else
+	// The state directory since Syncthing 1.27, the config directory before
+	if (auto state_home = environment_path("XDG_STATE_HOME"))
+		candidates.push_back(*state_home / "syncthing" / "config.xml");
+	else if (home)
+		candidates.push_back(*home / ".local" / "state" / "syncthing" / "config.xml");
+	if (auto config_home = environment_path("XDG_CONFIG_HOME"))
+		candidates.push_back(*config_home / "syncthing" / "config.xml");
+	else if (home)
+		candidates.push_back(*home / ".config" / "syncthing" / "config.xml");
+#endif
+
+	for (const auto& candidate : candidates)
+	{
+		std::error_code ec;
+		if (fs::is_regular_file(candidate, ec))
+			return normalize_path(candidate);
+	}
+	return std::nullopt;
+}
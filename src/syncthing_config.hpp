@@ -0,0 +1,29 @@
+#ifndef SYNCTHING_CONFIG_H
+#define SYNCTHING_CONFIG_H
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Paths of the folders configured in the content of a Syncthing config.xml, a leading '~' being
+// the home directory as in Syncthing. The content is scanned once as a stream of tags without
+// building a document, only the path attribute of the <folder> elements directly below the root
+// is read, so the folder template of <defaults> is skipped. Nothing if the document is
+// incomplete, as when Syncthing is writing it.
+std::optional<std::vector<std::filesystem::path>> syncthing_config_folders(
+	std::string_view xml, const std::filesystem::path& home);
+
+// Same with the config file, nothing if it can't be read
+std::optional<std::vector<std::filesystem::path>> read_syncthing_config_folders(
+	const std::filesystem::path& config_path);
+
+// Text of an attribute value with the XML entities resolved
+std::string decode_xml_entities(std::string_view text);
+
+// config.xml of the local Syncthing: the one of $STCONFDIR or $STHOMEDIR, or the default
+// location of the platform. Nothing if none exists.
+std::optional<std::filesystem::path> find_syncthing_config();
+
+#endif
@@ -2,13 +2,35 @@
 #include <fstream>
 #include <filesystem>
 #include <random>
+#include <set>
 #include <vector>
 #include <string>
+#include <thread>
 
 #include <doctest/doctest.h>
 
+#include "aho_corasick.hpp"
+#include "directory_cache.hpp"
+#include "folder_list.hpp"
+#include "gitignore_lexer.hpp"
+#include "gitignore_stack.hpp"
 #include "gitignore_parser.hpp"
+#include "ignore_sources.hpp"
+#include "matcher_cache.hpp"
+#include "matcher_registry.hpp"
+#include "metrics.hpp"
+#include "path_table.hpp"
+#include "rule_matcher.hpp"
+#include "scan_records.hpp"
+#include "scan_throttle.hpp"
+#include "simd_scan.hpp"
+#include "snapshot.hpp"
+#include "state_file.hpp"
+#include "syncthing_config.hpp"
+#include "trace.hpp"
+#include "stignore.hpp"
 #include "utils.hpp"
+#include "worker_pool.hpp"
 
 // Tests coming from the python package gitignore_parser: https://github.com/mherrmann/gitignore_parser
 
@@ -423,4 +445,1700 @@ TEST_SUITE("path function helper") {
         CHECK(normalize_path("C:/home/a2va") == "/C/home/a2va");
     #endif
     }
-}
\ No newline at end of file
+}
+
+TEST_SUITE("mapped file") {
+    TEST_CASE("a read file doesn't change with the file") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / ".gitignore";
+        std::ofstream(path) << "*.log\nbuild/\n";
+
+        const MappedFile read(path);
+        const MappedFile mapped(path, FileAccess::mapped);
+        REQUIRE(read.is_open());
+        CHECK(mapped.view() == read.view());
+
+        // Truncated in place, as editors do
+        std::ofstream(path, std::ios::trunc) << "*.o\n";
+        CHECK(read.view() == "*.log\nbuild/\n");
+        CHECK_FALSE(MappedFile(temp_dir.get_path() / "missing").is_open());
+    }
+}
+
+TEST_SUITE("stignore rules minimization") {
+    TEST_CASE("nested rules covered by a root rule") {
+        std::vector<std::string> rules = {
+            "/node_modules",
+            "/**/node_modules",
+            "sub/node_modules",
+            "sub/**/node_modules",
+            "/sub/deep/node_modules",
+        };
+        CHECK(minimize_rules(rules) == 3);
+        CHECK(rules == std::vector<std::string>{"/node_modules", "/**/node_modules"});
+    }
+
+    TEST_CASE("root rule doesn't cover itself at depth") {
+        std::vector<std::string> rules = {"/**/node_modules", "/node_modules"};
+        CHECK(minimize_rules(rules) == 0);
+        CHECK(rules.size() == 2);
+    }
+
+    TEST_CASE("glob covers literal names") {
+        std::vector<std::string> rules = {"/**/*.pyc", "sub/**/main.pyc", "/sub/main.pyo"};
+        CHECK(minimize_rules(rules) == 1);
+        CHECK(rules == std::vector<std::string>{"/**/*.pyc", "/sub/main.pyo"});
+    }
+
+    TEST_CASE("duplicates") {
+        std::vector<std::string> rules = {"/build", "/dist", "/build"};
+        CHECK(minimize_rules(rules) == 1);
+        CHECK(rules == std::vector<std::string>{"/build", "/dist"});
+    }
+
+    TEST_CASE("negation order is preserved") {
+        std::vector<std::string> rules = {
+            "!/keep/**/*.log",
+            "/keep/**/debug.log",
+            "/**/*.log",
+            "!/sub/**/*.log",
+            "/sub/**/*.log",
+        };
+        // debug.log is never reached after the negation, and both sub rules come after /**/*.log
+        CHECK(minimize_rules(rules) == 3);
+        CHECK(rules == std::vector<std::string>{"!/keep/**/*.log", "/**/*.log"});
+    }
+
+    TEST_CASE("later broader rule behind a negation") {
+        std::vector<std::string> rules = {"/sub/**/tmp", "!/sub/a/*", "/**/tmp"};
+        CHECK(minimize_rules(rules) == 0);
+
+        rules = {"/sub/**/tmp", "/other", "/**/tmp"};
+        CHECK(minimize_rules(rules) == 1);
+        CHECK(rules == std::vector<std::string>{"/other", "/**/tmp"});
+    }
+
+    TEST_CASE("opaque rules are kept") {
+        std::vector<std::string> rules = {"/**/*", "(?i)/Thumbs.db", "#include more", "/a\\*b"};
+        CHECK(minimize_rules(rules) == 0);
+    }
+}
+
+TEST_SUITE("stignore rules compaction") {
+    TEST_CASE("sibling extensions") {
+        std::vector<std::string> rules = {"/**/*.pyc", "/**/*.pyo", "/**/*.pyd", "/build"};
+        CHECK(compact_rules(rules) == 2);
+        CHECK(rules == std::vector<std::string>{"/**/{*.pyc,*.pyo,*.pyd}", "/build"});
+    }
+
+    TEST_CASE("sibling directories") {
+        std::vector<std::string> rules = {"sub/a/out", "sub/b/out", "/sub/a/out"};
+        CHECK(compact_rules(rules) == 1);
+        CHECK(rules == std::vector<std::string>{"sub/{a,b}/out", "/sub/a/out"});
+    }
+
+    TEST_CASE("negations split the runs") {
+        std::vector<std::string> rules = {"/a.log", "!/keep.log", "/b.log", "!/keep2.log", "!/keep3.log"};
+        CHECK(compact_rules(rules) == 1);
+        CHECK(rules == std::vector<std::string>{"/a.log", "!/keep.log", "/b.log", "!/{keep2.log,keep3.log}"});
+    }
+
+    TEST_CASE("complexity limits") {
+        std::vector<std::string> rules = {"/a", "/b", "/c", "/d", "/e"};
+        CHECK(compact_rules(rules, {.max_alternatives = 2, .max_pattern_length = 256}) == 2);
+        CHECK(rules == std::vector<std::string>{"/{a,b}", "/{c,d}", "/e"});
+
+        rules = {"/aaaa", "/bbbb", "/cccc"};
+        CHECK(compact_rules(rules, {.max_alternatives = 16, .max_pattern_length = 12}) == 1);
+        CHECK(rules == std::vector<std::string>{"/{aaaa,bbbb}", "/cccc"});
+    }
+
+    TEST_CASE("double asterisks and flags are not merged") {
+        std::vector<std::string> rules = {"/a/**", "/a/b", "(?i)/x", "(?i)/y"};
+        CHECK(compact_rules(rules) == 0);
+    }
+}
+
+TEST_SUITE("ordered rule set") {
+    TEST_CASE("keeps insertion order") {
+        OrderedRuleSet rules;
+        CHECK(rules.insert("/*.log"));
+        CHECK(rules.insert("!/keep.log"));
+        CHECK(rules.insert("/build"));
+        CHECK(std::vector<std::string>(rules.begin(), rules.end()) ==
+              std::vector<std::string>{"/*.log", "!/keep.log", "/build"});
+    }
+
+    TEST_CASE("appending keeps the last duplicate") {
+        // As in a gitignore file with *.log, !keep.log and *.log, where keep.log stays ignored
+        OrderedRuleSet rules;
+        for (const char* rule : {"/*.log", "/**/*.log", "!/keep.log", "!/**/keep.log", "/*.log", "/**/*.log"})
+            rules.append(rule);
+        CHECK(std::vector<std::string>(rules.begin(), rules.end()) ==
+              std::vector<std::string>{"!/keep.log", "!/**/keep.log", "/*.log", "/**/*.log"});
+        CHECK(rules.contains("/*.log"));
+        CHECK_FALSE(rules.insert("!/keep.log"));
+        CHECK(rules.size() == 4);
+    }
+
+    TEST_CASE("deduplicates") {
+        OrderedRuleSet rules;
+        CHECK(rules.insert("/build"));
+        CHECK(rules.insert("/dist"));
+        CHECK_FALSE(rules.insert("/build"));
+        CHECK(rules.size() == 2);
+        CHECK(rules.contains("/dist"));
+        CHECK_FALSE(rules.contains("/out"));
+
+        OrderedRuleSet copy = rules;
+        rules.clear();
+        CHECK(rules.empty());
+        CHECK(copy.contains("/build"));
+        CHECK_FALSE(copy.insert("/dist"));
+    }
+}
+
+TEST_SUITE("matcher cache") {
+    TEST_CASE("rules survive a round trip") {
+        TemporaryDirectory temp_dir;
+        fs::path gitignore_path = temp_dir.get_path() / ".gitignore";
+        {
+            std::ofstream file(gitignore_path);
+            file << "__pycache__/\n";
+            file << "*.py[cod]\n";
+            file << "!keep.pyc";
+        }
+        const fs::path cache_path = temp_dir.get_path() / "synctignore.cache";
+        {
+            MatcherCache cache(cache_path);
+            GitIgnoreMatcher matcher(cache.rules(gitignore_path, "/home/a2va"));
+            CHECK(matcher.is_ignored("/home/a2va/main.pyc"));
+            cache.save();
+        }
+        REQUIRE(fs::exists(cache_path));
+
+        // Same content somewhere else, found by hash
+        fs::path other_path = temp_dir.get_path() / "other.gitignore";
+        fs::copy_file(gitignore_path, other_path);
+
+        MatcherCache cache(cache_path);
+        const auto rules = cache.rules(other_path, "/home/a2va");
+        REQUIRE(rules.size() == 3);
+        CHECK(rules.negation(2));
+        CHECK(rules.line(2) == 3);
+        CHECK(rules.source(2) == other_path);
+
+        GitIgnoreMatcher matcher(rules);
+        CHECK(matcher.is_ignored("/home/a2va/__pycache__"));
+        CHECK(matcher.is_ignored("/home/a2va/dir/main.pyc"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/keep.pyc"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/main.py"));
+    }
+
+    TEST_CASE("a cache hit doesn't parse the content") {
+        TemporaryDirectory temp_dir;
+        fs::path gitignore_path = temp_dir.get_path() / ".gitignore";
+        {
+            std::ofstream file(gitignore_path);
+            file << "build/\n*.log\n/docs/**/*.tmp\n!important.log\n";
+        }
+        const fs::path cache_path = temp_dir.get_path() / "synctignore.cache";
+        {
+            MatcherCache cache(cache_path);
+            cache.rules(gitignore_path, "/home/a2va");
+            cache.save();
+        }
+
+        MatcherCache cache(cache_path);
+        GitIgnoreMatcher matcher(cache.rules(gitignore_path, "/home/a2va"));
+        // Built from the definitions in the file, the content isn't parsed again
+        CHECK(cache.parsed_count() == 0);
+        CHECK(matcher.is_ignored("/home/a2va/src/build/out.o"));
+        CHECK(matcher.is_ignored("/home/a2va/debug.log"));
+        CHECK(matcher.is_ignored("/home/a2va/docs/a/b/c.tmp"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/important.log"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/src/docs/c.tmp"));
+    }
+
+    TEST_CASE("saving keeps the entries not used") {
+        TemporaryDirectory temp_dir;
+        const fs::path cache_path = temp_dir.get_path() / "synctignore.cache";
+        {
+            MatcherCache cache(cache_path);
+            cache.rules_from_content("/home/a2va/.gitignore", "*.log\n");
+            cache.rules_from_content("/home/a2va/sub/.gitignore", "build/\n");
+            cache.save();
+        }
+        {
+            // Another run parsing a new content only
+            MatcherCache cache(cache_path);
+            cache.rules_from_content("/home/other/.gitignore", "*.tmp\n");
+            cache.save();
+        }
+
+        MatcherCache cache(cache_path);
+        cache.rules_from_content("/home/a2va/.gitignore", "*.log\n");
+        cache.rules_from_content("/home/a2va/sub/.gitignore", "build/\n");
+        const auto rules = cache.rules_from_content("/home/other/.gitignore", "*.tmp\n");
+        CHECK(cache.parsed_count() == 0);
+        REQUIRE(rules.size() == 1);
+        CHECK(rules.pattern(0) == "*.tmp");
+    }
+
+    TEST_CASE("invalid cache file is ignored") {
+        TemporaryDirectory temp_dir;
+        fs::path gitignore_path = temp_dir.get_path() / ".gitignore";
+        {
+            std::ofstream file(gitignore_path);
+            file << "*.log";
+        }
+        const fs::path cache_path = temp_dir.get_path() / "synctignore.cache";
+        {
+            std::ofstream file(cache_path);
+            file << "SIGC garbage";
+        }
+        MatcherCache cache(cache_path);
+        GitIgnoreMatcher matcher(cache.rules(gitignore_path, "/home/a2va"));
+        CHECK(matcher.is_ignored("/home/a2va/debug.log"));
+    }
+}
+
+TEST_SUITE("state file") {
+    State make_state() {
+        State state;
+        state.autostart = true;
+        state.max_alternatives = 4;
+        state.user_rules.insert("/private");
+        GitIgnoreFile root;
+        root.mtime = fs::file_time_type(fs::file_time_type::duration(1234));
+        root.st_rules.insert("/*.log");
+        root.st_rules.insert("!/keep.log");
+        state.gitignore_files.emplace(path_table().intern("/home/a2va/.gitignore"), root);
+        GitIgnoreFile sub;
+        sub.st_rules.insert("sub/build");
+        state.gitignore_files.emplace(path_table().intern("/home/a2va/sub/.gitignore"), sub);
+        return state;
+    }
+
+    TEST_CASE("round trip") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        StateFile(path).save(make_state());
+
+        State loaded;
+        REQUIRE(StateFile(path).load(loaded));
+        CHECK(loaded.autostart);
+        CHECK(loaded.max_alternatives == 4);
+        CHECK(loaded.user_rules.contains("/private"));
+        REQUIRE(loaded.gitignore_files.size() == 2);
+        const auto& root = loaded.gitignore_files.at(path_table().intern("/home/a2va/.gitignore"));
+        CHECK(root.mtime.time_since_epoch().count() == 1234);
+        CHECK(std::vector<std::string>(root.st_rules.begin(), root.st_rules.end()) ==
+              std::vector<std::string>{"/*.log", "!/keep.log"});
+    }
+
+    TEST_CASE("only changed records are appended") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        State state = make_state();
+        StateFile file(path);
+        REQUIRE(file.save(state));
+        const auto initial_size = fs::file_size(path);
+
+        const PathId root = path_table().intern("/home/a2va/.gitignore");
+        const PathId sub = path_table().intern("/home/a2va/sub/.gitignore");
+        REQUIRE(file.append({StateFile::settings_record(state),
+                             StateFile::file_record(root, state.gitignore_files.at(root))}));
+        CHECK(fs::file_size(path) == initial_size);
+
+        state.gitignore_files.at(sub).st_rules.insert("sub/dist");
+        REQUIRE(file.append({StateFile::file_record(sub, state.gitignore_files.at(sub)),
+                             StateFile::removed_file_record(root)}));
+        CHECK(fs::file_size(path) > initial_size);
+        CHECK(fs::file_size(path) < 2 * initial_size);
+
+        State loaded;
+        REQUIRE(StateFile(path).load(loaded));
+        REQUIRE(loaded.gitignore_files.size() == 1);
+        CHECK(loaded.gitignore_files.begin()->second.st_rules.contains("sub/dist"));
+    }
+
+    TEST_CASE("torn record at the end is dropped") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        StateFile(path).save(make_state());
+        {
+            std::ofstream ofs(path, std::ios::binary | std::ios::app);
+            ofs << "\x40\x00\x00\x00partial";
+        }
+
+        State loaded;
+        StateFile file(path);
+        REQUIRE(file.load(loaded));
+        CHECK(loaded.gitignore_files.size() == 2);
+
+        // The next save rewrites the file without the torn record
+        loaded.user_rules.insert("/other");
+        REQUIRE(file.append({StateFile::user_rules_record(loaded.user_rules)}));
+        State reloaded;
+        REQUIRE(StateFile(path).load(reloaded));
+        CHECK(reloaded.user_rules.contains("/other"));
+        CHECK(reloaded.gitignore_files.size() == 2);
+    }
+
+    TEST_CASE("a log made of stale records is rewritten with the live ones") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        const State state = make_state();
+        StateFile file(path);
+        REQUIRE(file.save(state));
+        const auto initial_size = fs::file_size(path);
+
+        OrderedRuleSet user_rules;
+        for (int i = 0; i < 200; i++) {
+            user_rules.clear();
+            user_rules.insert("/" + std::string(1000, 'a') + std::to_string(i));
+            REQUIRE(file.append({StateFile::user_rules_record(user_rules)}));
+        }
+        CHECK(fs::file_size(path) < initial_size + 80 * 1024);
+
+        State loaded;
+        REQUIRE(StateFile(path).load(loaded));
+        CHECK(loaded.user_rules.size() == 1);
+        CHECK(loaded.user_rules.contains(*user_rules.begin()));
+        CHECK(loaded.gitignore_files.size() == 2);
+        CHECK(loaded.max_alternatives == 4);
+    }
+
+    TEST_CASE("missing or foreign file") {
+        TemporaryDirectory temp_dir;
+        State state;
+        CHECK_FALSE(StateFile(temp_dir.get_path() / "missing.state").load(state));
+
+        const fs::path path = temp_dir.get_path() / "synctignore.json";
+        {
+            std::ofstream ofs(path);
+            ofs << "{}";
+        }
+        CHECK_FALSE(StateFile(path).load(state));
+    }
+}
+
+TEST_SUITE("state writer") {
+    TEST_CASE("changes are saved after the delay") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        StateFile file(path);
+        StateWriter writer(file, std::chrono::milliseconds(10), std::chrono::milliseconds(100));
+
+        GitIgnoreFile gitignore_file;
+        gitignore_file.st_rules.insert("/build");
+        writer.update_file(path_table().intern("/home/a2va/.gitignore"), gitignore_file);
+
+        State loaded;
+        for (int i = 0; i < 200 && !StateFile(path).load(loaded); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(loaded.gitignore_files.size() == 1);
+        CHECK(loaded.gitignore_files.begin()->second.st_rules.contains("/build"));
+    }
+
+    TEST_CASE("stop flushes pending changes") {
+        TemporaryDirectory temp_dir;
+        const fs::path path = temp_dir.get_path() / "synctignore.state";
+        StateFile file(path);
+        State state;
+        state.gitignore_files.emplace(path_table().intern("/home/a2va/.gitignore"), GitIgnoreFile{});
+        state.gitignore_files.emplace(path_table().intern("/home/a2va/sub/.gitignore"), GitIgnoreFile{});
+        {
+            StateWriter writer(file, std::chrono::hours(1), std::chrono::hours(1));
+            writer.replace(state);
+            writer.remove_file(path_table().intern("/home/a2va/sub/.gitignore"));
+            OrderedRuleSet user_rules;
+            user_rules.insert("/private");
+            writer.update_user_rules(user_rules);
+            CHECK_FALSE(fs::exists(path));
+        }
+
+        State loaded;
+        REQUIRE(StateFile(path).load(loaded));
+        CHECK(loaded.gitignore_files.size() == 1);
+        CHECK(loaded.user_rules.contains("/private"));
+    }
+
+    TEST_CASE("changes that failed to be saved are saved again") {
+        TemporaryDirectory temp_dir;
+        // The directory of the file is missing, so the first save fails
+        const fs::path path = temp_dir.get_path() / "missing" / "synctignore.state";
+        StateFile file(path);
+        {
+            StateWriter writer(file, std::chrono::hours(1), std::chrono::hours(1));
+            GitIgnoreFile gitignore_file;
+            gitignore_file.st_rules.insert("/build");
+            writer.update_file(path_table().intern("/home/a2va/.gitignore"), gitignore_file);
+            writer.flush();
+            CHECK_FALSE(fs::exists(path));
+            fs::create_directories(path.parent_path());
+        }
+
+        State loaded;
+        REQUIRE(StateFile(path).load(loaded));
+        REQUIRE(loaded.gitignore_files.size() == 1);
+        CHECK(loaded.gitignore_files.begin()->second.st_rules.contains("/build"));
+    }
+}
+
+TEST_SUITE("gitignore lexer") {
+    std::vector<GlobTokenKind> kinds(const LexedPattern& pattern) {
+        std::vector<GlobTokenKind> result;
+        for (const auto& token : pattern.tokens)
+            result.push_back(token.kind);
+        return result;
+    }
+
+    TEST_CASE("tokens and flags") {
+        const auto pattern = lex_gitignore_pattern("!/src/**/*.py[co]/");
+        REQUIRE(pattern);
+        CHECK(pattern->negation);
+        CHECK(pattern->anchored);
+        CHECK(pattern->directory_only);
+        using enum GlobTokenKind;
+        CHECK(kinds(*pattern) ==
+              std::vector<GlobTokenKind>{literal, separator, double_star, separator, star,
+                                         literal, char_class});
+        CHECK(pattern->tokens[0].text == "src");
+        CHECK(pattern->tokens[0].column == 2);
+        CHECK(pattern->tokens[6].text == "co");
+
+        const auto any_depth = lex_gitignore_pattern("**/build");
+        REQUIRE(any_depth);
+        CHECK_FALSE(any_depth->anchored);
+        CHECK(kinds(*any_depth) == std::vector<GlobTokenKind>{literal});
+    }
+
+    TEST_CASE("multi-asterisks inside a segment are single asterisks") {
+        using enum GlobTokenKind;
+        CHECK(kinds(*lex_gitignore_pattern("a**b")) ==
+              std::vector<GlobTokenKind>{literal, star, literal});
+        CHECK(kinds(*lex_gitignore_pattern("a/***/b")) ==
+              std::vector<GlobTokenKind>{literal, separator, double_star, separator, literal});
+    }
+
+    TEST_CASE("double asterisks alone match everything") {
+        using enum GlobTokenKind;
+        const auto everything = lex_gitignore_pattern("**");
+        REQUIRE(everything);
+        CHECK_FALSE(everything->anchored);
+        CHECK_FALSE(everything->directory_only);
+        CHECK(kinds(*everything) == std::vector<GlobTokenKind>{double_star});
+
+        const auto directories = lex_gitignore_pattern("**/");
+        REQUIRE(directories);
+        CHECK_FALSE(directories->anchored);
+        CHECK(directories->directory_only);
+        CHECK(kinds(*directories) == std::vector<GlobTokenKind>{double_star});
+
+        GitIgnoreMatcher matcher(parse_gitignore_content("**\n", "/home/a2va"));
+        CHECK(matcher.is_ignored("/home/a2va/a.txt"));
+        CHECK(matcher.is_ignored("/home/a2va/a/b/c.txt"));
+        CHECK_FALSE(matcher.is_ignored("/home/other/a.txt"));
+
+        GitIgnoreMatcher directory_matcher(parse_gitignore_content("**/\n", "/home/a2va"));
+        CHECK(directory_matcher.is_ignored("/home/a2va/a/b/c.txt"));
+    }
+
+    TEST_CASE("escapes and trailing spaces") {
+        using enum GlobTokenKind;
+        const auto escaped = lex_gitignore_pattern("\\#\\*.txt");
+        REQUIRE(escaped);
+        CHECK(kinds(*escaped) == std::vector<GlobTokenKind>{literal, literal, literal});
+        CHECK(escaped->tokens[1].text == "*");
+
+        CHECK(lex_gitignore_pattern("name  ")->tokens.back().text == "name");
+        const auto kept = lex_gitignore_pattern("name\\  ");
+        REQUIRE(kept);
+        CHECK(kept->tokens.back().text == " ");
+
+        CHECK(kinds(*lex_gitignore_pattern("a[b")) ==
+              std::vector<GlobTokenKind>{literal, literal, literal});
+    }
+
+    TEST_CASE("lines without pattern") {
+        CHECK_FALSE(lex_gitignore_pattern(""));
+        CHECK_FALSE(lex_gitignore_pattern("# comment"));
+        CHECK_FALSE(lex_gitignore_pattern("/"));
+        CHECK_FALSE(lex_gitignore_pattern("   "));
+
+        std::optional<LexError> error;
+        CHECK_FALSE(lex_gitignore_pattern("dir\\", &error));
+        REQUIRE(error);
+        CHECK(error->column == 3);
+
+        std::vector<ParseError> errors;
+        const auto definitions = definitions_from_content("*.log\nbad\\\n*.tmp\n", &errors);
+        CHECK(definitions.size() == 2);
+        REQUIRE(errors.size() == 1);
+        CHECK(errors[0].line == 2);
+        CHECK(errors[0].column == 3);
+    }
+
+    TEST_CASE("escaped glob characters match literally") {
+        GitIgnoreMatcher matcher(parse_gitignore_content("\\*.txt\nfile\\?\n", "/home/a2va"));
+        CHECK(matcher.is_ignored("/home/a2va/*.txt"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/a.txt"));
+        CHECK(matcher.is_ignored("/home/a2va/file?"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/file1"));
+    }
+}
+
+TEST_SUITE("parsing from memory") {
+    TEST_CASE("lines are split without their terminator") {
+        std::vector<std::string> lines;
+        for_each_line("a\r\n\nb\nc", [&](std::string_view line) { lines.emplace_back(line); });
+        CHECK(lines == std::vector<std::string>{"a", "", "b", "c"});
+
+        lines.clear();
+        for_each_line("", [&](std::string_view line) { lines.emplace_back(line); });
+        CHECK(lines.empty());
+    }
+
+    TEST_CASE("rules without a file") {
+        const auto definitions = definitions_from_content("# comment\r\n*.log\r\n\n!keep.log\r\n");
+        REQUIRE(definitions.size() == 2);
+        CHECK(definitions[0].pattern == "*.log");
+        CHECK(definitions[0].line == 2);
+        CHECK(definitions[1].line == 4);
+
+        GitIgnoreMatcher matcher(parse_gitignore_content("*.log\n!keep.log\nbuild/\n", "/home/a2va"));
+        CHECK(matcher.is_ignored("/home/a2va/debug.log"));
+        CHECK(matcher.is_ignored("/home/a2va/build/"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/keep.log"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/main.cpp"));
+    }
+}
+
+TEST_SUITE("rule set") {
+    TEST_CASE("rules of several files share their storage") {
+        TemporaryDirectory temp_dir;
+        fs::create_directories(temp_dir.get_path() / "sub");
+        fs::path root_path = temp_dir.get_path() / ".gitignore";
+        fs::path sub_path = temp_dir.get_path() / "sub" / ".gitignore";
+        {
+            std::ofstream file(root_path);
+            file << "*.log\nbuild/\n";
+        }
+        {
+            std::ofstream file(sub_path);
+            file << "# comment\n!keep.log\n";
+        }
+
+        RuleSet rules;
+        rules.append(parse_gitignore_definitions(root_path), root_path, temp_dir.get_path());
+        rules.append(parse_gitignore_definitions(sub_path), sub_path, temp_dir.get_path() / "sub");
+        REQUIRE(rules.size() == 3);
+        CHECK(rules.pattern(0) == "*.log");
+        CHECK(rules.pattern(1) == "build/");
+        CHECK(rules.pattern(2) == "!keep.log");
+        CHECK(rules.directory_only(1));
+        CHECK(rules.negation(2));
+        CHECK(rules.has_negations());
+        CHECK(rules.source(0) == root_path);
+        CHECK(rules.source(2) == sub_path);
+        CHECK(rules.line(2) == 2);
+        CHECK(rules.base_path(2) == normalize_path(temp_dir.get_path() / "sub"));
+
+        CHECK(rules.is_ignored(temp_dir.get_path() / "debug.log"));
+        CHECK(rules.is_ignored(temp_dir.get_path() / "sub" / "debug.log"));
+        CHECK_FALSE(rules.is_ignored(temp_dir.get_path() / "sub" / "keep.log"));
+        CHECK(rules.is_ignored(temp_dir.get_path() / "keep.log"));
+        CHECK(rules.match(0, temp_dir.get_path() / "a.log"));
+        CHECK_FALSE(rules.match(2, temp_dir.get_path() / "keep.log"));
+    }
+}
+
+TEST_SUITE("lazy rule compilation") {
+    TEST_CASE("regexes are compiled when a rule may match") {
+        RuleSet rules = parse_gitignore_content("*.log\n*.tmp\nbuild/\n/docs/*.md\n[ab]*\n", "/home/a2va");
+        CHECK(rules.compiled_count() == 0);
+        CHECK(rules.literal(0) == ".log");
+        CHECK(rules.literal(2) == "build");
+        CHECK(rules.literal(3) == ".md");
+        CHECK(rules.literal(4).empty());
+
+        CHECK(rules.is_ignored("/home/a2va/debug.log"));
+        // *.log is a suffix test, it has no regex to compile
+        CHECK(rules.compiled_count() == 0);
+
+        CHECK_FALSE(rules.is_ignored("/home/a2va/main.cpp"));
+        // Only [ab]* needs its regex, and has no literal to rule the path out
+        CHECK(rules.compiled_count() == 1);
+
+        CHECK(rules.is_ignored("/home/a2va/build/"));
+        CHECK(rules.is_ignored("/home/a2va/build/output.o"));
+        CHECK(rules.is_ignored("/home/a2va/docs/readme.md"));
+        CHECK_FALSE(rules.is_ignored("/home/a2va/src/readme.md"));
+
+        // Copies compile their own regexes
+        const RuleSet copy = rules;
+        CHECK(copy.compiled_count() == 0);
+        CHECK(copy.is_ignored("/home/a2va/debug.log"));
+    }
+
+    TEST_CASE("an invalid regex never matches") {
+        GitIgnoreMatcher matcher(parse_gitignore_content("[/]\n*.log\n", "/home/a2va"));
+        CHECK(matcher.is_ignored("/home/a2va/debug.log"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/a"));
+    }
+
+    TEST_CASE("rules are compiled once from concurrent queries") {
+        std::string content;
+        for (int i = 0; i < 200; ++i)
+            content += "dir" + std::to_string(i) + "/*.o\n";
+        const GitIgnoreMatcher matcher(parse_gitignore_content(content, "/home/a2va"));
+
+        std::vector<std::thread> threads;
+        std::atomic<int> ignored = 0;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 200; ++i) {
+                    if (matcher.is_ignored("/home/a2va/dir" + std::to_string(i) + "/a.o"))
+                        ignored++;
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        CHECK(ignored.load() == 800);
+    }
+}
+
+TEST_SUITE("literal prefilter") {
+    TEST_CASE("every occurrence is found in one scan") {
+        LiteralAutomaton automaton;
+        automaton.add("he", 0);
+        automaton.add("she", 1);
+        automaton.add("his", 2);
+        automaton.add("hers", 3);
+        automaton.add("he", 4);
+        automaton.build();
+
+        std::vector<std::pair<uint32_t, size_t>> found;
+        automaton.scan("ushers", [&](uint32_t id, size_t end) { found.emplace_back(id, end); });
+        std::sort(found.begin(), found.end());
+        CHECK(found == std::vector<std::pair<uint32_t, size_t>>{{0, 4}, {1, 4}, {3, 6}, {4, 4}});
+
+        LiteralAutomaton none;
+        none.build();
+        CHECK(none.empty());
+        size_t count = 0;
+        none.scan("anything", [&](uint32_t, size_t) { count++; });
+        CHECK(count == 0);
+    }
+
+    TEST_CASE("prefiltered matching is equivalent to the full scan") {
+        const std::vector<std::string> pieces = {"*.log", "build/", "!keep.log", "/dist", "src/**/*.o",
+                                                 "node_modules", "a?c", "[ab]*", "!/build/keep/",
+                                                 "docs/*.md", "**/tmp", "*cache*", "!b*"};
+        const std::vector<std::string> names = {"a.log", "keep.log", "build", "dist", "src", "x.o",
+                                                "node_modules", "abc", "tmp", "docs", "r.md",
+                                                "cache", "b", "keep"};
+        std::mt19937 gen(42);
+        for (int round = 0; round < 20; ++round) {
+            std::string content;
+            for (int i = 0; i < 8; ++i)
+                content += pieces[gen() % pieces.size()] + "\n";
+            const RuleSet full = parse_gitignore_content(content, "/home/a2va");
+            const GitIgnoreMatcher prefiltered(full);
+
+            for (int i = 0; i < 50; ++i) {
+                fs::path path = "/home/a2va";
+                const int depth = 1 + gen() % 4;
+                for (int d = 0; d < depth; ++d)
+                    path /= names[gen() % names.size()];
+                CHECK(prefiltered.is_ignored(path) == full.is_ignored(path));
+            }
+        }
+    }
+}
+
+TEST_SUITE("rule matchers") {
+    TEST_CASE("patterns get the matcher of their shape") {
+        const auto matcher = [](std::string_view line) {
+            return make_rule_matcher(*lex_gitignore_pattern(line), 0);
+        };
+        CHECK(std::holds_alternative<SegmentRule<NameTest, false, DirectoryMode::none>>(matcher("main.cpp")));
+        CHECK(std::holds_alternative<SegmentRule<NameTest, false, DirectoryMode::contents>>(matcher("build/")));
+        CHECK(std::holds_alternative<SegmentRule<NameTest, true, DirectoryMode::entry>>(matcher("!/build/")));
+        CHECK(std::holds_alternative<SegmentRule<SuffixTest, false, DirectoryMode::none>>(matcher("*.log")));
+        CHECK(std::holds_alternative<SegmentRule<PrefixTest, true, DirectoryMode::none>>(matcher("/cache-*")));
+        CHECK(std::holds_alternative<SegmentRule<GlobTest, false, DirectoryMode::none>>(matcher("a?c*.o")));
+        CHECK(std::holds_alternative<PathRule<DirectoryMode::contents>>(matcher("docs/build/")));
+        CHECK(std::holds_alternative<RegexRule<DirectoryMode::none>>(matcher("src/**/*.o")));
+        CHECK(std::holds_alternative<RegexRule<DirectoryMode::none>>(matcher("[ab]*")));
+        CHECK(std::holds_alternative<SegmentRule<NameTest, false, DirectoryMode::none>>(matcher("**/tmp")));
+    }
+
+    TEST_CASE("glob test") {
+        CHECK(GlobTest{"a?c*.o"}("abc.o"));
+        CHECK(GlobTest{"a?c*.o"}("axcyy.o"));
+        CHECK_FALSE(GlobTest{"a?c*.o"}("ac.o"));
+        CHECK(GlobTest{"*a*b*"}("xxaxxbxx"));
+        CHECK_FALSE(GlobTest{"*a*b*"}("xxbxxaxx"));
+        CHECK(GlobTest{"\\*\\?"}("*?"));
+        CHECK_FALSE(GlobTest{"\\*\\?"}("a?"));
+    }
+
+    TEST_CASE("specialized matchers agree with the regexes") {
+        const std::vector<std::string> pieces = {"*.log", "build/", "!keep.log", "/dist", "docs/build",
+                                                 "node_modules/", "a?c", "cache-*", "!/build/",
+                                                 "docs/*.md", "**/tmp", "*cache*", "!b*/", "a\\*b",
+                                                 "/src/", "!docs/build/", "?", "*"};
+        const std::vector<std::string> names = {"a.log", "keep.log", "build", "dist", "docs", "abc",
+                                                "node_modules", "cache-x", "tmp", "b", "a*b", "src",
+                                                "xcachey", "r.md"};
+        std::mt19937 gen(3);
+        for (const auto& piece : pieces) {
+            const std::vector<RuleDefinition> definitions = definitions_from_content(piece);
+            REQUIRE(definitions.size() == 1);
+            const std::regex regex(definitions[0].regex);
+            const RuleSet rules = parse_gitignore_content(piece, "/home/a2va");
+
+            for (int i = 0; i < 100; ++i) {
+                std::string rel;
+                const int depth = 1 + gen() % 3;
+                for (int d = 0; d < depth; ++d)
+                    rel += (d ? "/" : "") + names[gen() % names.size()];
+                CHECK(rules.match(0, "/home/a2va/" + rel) == std::regex_search(rel, regex));
+            }
+        }
+    }
+}
+
+TEST_SUITE("simd scan") {
+    TEST_CASE("every level agrees with the scalar scan") {
+        const std::string alphabet = "ab/c.-_x";
+        const std::vector<std::string> literals = {"a", "ab", "b/c", "x.x", "c.-_x", "abcabcabcabcabcabcab"};
+        std::mt19937 gen(7);
+        std::vector<std::string> texts;
+        for (size_t size = 0; size < 80; ++size) {
+            std::string text;
+            for (size_t i = 0; i < size; ++i)
+                text += alphabet[gen() % alphabet.size()];
+            texts.push_back(text);
+        }
+        texts.push_back(std::string(100, 'a') + "/" + std::string(100, 'b'));
+        texts.push_back(std::string(100, 'x') + "abcabcabcabcabcabcab");
+
+        for (const ScanLevel level : {ScanLevel::scalar, ScanLevel::sse2, ScanLevel::avx2}) {
+            set_scan_level(level);
+            CHECK(scan_level() <= best_scan_level());
+            for (const auto& text : texts) {
+                const std::string_view view(text);
+                for (size_t from = 0; from <= text.size(); ++from)
+                    CHECK(find_separator(view, from) == view.find('/', from));
+                CHECK(find_last_separator(view) == view.rfind('/'));
+                for (const auto& literal : literals)
+                    CHECK(find_literal(view, literal) == view.find(literal));
+                CHECK(find_literal(view, "") == 0);
+            }
+        }
+        set_scan_level(best_scan_level());
+    }
+}
+
+TEST_SUITE("directory cache") {
+    MatcherSnapshot matchers_of(const std::vector<std::pair<std::string, std::string>>& files) {
+        MatcherSnapshot matchers;
+        for (const auto& [content, base_dir] : files)
+            matchers.push_back(std::make_shared<const GitIgnoreMatcher>(parse_gitignore_content(content, base_dir)));
+        return matchers;
+    }
+
+    TEST_CASE("results are the same from the cache") {
+        const MatcherSnapshot matchers = matchers_of({{"*.log\n!keep.log\n", "/home/a2va"},
+                                                      {"out\n*.o\n", "/home/a2va/project"}});
+        DirectoryCache cache;
+        cache.clear(1);
+        const std::vector<std::pair<std::string, bool>> expected = {
+            {"/home/a2va/a.log", true}, {"/home/a2va/keep.log", false}, {"/home/a2va/project/a.o", true},
+            {"/home/a2va/a.o", false}, {"/home/a2va/project/src/main.cpp", false},
+            {"/home/a2va/project/src/main.o", true}, {"/home/a2va/project/out", true}};
+        for (const auto& [path, ignored] : expected) {
+            CHECK(cache.is_ignored(path, matchers, 1) == ignored);
+            // Second time from the cache
+            CHECK(cache.is_ignored(path, matchers, 1) == ignored);
+            // Same without the cache
+            CHECK(cache.is_ignored(path, matchers, 2) == ignored);
+        }
+    }
+
+    TEST_CASE("paths below an excluded directory are excluded") {
+        const MatcherSnapshot matchers = matchers_of({{"out\n", "/home/a2va"}});
+        DirectoryCache cache;
+        cache.clear(1);
+        CHECK(cache.is_ignored("/home/a2va/out", matchers, 1));
+        CHECK(cache.is_ignored("/home/a2va/out/deep/file.txt", matchers, 1));
+        CHECK_FALSE(cache.is_ignored("/home/a2va/src/file.txt", matchers, 1));
+        // Not with the matcher alone, which only tests the path itself
+        CHECK_FALSE(matchers[0]->is_ignored("/home/a2va/out/deep/file.txt"));
+    }
+
+    TEST_CASE("a changed gitignore only drops its directory") {
+        const MatcherSnapshot before = matchers_of({{"*.log\n", "/home/a2va"}, {"", "/home/a2va/sub"}});
+        DirectoryCache cache;
+        cache.clear(1);
+        CHECK_FALSE(cache.is_ignored("/home/a2va/sub/deep/a.tmp", before, 1));
+        CHECK_FALSE(cache.is_ignored("/home/a2va/other/a.tmp", before, 1));
+        const size_t cached = cache.size();
+
+        const MatcherSnapshot after = matchers_of({{"*.log\n", "/home/a2va"}, {"*.tmp\n", "/home/a2va/sub"}});
+        cache.invalidate(2, "/home/a2va/sub");
+        // sub and sub/deep are gone
+        CHECK(cache.size() == cached - 2);
+        CHECK(cache.is_ignored("/home/a2va/sub/deep/a.tmp", after, 2));
+        CHECK_FALSE(cache.is_ignored("/home/a2va/other/a.tmp", after, 2));
+
+        // Queries with the matchers of another generation don't fill the cache
+        const size_t size = cache.size();
+        CHECK_FALSE(cache.is_ignored("/home/a2va/third/a.tmp", before, 1));
+        CHECK(cache.size() == size);
+    }
+
+    TEST_CASE("deeper gitignore files take precedence") {
+        // Registry order, not depth order
+        const MatcherSnapshot matchers = matchers_of({{"!keep.log\n", "/home/a2va/sub"}, {"*.log\n", "/home/a2va"}});
+        DirectoryCache cache;
+        cache.clear(1);
+        CHECK(cache.is_ignored("/home/a2va/keep.log", matchers, 1));
+        CHECK_FALSE(cache.is_ignored("/home/a2va/sub/keep.log", matchers, 1));
+        CHECK(cache.is_ignored("/home/a2va/sub/other.log", matchers, 1));
+    }
+
+    TEST_CASE("the least recently used directories are evicted") {
+        const MatcherSnapshot matchers = matchers_of({{"*.log\n", "/home/a2va"}});
+        DirectoryCache cache(4);
+        cache.clear(1);
+        for (int i = 0; i < 10; ++i)
+            CHECK(cache.is_ignored("/home/a2va/dir" + std::to_string(i) + "/a.log", matchers, 1));
+        CHECK(cache.size() == 4);
+    }
+
+    TEST_CASE("concurrent queries resolve the same directories") {
+        const MatcherSnapshot matchers = matchers_of({{"*.log\nout\n", "/home/a2va"}});
+        DirectoryCache cache(8);
+        cache.clear(1);
+        std::atomic<int> wrong = 0;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 500; i++) {
+                    const std::string dir = "/home/a2va/dir" + std::to_string(i % 12);
+                    if (!cache.is_ignored(dir + "/a.log", matchers, 1) ||
+                        cache.is_ignored(dir + "/a.txt", matchers, 1) ||
+                        !cache.is_ignored(dir + "/out/a.txt", matchers, 1))
+                        wrong++;
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        CHECK(wrong == 0);
+        CHECK(cache.size() <= 8);
+    }
+}
+
+TEST_SUITE("gitignore stack") {
+    struct FakeTree {
+        std::map<std::string, std::string> gitignores;
+        std::vector<std::string> loaded;
+
+        GitIgnoreStack::Loader loader() {
+            return [this](const fs::path& directory) {
+                loaded.push_back(directory.generic_string());
+                MatcherSnapshot matchers;
+                const auto it = gitignores.find(directory.generic_string());
+                if (it != gitignores.end())
+                    matchers.push_back(std::make_shared<const GitIgnoreMatcher>(parse_gitignore_content(it->second, directory)));
+                return matchers;
+            };
+        }
+    };
+
+    TEST_CASE("deeper files override and re-include") {
+        FakeTree tree{.gitignores = {{"/home/a2va", "*.log\n*.tmp\n"},
+                                     {"/home/a2va/sub", "!keep.log\n*.o\n"},
+                                     {"/home/a2va/sub/deep", "keep.log\n!*.tmp\n"}},
+                      .loaded = {}};
+        GitIgnoreStack stack("/home/a2va", tree.loader());
+        CHECK(stack.is_ignored("/home/a2va/keep.log"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va/sub/keep.log"));
+        CHECK(stack.is_ignored("/home/a2va/sub/a.log"));
+        CHECK(stack.is_ignored("/home/a2va/sub/a.o"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va/a.o"));
+        CHECK(stack.is_ignored("/home/a2va/sub/deep/keep.log"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va/sub/deep/a.tmp"));
+        CHECK(stack.is_ignored("/home/a2va/sub/a.tmp"));
+        // Outside of the root
+        CHECK_FALSE(stack.is_ignored("/home/other/a.log"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va"));
+    }
+
+    TEST_CASE("nothing is re-included below an excluded directory") {
+        FakeTree tree{.gitignores = {{"/home/a2va", "build/\n"}, {"/home/a2va/build", "!*\n"}},
+                      .loaded = {}};
+        GitIgnoreStack stack("/home/a2va", tree.loader());
+        CHECK(stack.is_ignored("/home/a2va/build"));
+        CHECK(stack.is_ignored("/home/a2va/build/a/b/c.txt"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va/src/c.txt"));
+        // The gitignore file of build is never read
+        CHECK(std::find(tree.loaded.begin(), tree.loaded.end(), "/home/a2va/build") == tree.loaded.end());
+    }
+
+    TEST_CASE("directories are loaded once and on demand") {
+        FakeTree tree{.gitignores = {{"/home/a2va", "*.log\n"}, {"/home/a2va/a", "!x.log\n"}},
+                      .loaded = {}};
+        GitIgnoreStack stack("/home/a2va", tree.loader());
+        CHECK_FALSE(stack.is_ignored("/home/a2va/a/x.log"));
+        CHECK(stack.is_ignored("/home/a2va/a/y.log"));
+        CHECK(tree.loaded == std::vector<std::string>{"/home/a2va", "/home/a2va/a"});
+        CHECK(stack.directory_count() == 2);
+
+        CHECK(stack.is_ignored("/home/a2va/b/c/x.log"));
+        CHECK(tree.loaded.size() == 4);
+
+        tree.gitignores["/home/a2va/a"] = "";
+        stack.invalidate("/home/a2va/a");
+        CHECK(stack.directory_count() == 3);
+        CHECK(stack.is_ignored("/home/a2va/a/x.log"));
+        CHECK(tree.loaded.size() == 5);
+    }
+
+    TEST_CASE("queried paths are not interned") {
+        FakeTree tree{.gitignores = {{"/home/a2va", "*.log\n"}}, .loaded = {}};
+        GitIgnoreStack stack("/home/a2va", tree.loader());
+        const size_t size = path_table().size();
+        CHECK(stack.is_ignored("/home/a2va/queried/a/b/c.log"));
+        CHECK_FALSE(stack.is_ignored("/home/a2va/queried/d/e.txt"));
+        CHECK(path_table().size() == size);
+    }
+
+    TEST_CASE("gitignore files are read from disk") {
+        TemporaryDirectory temp_dir;
+        fs::create_directories(temp_dir.get_path() / "sub");
+        std::ofstream(temp_dir.get_path() / ".gitignore") << "*.log\n";
+        std::ofstream(temp_dir.get_path() / "sub" / ".gitignore") << "!keep.log\n";
+        GitIgnoreStack stack(temp_dir.get_path());
+        CHECK(stack.is_ignored(temp_dir.get_path() / "keep.log"));
+        CHECK_FALSE(stack.is_ignored(temp_dir.get_path() / "sub" / "keep.log"));
+        CHECK(stack.is_ignored(temp_dir.get_path() / "sub" / "other.log"));
+    }
+}
+
+TEST_SUITE("ignore sources") {
+    TEST_CASE("kind and base directory of a file") {
+        CHECK(ignore_source_kind("/home/a2va/repo/.gitignore") == IgnoreSourceKind::gitignore);
+        CHECK(ignore_source_kind("/home/a2va/repo/.git/info/exclude") == IgnoreSourceKind::info_exclude);
+        CHECK(ignore_source_kind("/home/a2va/.config/git/ignore") == IgnoreSourceKind::excludes_file);
+        CHECK(ignore_source_kind("/home/a2va/info/exclude") == IgnoreSourceKind::excludes_file);
+        CHECK(ignore_source_base("/home/a2va/repo/sub/.gitignore") == fs::path("/home/a2va/repo/sub"));
+        CHECK(ignore_source_base("/home/a2va/repo/.git/info/exclude") == fs::path("/home/a2va/repo"));
+        CHECK_FALSE(ignore_source_base("/home/a2va/.config/git/ignore"));
+    }
+
+    TEST_CASE("excludes file from git config") {
+        const fs::path home = "/home/a2va";
+        const fs::path repo = "/home/a2va/repo";
+        CHECK(excludes_file_from_config("[core]\n\texcludesFile = ~/.gitignore_global\n", home, repo) ==
+              fs::path("/home/a2va/.gitignore_global"));
+        // Section and key are case insensitive, quotes and comments are resolved
+        CHECK(excludes_file_from_config("[Core]\nEXCLUDESFILE = \"/etc/my ignore\" # global\n", home, repo) ==
+              fs::path("/etc/my ignore"));
+        // Relative to the repository, the last value wins
+        CHECK(excludes_file_from_config("[core]\nexcludesfile = a\nexcludesfile = b/../c\n", home, repo) ==
+              fs::path("/home/a2va/repo/c"));
+        // Other sections and unset values
+        CHECK_FALSE(excludes_file_from_config("[user]\nexcludesfile = a\n", home, repo));
+        CHECK_FALSE(excludes_file_from_config("[core]\nexcludesfile = a\nexcludesfile =\n", home, repo));
+        CHECK_FALSE(excludes_file_from_config("", home, repo));
+    }
+
+    TEST_CASE("excludes file lookup") {
+        TemporaryDirectory temp_dir;
+        const fs::path home = temp_dir.get_path() / "home";
+        const fs::path xdg = temp_dir.get_path() / "xdg";
+        const fs::path repo = temp_dir.get_path() / "repo";
+        fs::create_directories(xdg / "git");
+        fs::create_directories(repo / ".git");
+        fs::create_directories(home);
+
+        // Nothing configured and no default file
+        CHECK_FALSE(find_excludes_file(repo, home, xdg));
+
+        std::ofstream(xdg / "git" / "ignore") << "*.swp\n";
+        CHECK(find_excludes_file(repo, home, xdg) == normalize_path(xdg / "git" / "ignore"));
+
+        std::ofstream(home / ".gitconfig") << "[core]\n\texcludesfile = ~/global_ignore\n";
+        // A configured file that doesn't exist
+        CHECK_FALSE(find_excludes_file(repo, home, xdg));
+        std::ofstream(home / "global_ignore") << "*.bak\n";
+        CHECK(find_excludes_file(repo, home, xdg) == normalize_path(home / "global_ignore"));
+
+        // The repository config wins
+        std::ofstream(repo / ".git" / "config") << "[core]\n\texcludesfile = local_ignore\n";
+        std::ofstream(repo / "local_ignore") << "*.o\n";
+        CHECK(find_excludes_file(repo, home, xdg) == normalize_path(repo / "local_ignore"));
+    }
+
+    TEST_CASE("one matcher applies below several repositories") {
+        RuleSet rules = parse_gitignore_content("*.swp\n/build\n", fs::path("/home/a2va/one"));
+        rules.add_base_path("/home/a2va/two");
+        rules.add_base_path("/home/a2va/two");
+        const GitIgnoreMatcher matcher(std::move(rules));
+        CHECK(matcher.is_ignored("/home/a2va/one/a.swp"));
+        CHECK(matcher.is_ignored("/home/a2va/two/sub/a.swp"));
+        CHECK(matcher.is_ignored("/home/a2va/one/build"));
+        CHECK(matcher.is_ignored("/home/a2va/two/build"));
+        // Anchored rules are relative to the repository containing the path
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/two/sub/build"));
+        CHECK_FALSE(matcher.is_ignored("/home/a2va/three/a.swp"));
+        CHECK(matcher.applies_below("/home/a2va/two/sub"));
+        CHECK_FALSE(matcher.applies_below("/home/a2va/three"));
+    }
+
+    TEST_CASE("stack with git precedence across sources") {
+        TemporaryDirectory temp_dir;
+        const fs::path repo = temp_dir.get_path();
+        fs::create_directories(repo / ".git" / "info");
+        fs::create_directories(repo / "sub");
+        std::ofstream(repo / ".git" / "info" / "exclude") << "*.log\n*.tmp\n";
+        std::ofstream(repo / ".gitignore") << "!keep.log\n";
+        std::ofstream(repo / "sub" / ".gitignore") << "!*.tmp\n";
+
+        const auto sources = directory_ignore_sources(repo);
+        REQUIRE(sources.size() >= 2);
+        CHECK(sources[sources.size() - 2].kind == IgnoreSourceKind::info_exclude);
+        CHECK(sources.back().kind == IgnoreSourceKind::gitignore);
+
+        GitIgnoreStack stack(repo);
+        CHECK(stack.is_ignored(repo / "a.log"));
+        // .gitignore overrides .git/info/exclude
+        CHECK_FALSE(stack.is_ignored(repo / "keep.log"));
+        CHECK(stack.is_ignored(repo / "a.tmp"));
+        CHECK_FALSE(stack.is_ignored(repo / "sub" / "a.tmp"));
+    }
+}
+
+TEST_SUITE("matcher registry") {
+    TEST_CASE("matchers are shared until the content changes") {
+        TemporaryDirectory temp_dir;
+        fs::path gitignore_path = temp_dir.get_path() / ".gitignore";
+        {
+            std::ofstream file(gitignore_path);
+            file << "*.log";
+        }
+        MatcherCache cache(temp_dir.get_path() / "synctignore.cache");
+        MatcherRegistry registry(cache);
+        const PathId gitignore_id = path_table().intern(gitignore_path);
+
+        const auto matcher = registry.get(gitignore_id);
+        CHECK(registry.get(gitignore_id) == matcher);
+        CHECK(registry.refresh(gitignore_id) == matcher);
+        CHECK(matcher->is_ignored(temp_dir.get_path() / "debug.log"));
+
+        const auto snapshot = registry.snapshot();
+        CHECK(snapshot->size() == 1);
+        CHECK(registry.snapshot() == snapshot);
+
+        {
+            std::ofstream file(gitignore_path);
+            file << "*.tmp";
+        }
+        // get doesn't look at the file again, refresh does
+        CHECK(registry.get(gitignore_id) == matcher);
+        const auto updated = registry.refresh(gitignore_id);
+        CHECK(updated != matcher);
+        CHECK_FALSE(updated->is_ignored(temp_dir.get_path() / "debug.log"));
+        CHECK(updated->is_ignored(temp_dir.get_path() / "a.tmp"));
+
+        // Older snapshots stay valid
+        CHECK(snapshot->front() == matcher);
+        CHECK(registry.snapshot()->front() == updated);
+
+        registry.remove(gitignore_id);
+        CHECK(registry.snapshot()->empty());
+    }
+
+    TEST_CASE("snapshot is ordered by precedence and excludes files are shared") {
+        TemporaryDirectory temp_dir;
+        const fs::path root = temp_dir.get_path();
+        fs::create_directories(root / "repo" / ".git" / "info");
+        fs::create_directories(root / "other");
+        std::ofstream(root / "repo" / ".gitignore") << "!a.swp\n";
+        std::ofstream(root / "repo" / ".git" / "info" / "exclude") << "*.log\n";
+        std::ofstream(root / "global_ignore") << "*.swp\n";
+
+        MatcherCache cache(root / "synctignore.cache");
+        MatcherRegistry registry(cache);
+        const auto gitignore = registry.get(path_table().intern(root / "repo" / ".gitignore"));
+        const auto info_exclude = registry.get(path_table().intern(root / "repo" / ".git" / "info" / "exclude"));
+        const PathId excludes_id = path_table().intern(root / "global_ignore");
+        const auto excludes = registry.refresh(excludes_id, "*.swp\n", {root / "repo", root / "other"});
+
+        CHECK(*registry.snapshot() == MatcherSnapshot{excludes, info_exclude, gitignore});
+        CHECK(info_exclude->is_ignored(root / "repo" / "sub" / "a.log"));
+        CHECK(excludes->is_ignored(root / "other" / "b.swp"));
+        CHECK_FALSE(excludes->is_ignored(root / "c.swp"));
+
+        // Same content and repositories, same matcher
+        CHECK(registry.refresh(excludes_id, "*.swp\n", {root / "repo", root / "other"}) == excludes);
+        const auto fewer = registry.refresh(excludes_id, "*.swp\n", {root / "repo"});
+        CHECK(fewer != excludes);
+        CHECK_FALSE(fewer->is_ignored(root / "other" / "b.swp"));
+    }
+}
+
+TEST_SUITE("published snapshot") {
+    TEST_CASE("readers keep the generation they loaded") {
+        Published<std::vector<int>> published;
+        CHECK(published.load() == nullptr);
+
+        published.publish(std::make_shared<const std::vector<int>>(std::vector<int>{1}));
+        const auto first = published.load();
+        published.publish(std::make_shared<const std::vector<int>>(std::vector<int>{1, 2}));
+
+        CHECK(first->size() == 1);
+        CHECK(published.load()->size() == 2);
+    }
+
+    TEST_CASE("concurrent readers always see a complete generation") {
+        Published<std::vector<int>> published(std::make_shared<const std::vector<int>>(8, 0));
+        std::atomic<bool> stop = false;
+        std::atomic<bool> consistent = true;
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 4; ++i) {
+            readers.emplace_back([&] {
+                while (!stop.load()) {
+                    const auto values = published.load();
+                    for (int value : *values) {
+                        if (value != values->front())
+                            consistent = false;
+                    }
+                }
+            });
+        }
+        for (int generation = 1; generation <= 1000; ++generation)
+            published.publish(std::make_shared<const std::vector<int>>(8, generation));
+        stop = true;
+        for (auto& reader : readers)
+            reader.join();
+
+        CHECK(consistent.load());
+        CHECK(published.load()->front() == 1000);
+    }
+}
+
+TEST_CASE("rules don't apply outside of the gitignore directory") {
+    TemporaryDirectory temp_dir;
+    fs::create_directories(temp_dir.get_path() / "sub");
+    fs::path gitignore_path = temp_dir.get_path() / "sub" / ".gitignore";
+    {
+        std::ofstream file(gitignore_path);
+        file << "*.log";
+    }
+    GitIgnoreMatcher matcher(gitignore_path, temp_dir.get_path() / "sub");
+
+    CHECK(matcher.is_ignored(temp_dir.get_path() / "sub" / "debug.log"));
+    CHECK(matcher.is_ignored(temp_dir.get_path() / "sub" / "deep" / "debug.log"));
+    CHECK_FALSE(matcher.is_ignored(temp_dir.get_path() / "debug.log"));
+    CHECK_FALSE(matcher.is_ignored(temp_dir.get_path() / "other" / "debug.log"));
+}
+
+TEST_SUITE("path table") {
+    TEST_CASE("paths sharing a prefix share their components") {
+        PathTable table;
+        const PathId root = table.intern("/home/a2va/.gitignore");
+        const size_t size = table.size();
+        const PathId sub = table.intern("/home/a2va/sub/.gitignore");
+        // Only sub and its .gitignore are new
+        CHECK(table.size() == size + 2);
+
+        CHECK(table.intern("/home/a2va/.gitignore") == root);
+        CHECK(table.find("/home/a2va/sub/.gitignore") == sub);
+        CHECK_FALSE(table.find("/home/a2va/other/.gitignore").has_value());
+
+        CHECK(table.path(root) == fs::path("/home/a2va/.gitignore"));
+        CHECK(table.path(sub) == fs::path("/home/a2va/sub/.gitignore"));
+        CHECK(table.parent(sub) == table.find("/home/a2va/sub"));
+        CHECK(table.depth(sub) == table.depth(root) + 1);
+        CHECK(table.path(PathId{}).empty());
+    }
+
+    TEST_CASE("a trailing separator names the same path") {
+        PathTable table;
+        const PathId directory = table.intern("/home/a2va/sub");
+        const size_t size = table.size();
+        CHECK(table.intern("/home/a2va/sub/") == directory);
+        CHECK(table.find("/home/a2va/sub/") == directory);
+        CHECK(table.size() == size);
+    }
+
+    TEST_CASE("concurrent interning gives a single id per path") {
+        PathTable table;
+        std::vector<std::thread> threads;
+        std::vector<PathId> ids(4);
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([&table, &ids, i] {
+                for (int j = 0; j < 100; ++j)
+                    table.intern("/root/dir" + std::to_string(j) + "/.gitignore");
+                ids[i] = table.intern("/root/dir42/.gitignore");
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+
+        for (const auto& id : ids)
+            CHECK(id == ids.front());
+        CHECK(table.path(ids.front()) == fs::path("/root/dir42/.gitignore"));
+    }
+}
+
+TEST_SUITE("folder list") {
+    TEST_CASE("roots are read one per line") {
+        const auto list = parse_folder_list("# synced folders\n/home/a2va/docs\n\n  relative/dir  \r\n/home/a2va/docs/\n",
+                                            "/home/a2va/config");
+        CHECK(list.roots == std::vector<fs::path>{normalize_path("/home/a2va/docs"),
+                                                  normalize_path("/home/a2va/config/relative/dir")});
+        CHECK(list.sources.empty());
+        CHECK(list.complete);
+        CHECK(parse_folder_list("", "/home").roots.empty());
+    }
+
+    TEST_CASE("scan options directive") {
+        const auto list = parse_folder_list("@scan max_rate=200\n/data\n@scan idle_io=on\n@scan bogus\n", "/");
+        CHECK(list.roots == std::vector<fs::path>{normalize_path("/data")});
+        REQUIRE(list.scan_options);
+        CHECK(list.scan_options->max_directories_per_second == 200);
+        CHECK(list.scan_options->idle_io_priority);
+        CHECK_FALSE(parse_folder_list("/data\n", "/").scan_options);
+    }
+
+    TEST_CASE("a missing list is not an empty one") {
+        TemporaryDirectory temp_dir;
+        CHECK_FALSE(read_folder_list(temp_dir.get_path() / "synctignore.folders"));
+        std::ofstream(temp_dir.get_path() / "synctignore.folders") << "a\nb\n";
+        const auto list = read_folder_list(temp_dir.get_path() / "synctignore.folders");
+        REQUIRE(list);
+        CHECK(list->roots == std::vector<fs::path>{normalize_path(temp_dir.get_path() / "a"),
+                                                   normalize_path(temp_dir.get_path() / "b")});
+        CHECK(list->sources == std::vector<fs::path>{normalize_path(temp_dir.get_path() / "synctignore.folders")});
+    }
+
+    TEST_CASE("folders of a syncthing config") {
+        TemporaryDirectory temp_dir;
+        const fs::path config = temp_dir.get_path() / "st" / "config.xml";
+        fs::create_directories(config.parent_path());
+        std::ofstream(config) << "<configuration version=\"37\">\n"
+                                 "    <folder id=\"a\" path=\"" << (temp_dir.get_path() / "docs").generic_string() << "\"></folder>\n"
+                                 "</configuration>\n";
+        std::ofstream(temp_dir.get_path() / "synctignore.folders") << "other\n@syncthing st/config.xml\n";
+
+        const auto list = read_folder_list(temp_dir.get_path() / "synctignore.folders");
+        REQUIRE(list);
+        CHECK(list->complete);
+        CHECK(list->roots == std::vector<fs::path>{normalize_path(temp_dir.get_path() / "other"),
+                                                   normalize_path(temp_dir.get_path() / "docs")});
+        CHECK(list->sources == std::vector<fs::path>{normalize_path(config),
+                                                     normalize_path(temp_dir.get_path() / "synctignore.folders")});
+
+        // Being written
+        std::ofstream(config) << "<configuration version=\"37\">\n    <folder id=\"a\"";
+        CHECK_FALSE(syncthing_folder_list(config).complete);
+        fs::remove(config);
+        const auto missing = syncthing_folder_list(config);
+        CHECK_FALSE(missing.complete);
+        CHECK(missing.sources == std::vector<fs::path>{normalize_path(config)});
+    }
+
+    TEST_CASE("the deepest root containing a path") {
+        const std::vector<fs::path> roots{normalize_path("/home/a2va/docs"), normalize_path("/home/a2va"),
+                                          normalize_path("/home/a2va/docs/nested")};
+        CHECK(find_folder(roots, "/home/a2va/docs/a.txt") == 0);
+        CHECK(find_folder(roots, "/home/a2va/music/a.mp3") == 1);
+        CHECK(find_folder(roots, "/home/a2va/docs/nested/deep/a.txt") == 2);
+        CHECK(find_folder(roots, "/home/a2va/docs") == 0);
+        // A common prefix isn't enough
+        CHECK(find_folder(roots, "/home/a2va/docs2/a.txt") == 1);
+        CHECK_FALSE(find_folder(roots, "/home/other/a.txt"));
+        CHECK_FALSE(find_folder({}, "/home/a2va"));
+    }
+}
+
+TEST_SUITE("worker pool") {
+    TEST_CASE("tasks run on the pool threads") {
+        std::atomic<int> done = 0;
+        std::mutex mutex;
+        std::set<std::thread::id> threads;
+        WorkerPool pool(4);
+        CHECK(pool.thread_count() == 4);
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&] {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    threads.insert(std::this_thread::get_id());
+                }
+                done++;
+            });
+        }
+        pool.wait_idle();
+        CHECK(done == 100);
+        CHECK_FALSE(threads.contains(std::this_thread::get_id()));
+        CHECK(threads.size() <= 4);
+        CHECK(pool.queued_tasks() == 0);
+    }
+
+    TEST_CASE("tasks can submit tasks and destruction drains the queue") {
+        std::atomic<int> done = 0;
+        {
+            WorkerPool pool(1);
+            pool.submit([&] {
+                pool.submit([&] { done++; });
+                done++;
+            });
+            pool.wait_idle();
+            CHECK(done == 2);
+            for (int i = 0; i < 10; i++)
+                pool.submit([&] { done++; });
+        }
+        CHECK(done == 12);
+    }
+}
+
+TEST_SUITE("syncthing config") {
+    TEST_CASE("folders directly below the root element") {
+        const std::string_view xml = R"(<?xml version="1.0" encoding="UTF-8"?>
+<!-- <folder path="/commented"> -->
+<configuration version="37">
+    <folder id="docs" label="Docs &amp; notes" path="/data/docs &amp; notes" type="sendreceive">
+        <filesystemType>basic</filesystemType>
+        <device id="ABC" introducedBy=""></device>
+        <versioning><param key="path" val="/folder/like"></param></versioning>
+    </folder>
+    <folder path='~/Music' id='music'/>
+    <folder id="home" path="~"></folder>
+    <folder id="quoted" label="a > b" path="/data/&#x41;&#66;"></folder>
+    <device id="ABC" name="laptop"><address>dynamic</address></device>
+    <defaults>
+        <folder id="" path="~"></folder>
+    </defaults>
+    <options><![CDATA[<folder path="/cdata">]]></options>
+</configuration>
+)";
+        const auto folders = syncthing_config_folders(xml, "/home/a2va");
+        REQUIRE(folders);
+        CHECK(*folders == std::vector<fs::path>{"/data/docs & notes", fs::path("/home/a2va") / "Music",
+                                                fs::path("/home/a2va") / "", "/data/AB"});
+    }
+
+    TEST_CASE("incomplete documents") {
+        CHECK_FALSE(syncthing_config_folders("", "/home"));
+        CHECK_FALSE(syncthing_config_folders("<configuration><folder path=\"/a\">", "/home"));
+        CHECK_FALSE(syncthing_config_folders("<configuration><folder path=\"/a", "/home"));
+        CHECK_FALSE(syncthing_config_folders("</configuration>", "/home"));
+        const auto empty = syncthing_config_folders("<configuration/>", "/home");
+        REQUIRE(empty);
+        CHECK(empty->empty());
+    }
+
+    TEST_CASE("xml entities") {
+        CHECK(decode_xml_entities("a &lt;b&gt; &quot;c&quot; &apos;d&apos; &amp;amp;") == "a <b> \"c\" 'd' &amp;");
+        CHECK(decode_xml_entities("&#233;&#x20AC;") == "\xC3\xA9\xE2\x82\xAC");
+        CHECK(decode_xml_entities("&unknown; & x") == "&unknown; & x");
+    }
+}
+
+TEST_SUITE("scan throttle") {
+    TEST_CASE("options are parsed as a whole") {
+        ScanOptions options;
+        CHECK(parse_scan_options("max_rate=500  max_walkers=2\tidle_io=on", options));
+        CHECK(options.max_directories_per_second == 500);
+        CHECK(options.max_walkers == 2);
+        CHECK(options.idle_io_priority);
+        CHECK(format_scan_options(options) == "max_rate=500 max_walkers=2 idle_io=on");
+
+        CHECK_FALSE(parse_scan_options("max_walkers=1 max_rate=fast", options));
+        CHECK_FALSE(parse_scan_options("idle_io=maybe", options));
+        CHECK_FALSE(parse_scan_options("max_rate", options));
+        CHECK_FALSE(parse_scan_options("unknown=1", options));
+        CHECK(options.max_walkers == 2);
+        CHECK(parse_scan_options("", options));
+        CHECK(parse_scan_options("max_rate=0 idle_io=off", options));
+        CHECK(format_scan_options(options) == "max_rate=0 max_walkers=2 idle_io=off");
+    }
+
+    TEST_CASE("directories are read at the maximum rate") {
+        ScanThrottle throttle(ScanOptions{.max_directories_per_second = 200});
+        const auto start = std::chrono::steady_clock::now();
+        {
+            ScanThrottle::Walker walker(throttle);
+            for (int i = 0; i < 41; i++)
+                walker.read_directory();
+        }
+        // The first directory is read right away, the 40 others take 200ms
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(180));
+
+        throttle.set_options(ScanOptions{});
+        const auto unlimited = std::chrono::steady_clock::now();
+        ScanThrottle::Walker walker(throttle);
+        for (int i = 0; i < 10000; i++)
+            walker.read_directory();
+        CHECK(std::chrono::steady_clock::now() - unlimited < std::chrono::milliseconds(150));
+    }
+
+    TEST_CASE("concurrent walkers are capped") {
+        ScanThrottle throttle(ScanOptions{.max_walkers = 2});
+        std::atomic<int> active = 0;
+        std::atomic<int> max_active = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; i++) {
+            threads.emplace_back([&] {
+                ScanThrottle::Walker walker(throttle);
+                const int now = ++active;
+                int seen = max_active.load();
+                while (now > seen && !max_active.compare_exchange_weak(seen, now)) {
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                active--;
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        CHECK(max_active <= 2);
+        CHECK(max_active >= 1);
+    }
+
+    TEST_CASE("cancelled walks stop waiting") {
+        ScanThrottle throttle(ScanOptions{.max_directories_per_second = 0.1, .max_walkers = 1});
+        std::atomic<bool> cancelled = false;
+        ScanThrottle::Walker walker(throttle, &cancelled);
+        // Uses the burst, the next directory would wait for 10s
+        CHECK(walker.read_directory());
+
+        const auto start = std::chrono::steady_clock::now();
+        bool read = true;
+        std::thread thread([&] { read = walker.read_directory(); });
+        std::atomic<bool> other_cancelled = false;
+        std::thread waiting([&] {
+            // No slot is free until the first walker is done
+            ScanThrottle::Walker other(throttle, &other_cancelled);
+            CHECK_FALSE(other.read_directory());
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        cancelled = true;
+        other_cancelled = true;
+        throttle.wake_walkers();
+        thread.join();
+        waiting.join();
+        CHECK_FALSE(read);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    TEST_CASE("walkers with the idle I/O priority") {
+        // The priority is lowered and restored on each walk, where the platform has one
+        ScanThrottle throttle(ScanOptions{.max_walkers = 1, .idle_io_priority = true});
+        for (int i = 0; i < 3; i++) {
+            ScanThrottle::Walker walker(throttle);
+            walker.read_directory();
+        }
+        CHECK(throttle.options().idle_io_priority);
+    }
+
+    TEST_CASE("progress of a scan") {
+        ScanProgress progress;
+        CHECK(progress.state == ScanState::idle);
+        CHECK(progress.elapsed().count() == 0);
+        progress.start();
+        progress.directories += 3;
+        CHECK(std::string(scan_state_name(progress.state)) == "scanning");
+        progress.finish();
+        CHECK(progress.state == ScanState::idle);
+        CHECK(progress.directories == 3);
+        CHECK(progress.elapsed().count() >= 0);
+    }
+}
+
+TEST_SUITE("scan records") {
+    using Clock = ScanRecords::Clock;
+
+    TEST_CASE("requests cover the ones below them with a larger max age") {
+        const ScanRequest folder{.subtree = "/data"};
+        const ScanRequest repo{.subtree = "/data/repo", .max_age = std::chrono::seconds(60)};
+        CHECK(folder.covers(repo));
+        CHECK(folder.covers(folder));
+        CHECK_FALSE(repo.covers(folder));
+        CHECK_FALSE((ScanRequest{.subtree = "/data/rep"}.covers(repo)));
+        CHECK_FALSE((ScanRequest{.subtree = "/data", .max_age = std::chrono::seconds(90)}.covers(repo)));
+    }
+
+    TEST_CASE("a walk holds for its whole tree") {
+        ScanRecords records;
+        const auto t0 = Clock::now();
+        CHECK_FALSE(records.read_time("/data/a"));
+        CHECK_FALSE(records.fresh("/data", std::chrono::seconds(10), t0));
+
+        records.record_walk("/data", t0, {});
+        CHECK(records.read_time("/data/a/b") == t0);
+        CHECK(records.fresh("/data/a", std::chrono::seconds(10), t0 + std::chrono::seconds(5)));
+        CHECK_FALSE(records.fresh("/data/a", std::chrono::seconds(10), t0 + std::chrono::seconds(10)));
+        CHECK_FALSE(records.read_time("/other"));
+        CHECK(records.size() == 1);
+    }
+
+    TEST_CASE("skipped trees keep the time they were read") {
+        ScanRecords records;
+        const auto t0 = Clock::now();
+        const auto t1 = t0 + std::chrono::seconds(30);
+        const auto t2 = t0 + std::chrono::seconds(60);
+        records.record_walk("/data", t0, {});
+        records.record_walk("/data/a", t1, {});
+        CHECK(records.read_time("/data/a/x") == t1);
+        CHECK(records.read_time("/data/b") == t0);
+        CHECK(records.oldest("/data") == t0);
+        CHECK(records.oldest("/data/a") == t1);
+
+        // /data/b is read again, /data/a was read recently enough
+        records.record_walk("/data", t2, {"/data/a"});
+        CHECK(records.read_time("/data/b") == t2);
+        CHECK(records.read_time("/data/a/x") == t1);
+        CHECK(records.oldest("/data") == t1);
+        // The stale tree below a fresh directory makes it stale
+        CHECK_FALSE(records.fresh("/data", std::chrono::seconds(20), t2 + std::chrono::seconds(1)));
+        CHECK(records.fresh("/data/b", std::chrono::seconds(20), t2 + std::chrono::seconds(1)));
+
+        // A walk reading everything drops the deeper records
+        records.record_walk("/data", t2, {});
+        CHECK(records.size() == 1);
+        CHECK(records.read_time("/data/a/x") == t2);
+    }
+
+    TEST_CASE("a walk skipping its whole subtree changes nothing") {
+        ScanRecords records;
+        const auto t0 = Clock::now();
+        records.record_walk("/data", t0, {});
+        records.record_walk("/data/a", t0 + std::chrono::seconds(5), {"/data/a"});
+        CHECK(records.read_time("/data/a") == t0);
+        CHECK(records.oldest("/data") == t0);
+    }
+}
+
+TEST_SUITE("trace") {
+    TEST_CASE("nothing is recorded while disabled") {
+        Tracer local;
+        CHECK_FALSE(local.enabled());
+        CHECK(local.chrome_json() == "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n]}\n");
+
+        const bool was_enabled = tracer().enabled();
+        tracer().set_enabled(false);
+        const size_t before = tracer().event_count();
+        {
+            const TraceScope scope("disabled");
+            trace_counter("disabled counter", 1);
+        }
+        CHECK(tracer().event_count() == before);
+        tracer().set_enabled(was_enabled);
+    }
+
+    TEST_CASE("chrome trace events") {
+        Tracer local;
+        local.set_enabled(true);
+        local.complete("parse \"a\"", 10, 25);
+        local.counter("rules", 42);
+        CHECK(local.event_count() == 2);
+        const std::string json = local.chrome_json();
+        CHECK(json.find("{\"name\":\"parse \\\"a\\\"\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":10,\"dur\":25}") != std::string::npos);
+        CHECK(json.find("\"name\":\"rules\",\"ph\":\"C\"") != std::string::npos);
+        CHECK(json.find("\"args\":{\"value\":42}}") != std::string::npos);
+
+        local.clear();
+        CHECK(local.event_count() == 0);
+    }
+
+    TEST_CASE("each thread records in its own buffer") {
+        Tracer local;
+        local.set_enabled(true);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 1000; j++)
+                    local.complete("work", local.now(), 1);
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        CHECK(local.event_count() == 4000);
+        CHECK(local.dropped() == 0);
+        const std::string json = local.chrome_json();
+        for (int tid = 1; tid <= 4; tid++)
+            CHECK(json.find("\"tid\":" + std::to_string(tid) + ",") != std::string::npos);
+    }
+
+    TEST_CASE("the parser is instrumented") {
+        tracer().clear();
+        tracer().set_enabled(true);
+        parse_gitignore_content("*.o\nbuild/\n", std::nullopt);
+        tracer().set_enabled(false);
+        CHECK(tracer().chrome_json().find("\"name\":\"parse_gitignore\"") != std::string::npos);
+        tracer().clear();
+    }
+}
+
+TEST_SUITE("metrics") {
+    using namespace std::chrono_literals;
+
+    TEST_CASE("histogram buckets") {
+        LatencyHistogram histogram({0.001, 0.01, 1});
+        histogram.observe(500us);
+        histogram.observe(1ms);
+        histogram.observe(2ms);
+        histogram.observe(5s);
+        const auto snapshot = histogram.snapshot();
+        CHECK(snapshot.counts == std::vector<uint64_t>{2, 1, 0, 1});
+        CHECK(snapshot.count == 4);
+        CHECK(snapshot.sum == 5003500us);
+        CHECK_THROWS(LatencyHistogram({1, 0.5}));
+    }
+
+    TEST_CASE("concurrent observations are all counted") {
+        LatencyHistogram histogram({0.001, 0.01});
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 8; i++) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 10000; j++)
+                    histogram.observe(j % 2 ? 5ms : 50ms);
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        const auto snapshot = histogram.snapshot();
+        CHECK(snapshot.counts == std::vector<uint64_t>{0, 40000, 40000});
+        CHECK(snapshot.sum == 40000 * 55ms);
+    }
+
+    TEST_CASE("prometheus text format") {
+        Metrics local;
+        local.events_received.add(3);
+        local.stignore_writes.add();
+        local.stignore_writes_skipped.add(2);
+        local.scan_duration.observe(20ms);
+        local.scan_queue_depth.set(4);
+        const std::string text = local.prometheus_text();
+        CHECK(text.find("# TYPE synctignore_events_received_total counter\nsynctignore_events_received_total 3\n") != std::string::npos);
+        CHECK(text.find("synctignore_stignore_writes_total{result=\"performed\"} 1\n") != std::string::npos);
+        CHECK(text.find("synctignore_stignore_writes_total{result=\"skipped\"} 2\n") != std::string::npos);
+        CHECK(text.find("synctignore_scan_duration_seconds_bucket{le=\"0.01\"} 0\n"
+                        "synctignore_scan_duration_seconds_bucket{le=\"0.05\"} 1\n") != std::string::npos);
+        CHECK(text.find("synctignore_scan_duration_seconds_bucket{le=\"+Inf\"} 1\n"
+                        "synctignore_scan_duration_seconds_sum 0.02\n"
+                        "synctignore_scan_duration_seconds_count 1\n") != std::string::npos);
+        CHECK(text.find("synctignore_scan_queue_depth 4\n") != std::string::npos);
+    }
+}
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "trace.hpp"
+
+namespace
+{
+	std::atomic<uint64_t> next_tracer_id = 1;
+
+	int64_t steady_microseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	void append_json_string(std::string& json, std::string_view text)
+	{
+		json += '"';
+		for (const char c : text)
+		{
+			if (c == '"' || c == '\\')
+				json += '\\';
+			if (static_cast<unsigned char>(c) >= 0x20)
+				json += c;
+		}
+		json += '"';
+	}
+} // namespace
+
+Tracer::Tracer() : id(next_tracer_id++), epoch(steady_microseconds())
+{
+}
+
+void Tracer::set_enabled(bool enabled)
+{
+	active.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t Tracer::now() const
+{
+	return steady_microseconds() - epoch;
+}
+
+Tracer::ThreadBuffer& Tracer::thread_buffer()
+{
+	// Buffers of the calling thread, by tracer id, as the program has a single tracer the search
+	// stops at the first one
+	thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadBuffer>>> thread_buffers;
+	for (const auto& [tracer_id, buffer] : thread_buffers)
+	{
+		if (tracer_id == id)
+			return *buffer;
+	}
+
+	auto buffer = std::make_shared<ThreadBuffer>();
+	{
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		buffer->thread = static_cast<uint32_t>(buffers.size() + 1);
+		buffers.push_back(buffer);
+	}
+	thread_buffers.emplace_back(id, buffer);
+	return *buffer;
+}
+
+void Tracer::record(const Event& event)
+{
+	ThreadBuffer& buffer = thread_buffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	if (buffer.events.size() >= max_thread_events)
+	{
+		dropped_events.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	buffer.events.push_back(event);
+}
+
+void Tracer::complete(const char* name, int64_t start, int64_t duration)
+{
+	record(Event{.name = name, .phase = 'X', .timestamp = start, .value = duration});
+}
+
+void Tracer::counter(const char* name, int64_t value)
+{
+	record(Event{.name = name, .phase = 'C', .timestamp = now(), .value = value});
+}
+
+size_t Tracer::event_count() const
+{
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	size_t count = 0;
+	for (const auto& buffer : buffers)
+	{
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		count += buffer->events.size();
+	}
+	return count;
+}
+
+void Tracer::clear()
+{
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	for (const auto& buffer : buffers)
+	{
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		buffer->events.clear();
+	}
+	dropped_events.store(0, std::memory_order_relaxed);
+}
+
+std::string Tracer::chrome_json() const
+{
+	std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	for (const auto& buffer : buffers)
+	{
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		for (const Event& event : buffer->events)
+		{
+			json += first ? "\n" : ",\n";
+			first = false;
+			json += "{\"name\":";
+			append_json_string(json, event.name);
+			json += ",\"ph\":\"";
+			json += event.phase;
+			json += "\",\"pid\":1,\"tid\":" + std::to_string(buffer->thread) +
+					",\"ts\":" + std::to_string(event.timestamp);
+			if (event.phase == 'X')
+				json += ",\"dur\":" + std::to_string(event.value) + "}";
+			else
+				json += ",\"args\":{\"value\":" + std::to_string(event.value) + "}}";
+		}
+	}
+	json += "\n]}\n";
+	return json;
+}
+
+Tracer& tracer()
+{
+	static Tracer instance;
+	return instance;
+}
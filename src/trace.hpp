@@ -0,0 +1,116 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timings and counters of the hot paths, written as Chrome trace_event JSON for chrome://tracing
+// or Perfetto.
+// Recording is off by default, a scope then costs a relaxed atomic load. Once on, each thread
+// records into a buffer of its own, so that threads never wait for each other, and the buffers
+// are merged when the trace is written.
+class Tracer
+{
+  public:
+	struct Event
+	{
+		// Names are string literals, so that recording doesn't allocate
+		const char* name;
+		// 'X' for a complete event, 'C' for a counter
+		char phase;
+		// Microseconds since the tracer was created
+		int64_t timestamp;
+		// Duration in microseconds of a complete event, value of a counter
+		int64_t value;
+	};
+
+	// Events kept per thread, the later ones are dropped
+	static constexpr size_t max_thread_events = 1 << 20;
+
+	Tracer();
+
+	Tracer(const Tracer&) = delete;
+	Tracer& operator=(const Tracer&) = delete;
+
+	bool enabled() const
+	{
+		return active.load(std::memory_order_relaxed);
+	}
+	void set_enabled(bool enabled);
+
+	// Microseconds since the tracer was created
+	int64_t now() const;
+	void complete(const char* name, int64_t start, int64_t duration);
+	void counter(const char* name, int64_t value);
+
+	size_t event_count() const;
+	uint64_t dropped() const
+	{
+		return dropped_events.load(std::memory_order_relaxed);
+	}
+	// Drops the events recorded so far
+	void clear();
+
+	std::string chrome_json() const;
+
+  private:
+	struct ThreadBuffer
+	{
+		uint32_t thread;
+		// Only contended while the trace is written or cleared
+		std::mutex mutex;
+		std::vector<Event> events;
+	};
+
+	const uint64_t id;
+	const int64_t epoch;
+	std::atomic<bool> active = false;
+	std::atomic<uint64_t> dropped_events = 0;
+
+	// Buffers of all the threads that recorded, kept after the threads exit
+	mutable std::mutex buffers_mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+	ThreadBuffer& thread_buffer();
+	void record(const Event& event);
+};
+
+// Tracer shared by the whole program
+Tracer& tracer();
+
+// Records the time spent in a scope as a complete event, if the tracer is enabled when the scope
+// starts
+class TraceScope
+{
+	const char* name;
+	int64_t start = -1;
+
+  public:
+	explicit TraceScope(const char* scope_name) : name(scope_name)
+	{
+		if (tracer().enabled())
+			start = tracer().now();
+	}
+	~TraceScope()
+	{
+		if (start >= 0)
+			tracer().complete(name, start, tracer().now() - start);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// Records the value of a counter, if the tracer is enabled
+inline void trace_counter(const char* name, int64_t value)
+{
+	if (tracer().enabled())
+		tracer().counter(name, value);
+}
+
+#endif
@@ -1,9 +1,20 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <utility>
 
 #include "utils.hpp"
 
+#ifndef TB_CONFIG_OS_WINDOWS
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
 namespace fs = std::filesystem;
 
 std::string get_sys_name()
@@ -42,6 +53,21 @@ bool is_running()
 	return _is_running(program_path.c_str());
 }
 
+std::optional<fs::path> environment_path(const char* name)
+{
+	const char* value = std::getenv(name);
+	if (!value || !*value)
+		return std::nullopt;
+	return fs::path(value);
+}
+
+std::optional<fs::path> home_directory()
+{
+	if (auto home = environment_path("HOME"))
+		return home;
+	return environment_path("USERPROFILE");
+}
+
 fs::path to_windows_path(const fs::path& path)
 {
 	std::string native_path = path.string();
@@ -97,4 +123,89 @@ fs::path normalize_path(const fs::path& path)
 	}
 
 	return normalized;
+}
+
+bool contains_path(const fs::path& directory, const fs::path& path)
+{
+	return std::mismatch(directory.begin(), directory.end(), path.begin(), path.end()).first ==
+		   directory.end();
+}
+
+uint64_t hash_bytes(std::string_view data)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const char c : data)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+MappedFile::MappedFile(const fs::path& path, FileAccess access)
+{
+#ifndef TB_CONFIG_OS_WINDOWS
+	const int fd = access == FileAccess::mapped ? open(path.c_str(), O_RDONLY) : -1;
+	if (fd >= 0)
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void* region = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (region != MAP_FAILED)
+			{
+				data = static_cast<const char*>(region);
+				size = st.st_size;
+				mapped = true;
+			}
+		}
+		close(fd);
+		if (mapped)
+			return;
+	}
+#endif
+
+	std::ifstream ifs(path, std::ios::binary);
+	if (!ifs)
+		return;
+	buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	data = buffer.data();
+	size = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+	release();
+}
+
+void MappedFile::release()
+{
+#ifndef TB_CONFIG_OS_WINDOWS
+	if (mapped)
+		munmap(const_cast<char*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+	mapped = false;
+	buffer.clear();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this == &other)
+		return *this;
+
+	release();
+	const bool other_open = other.data != nullptr;
+	mapped = std::exchange(other.mapped, false);
+	size = std::exchange(other.size, 0);
+	buffer = std::move(other.buffer);
+	data = mapped ? other.data : (other_open ? buffer.data() : nullptr);
+	other.data = nullptr;
+	return *this;
 }
\ No newline at end of file
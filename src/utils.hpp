@@ -1,8 +1,11 @@
 #ifndef UTILS_H
 #define UTILS_H
 #include "cosmocc.h"
+#include <cstdint>
 #include <filesystem>
+#include <optional>
 #include <string>
+#include <string_view>
 
 std::string get_sys_name();
 std::string get_program_file();
@@ -15,5 +18,73 @@ bool is_running();
 std::filesystem::path to_unix_path(const std::filesystem::path& path);
 std::filesystem::path to_windows_path(const std::filesystem::path& path);
 std::filesystem::path normalize_path(const std::filesystem::path& path);
+// Whether the path is the directory or below it, compared lexically, both paths being normalized
+bool contains_path(const std::filesystem::path& directory, const std::filesystem::path& path);
+
+// Path held by an environment variable, nothing if it is unset or empty
+std::optional<std::filesystem::path> environment_path(const char* name);
+// Home directory of the user, from HOME or USERPROFILE
+std::optional<std::filesystem::path> home_directory();
+
+// Calls fn with each line of the buffer, as a view into it without the line terminator
+template<typename Fn> void for_each_line(std::string_view buffer, Fn&& fn)
+{
+	while (!buffer.empty())
+	{
+		const size_t end = buffer.find('\n');
+		std::string_view line = buffer.substr(0, end);
+		if (line.ends_with('\r'))
+			line.remove_suffix(1);
+		fn(line);
+		if (end == std::string_view::npos)
+			break;
+		buffer.remove_prefix(end + 1);
+	}
+}
+
+// 64-bit FNV-1a hash, stable across runs and platforms
+uint64_t hash_bytes(std::string_view data);
+
+// How a MappedFile gets the content of its file
+enum class FileAccess : uint8_t
+{
+	// Read in memory. A file truncated while mapped makes the program crash on reading it, so
+	// the files edited by the users and other programs are read.
+	read,
+	// Memory-mapped where the platform allows it, for the files the program only replaces
+	// atomically
+	mapped,
+};
+
+// Read-only view of a whole file
+class MappedFile
+{
+	const char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::string buffer;
+
+	void release();
+
+  public:
+	MappedFile() = default;
+	explicit MappedFile(const std::filesystem::path& path, FileAccess access = FileAccess::read);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool is_open() const
+	{
+		return data != nullptr;
+	}
+
+	std::string_view view() const
+	{
+		return std::string_view(data, size);
+	}
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include <algorithm>
+
+#include "worker_pool.hpp"
+
+WorkerPool::WorkerPool(size_t thread_count)
+{
+	if (!thread_count)
+		thread_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+	threads.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; i++)
+		threads.emplace_back([this] { run(); });
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	task_cv.notify_all();
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void WorkerPool::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		task_cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+		// The queue is drained before stopping
+		if (tasks.empty())
+			return;
+
+		std::function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		running++;
+		lock.unlock();
+		task();
+		lock.lock();
+		running--;
+		if (tasks.empty() && !running)
+			idle_cv.notify_all();
+	}
+}
+
+void WorkerPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	task_cv.notify_one();
+}
+
+void WorkerPool::wait_idle()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle_cv.wait(lock, [this] { return tasks.empty() && !running; });
+}
+
+size_t WorkerPool::queued_tasks() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return tasks.size();
+}
@@ -0,0 +1,46 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running submitted tasks in submission order.
+// Tasks must not throw. Destroying the pool runs the tasks already submitted, then joins.
+class WorkerPool
+{
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	size_t running = 0;
+	bool stopping = false;
+	mutable std::mutex mutex;
+	std::condition_variable task_cv;
+	std::condition_variable idle_cv;
+
+	void run();
+
+  public:
+	// At least one thread, the number of hardware threads by default
+	explicit WorkerPool(size_t thread_count = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void submit(std::function<void()> task);
+	// Waits until no task is queued nor running
+	void wait_idle();
+
+	size_t thread_count() const
+	{
+		return threads.size();
+	}
+	// Tasks submitted and not started yet
+	size_t queued_tasks() const;
+};
+
+#endif
@@ -12,20 +12,37 @@ end
 
 target("gitignore_parser")
     set_kind("static")
-    add_files("src/gitignore_parser.cpp")
+    add_files("src/aho_corasick.cpp", "src/directory_cache.cpp", "src/gitignore_lexer.cpp",
+              "src/gitignore_parser.cpp", "src/gitignore_stack.cpp", "src/ignore_sources.cpp",
+              "src/matcher_cache.cpp", "src/matcher_registry.cpp", "src/rule_matcher.cpp",
+              "src/simd_scan.cpp")
     add_deps("utils")
-    add_headerfiles("src/gitignore_parser.hpp")
+    add_headerfiles("src/aho_corasick.hpp", "src/directory_cache.hpp", "src/gitignore_lexer.hpp",
+                    "src/gitignore_parser.hpp", "src/gitignore_stack.hpp", "src/ignore_sources.hpp",
+                    "src/matcher_cache.hpp", "src/matcher_registry.hpp", "src/rule_matcher.hpp",
+                    "src/simd_scan.hpp")
+
+target("stignore")
+    set_kind("static")
+    add_files("src/stignore.cpp", "src/state_file.cpp")
+    add_deps("utils")
+    add_headerfiles("src/stignore.hpp", "src/state_file.hpp")
 
 target("utils")
     set_kind("static")
-    add_files("src/cosmocc.c", "src/utils.cpp")
-    add_headerfiles("src/cosmocc.h", "src/utils.hpp")
+    add_files("src/cosmocc.c", "src/folder_list.cpp", "src/ipc.cpp", "src/metrics.cpp",
+              "src/path_table.cpp", "src/scan_records.cpp", "src/scan_throttle.cpp",
+              "src/syncthing_config.cpp", "src/trace.cpp", "src/utils.cpp", "src/worker_pool.cpp")
+    add_headerfiles("src/cosmocc.h", "src/folder_list.hpp", "src/ipc.hpp", "src/metrics.hpp",
+                    "src/path_table.hpp", "src/scan_records.hpp", "src/scan_throttle.hpp",
+                    "src/snapshot.hpp", "src/syncthing_config.hpp", "src/trace.hpp",
+                    "src/utils.hpp", "src/worker_pool.hpp")
     add_packages("tbox", {public = true})
 
 target("synctignore")
     set_rundir("$(projectdir)")
-    add_files("src/main.cpp")
-    add_deps("utils", "gitignore_parser")
+    add_files("src/daemon.cpp", "src/folder.cpp", "src/main.cpp")
+    add_deps("utils", "gitignore_parser", "stignore")
     add_packages("nlohmann_json")
 
     -- used for win32 api (also compospolitan)
@@ -39,5 +56,10 @@ target("synctignore")
 target("tests")
     set_default(false)
     add_files("src/tests.cpp")
+    add_deps("gitignore_parser", "stignore", "utils")
+    add_packages("doctest")
+
+target("bench")
+    set_default(false)
+    add_files("src/bench.cpp")
     add_deps("gitignore_parser", "utils")
-    add_packages("doctest")
\ No newline at end of file